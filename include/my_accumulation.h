@@ -0,0 +1,287 @@
+#ifndef MY_ACCUMULATION_H
+#define MY_ACCUMULATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <my_shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+// Progressive accumulation: while nothing that affects the image changes, every frame traces one more
+// jittered sample and adds it into an RGBA32F buffer (raytracing.fs writes alpha 1, so alpha counts the
+// samples). Once targetSamples are in, frames only present the buffer.
+//
+// raytracing.fs also adds its squared luminance into a second target, which gives every pixel's
+// variance. With adaptive sampling, after ADAPTIVE_WARMUP_SAMPLES uniform passes each pass only traces
+// the pixels whose estimated error is above a threshold (adaptive_mask.fs marks the others in the
+// stencil buffer). The threshold follows occlusion query results so that about adaptiveFraction of
+// the pixels are traced per pass, always the worst ones.
+const unsigned int ADAPTIVE_WARMUP_SAMPLES = 4;
+const int ADAPTIVE_QUERIES = 3;
+
+struct Accumulator
+{
+    GLuint fbo = 0;
+    GLuint texture = 0;
+    GLuint moments = 0;     // R32F, sum of squared luminance
+    GLuint stencil = 0;     // Stencil only, so the depth test still sees no depth buffer
+    GLuint maskFbo = 0;     // Just the stencil, adaptive_mask.fs reads the other two
+    int width = 0;
+    int height = 0;
+    unsigned int sampleCount = 0;   // Passes, adaptive ones only trace part of the pixels
+    uint64_t stateKey = 0;
+
+    bool adaptive = false;
+    float adaptiveFraction = 0.25f;
+    float errorThreshold = 0.01f;
+    float tracedFraction = 1.0f;    // Of the last measured adaptive pass
+    GLuint queries[ADAPTIVE_QUERIES] = {};
+    bool queryIssued[ADAPTIVE_QUERIES] = {};
+    int nextQuery = 0;
+};
+Accumulator accumulator;
+
+void cleanupAccumulation()
+{
+    glDeleteFramebuffers(1, &accumulator.fbo);
+    glDeleteFramebuffers(1, &accumulator.maskFbo);
+    glDeleteTextures(1, &accumulator.texture);
+    glDeleteTextures(1, &accumulator.moments);
+    glDeleteRenderbuffers(1, &accumulator.stencil);
+    if (accumulator.queries[0] != 0)
+        glDeleteQueries(ADAPTIVE_QUERIES, accumulator.queries);
+    bool adaptive = accumulator.adaptive;
+    float adaptiveFraction = accumulator.adaptiveFraction;
+    accumulator = Accumulator();
+    accumulator.adaptive = adaptive;
+    accumulator.adaptiveFraction = adaptiveFraction;
+}
+
+// (Re)creates the buffer, nothing happens when it already has this size
+void setupAccumulation(int width, int height)
+{
+    if (accumulator.fbo != 0 && accumulator.width == width && accumulator.height == height)
+        return;
+    cleanupAccumulation();
+    accumulator.width = width;
+    accumulator.height = height;
+
+    glGenTextures(1, &accumulator.texture);
+    glBindTexture(GL_TEXTURE_2D, accumulator.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &accumulator.moments);
+    glBindTexture(GL_TEXTURE_2D, accumulator.moments);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenRenderbuffers(1, &accumulator.stencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, accumulator.stencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glGenFramebuffers(1, &accumulator.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, accumulator.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulator.texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, accumulator.moments, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, accumulator.stencil);
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::ACCUMULATION:: Framebuffer is not complete" << std::endl;
+
+    glGenFramebuffers(1, &accumulator.maskFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, accumulator.maskFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, accumulator.stencil);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::ACCUMULATION:: Mask framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenQueries(ADAPTIVE_QUERIES, accumulator.queries);
+}
+
+// Radical inverse in the given base, Halton(2, 3) spreads the sub-pixel offsets evenly for any count
+float haltonSequence(unsigned int index, unsigned int base)
+{
+    float result = 0.0f;
+    float fraction = 1.0f / static_cast<float>(base);
+    while (index > 0)
+    {
+        result += fraction * static_cast<float>(index % base);
+        index /= base;
+        fraction /= static_cast<float>(base);
+    }
+    return result;
+}
+
+// Shifts the projection by a sub-pixel offset in [-0.5, 0.5) pixels. Rays (through the per-frame UBO's
+// basis) and the hybrid G-buffer both follow the shifted projection, so they stay consistent. The
+// first sample is unjittered.
+glm::mat4 jitterProjection(const glm::mat4& projection, unsigned int sampleIndex, int width, int height)
+{
+    if (sampleIndex == 0)
+        return projection;
+    glm::vec2 offset(haltonSequence(sampleIndex, 2) - 0.5f, haltonSequence(sampleIndex, 3) - 0.5f);
+    glm::vec2 ndcOffset = offset * 2.0f / glm::vec2(static_cast<float>(width), static_cast<float>(height));
+    return glm::translate(glm::mat4(1.0f), glm::vec3(ndcOffset, 0.0f)) * projection;
+}
+
+// Starts the error threshold over and drops the queries still in flight, their counts belong to
+// whatever was accumulated before
+void resetAdaptiveSampling()
+{
+    accumulator.errorThreshold = Accumulator().errorThreshold;
+    accumulator.tracedFraction = 1.0f;
+    for (int i = 0; i < ADAPTIVE_QUERIES; i++)
+        accumulator.queryIssued[i] = false;
+    accumulator.nextQuery = 0;
+}
+
+// Whether this frame should trace another sample. A new stateKey (or size) clears the buffer first.
+bool needsAccumulationSample(uint64_t stateKey, int width, int height, unsigned int targetSamples)
+{
+    setupAccumulation(width, height);
+    if (stateKey != accumulator.stateKey)
+    {
+        accumulator.stateKey = stateKey;
+        accumulator.sampleCount = 0;
+        resetAdaptiveSampling();
+    }
+    if (accumulator.sampleCount == 0)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, accumulator.fbo);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    return accumulator.sampleCount < targetSamples;
+}
+
+// Wraps one traced frame: everything drawn in between is added into the buffer
+void beginAccumulationSample()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, accumulator.fbo);
+    glViewport(0, 0, accumulator.width, accumulator.height);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+}
+
+// Passes to trace for targetSamples samples per pixel on average: adaptive passes only trace
+// adaptiveFraction of the pixels, so the same sample budget buys more of them
+unsigned int accumulationPasses(unsigned int targetSamples, bool adaptive)
+{
+    if (!adaptive || targetSamples <= ADAPTIVE_WARMUP_SAMPLES)
+        return targetSamples;
+    float adaptivePasses = static_cast<float>(targetSamples - ADAPTIVE_WARMUP_SAMPLES) / accumulator.adaptiveFraction;
+    return ADAPTIVE_WARMUP_SAMPLES + static_cast<unsigned int>(std::ceil(adaptivePasses));
+}
+
+// Moves the error threshold towards the one tracing adaptiveFraction of the pixels, from the occlusion
+// queries that have finished (they count the converged pixels), never waiting on one
+void updateErrorThreshold()
+{
+    for (int i = 0; i < ADAPTIVE_QUERIES; i++)
+    {
+        if (!accumulator.queryIssued[i])
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(accumulator.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != GL_TRUE)
+            continue;
+        GLuint converged = 0;
+        glGetQueryObjectuiv(accumulator.queries[i], GL_QUERY_RESULT, &converged);
+        accumulator.queryIssued[i] = false;
+
+        float pixels = static_cast<float>(accumulator.width) * static_cast<float>(accumulator.height);
+        accumulator.tracedFraction = 1.0f - static_cast<float>(converged) / pixels;
+        float ratio = std::max(accumulator.tracedFraction, 0.001f) / accumulator.adaptiveFraction;
+        accumulator.errorThreshold *= std::clamp(std::sqrt(ratio), 0.5f, 2.0f);
+        accumulator.errorThreshold = std::clamp(accumulator.errorThreshold, 1e-5f, 10.0f);
+    }
+}
+
+// beginAccumulationSample for the fragment pass with adaptive sampling: past the warm-up the pixels
+// that have converged are marked in the stencil buffer first (maskShader is adaptive_mask.fs, vao a
+// fullscreen triangle) and the traced pass skips them
+void beginAdaptiveSample(Shader& maskShader, GLuint vao)
+{
+    if (accumulator.sampleCount < ADAPTIVE_WARMUP_SAMPLES)
+    {
+        beginAccumulationSample();
+        return;
+    }
+    updateErrorThreshold();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, accumulator.maskFbo);
+    glViewport(0, 0, accumulator.width, accumulator.height);
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    maskShader.use();
+    maskShader.setInt("accumulation", 0);
+    maskShader.setInt("moments", 1);
+    maskShader.setFloat("errorThreshold", accumulator.errorThreshold);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, accumulator.texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, accumulator.moments);
+    glActiveTexture(GL_TEXTURE0);
+
+    bool counted = !accumulator.queryIssued[accumulator.nextQuery];
+    if (counted)
+        glBeginQuery(GL_SAMPLES_PASSED, accumulator.queries[accumulator.nextQuery]);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    if (counted)
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        accumulator.queryIssued[accumulator.nextQuery] = true;
+        accumulator.nextQuery = (accumulator.nextQuery + 1) % ADAPTIVE_QUERIES;
+    }
+
+    glStencilFunc(GL_EQUAL, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    beginAccumulationSample();
+}
+
+void endAccumulationSample()
+{
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    accumulator.sampleCount++;
+}
+
+// Draws the average of the samples summed in texture (alpha counts them) into the bound framebuffer
+// with a fullscreen triangle (vao)
+void presentTexture(Shader& shader, GLuint texture, GLuint vao)
+{
+    shader.use();
+    shader.setInt("accumulation", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+}
+
+// Draws the average of every sample so far
+void presentAccumulation(Shader& shader, GLuint vao)
+{
+    presentTexture(shader, accumulator.texture, vao);
+}
+
+#endif // MY_ACCUMULATION_H
@@ -0,0 +1,278 @@
+#ifndef MY_ANIMATION_H
+#define MY_ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <assimp/scene.h>
+
+#include <my_parallel.h>
+
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Skeletal animation: bone weights are read per vertex in Model::processMesh, keyframed channels per
+// animation here. The Animator samples one animation into a bone matrix palette that skinVertices()
+// applies on the CPU, the raytracer then refits its BVH over the skinned triangles.
+
+#define MAX_BONE_INFLUENCE 4
+
+struct BoneInfo
+{
+    int id;
+    glm::mat4 offset;   // Mesh space to bone space in the bind pose
+};
+
+glm::mat4 aiToGlm(const aiMatrix4x4& m)
+{
+    // Assimp is row-major, glm column-major
+    glm::mat4 out;
+    out[0][0] = m.a1; out[1][0] = m.a2; out[2][0] = m.a3; out[3][0] = m.a4;
+    out[0][1] = m.b1; out[1][1] = m.b2; out[2][1] = m.b3; out[3][1] = m.b4;
+    out[0][2] = m.c1; out[1][2] = m.c2; out[2][2] = m.c3; out[3][2] = m.c4;
+    out[0][3] = m.d1; out[1][3] = m.d2; out[2][3] = m.d3; out[3][3] = m.d4;
+    return out;
+}
+
+// Keyframes of one bone (or any animated node)
+struct BoneChannel
+{
+    std::vector<std::pair<float, glm::vec3>> positions;
+    std::vector<std::pair<float, glm::quat>> rotations;
+    std::vector<std::pair<float, glm::vec3>> scales;
+
+    // Index of the last key at or before time (keys are sorted by time)
+    template <typename T>
+    static size_t keyBefore(const std::vector<std::pair<float, T>>& keys, float time)
+    {
+        size_t k = 0;
+        while (k + 2 <= keys.size() && keys[k + 1].first <= time)
+            k++;
+        return k;
+    }
+
+    template <typename T>
+    static float keyFactor(const std::vector<std::pair<float, T>>& keys, size_t k, float time)
+    {
+        if (k + 1 >= keys.size())
+            return 0.0f;
+        float span = keys[k + 1].first - keys[k].first;
+        return span > 0.0f ? glm::clamp((time - keys[k].first) / span, 0.0f, 1.0f) : 0.0f;
+    }
+
+    glm::mat4 sample(float time) const
+    {
+        glm::vec3 position(0.0f);
+        if (!positions.empty())
+        {
+            size_t k = keyBefore(positions, time);
+            size_t next = std::min(k + 1, positions.size() - 1);
+            position = glm::mix(positions[k].second, positions[next].second, keyFactor(positions, k, time));
+        }
+
+        glm::quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+        if (!rotations.empty())
+        {
+            size_t k = keyBefore(rotations, time);
+            size_t next = std::min(k + 1, rotations.size() - 1);
+            rotation = glm::normalize(glm::slerp(rotations[k].second, rotations[next].second, keyFactor(rotations, k, time)));
+        }
+
+        glm::vec3 scale(1.0f);
+        if (!scales.empty())
+        {
+            size_t k = keyBefore(scales, time);
+            size_t next = std::min(k + 1, scales.size() - 1);
+            scale = glm::mix(scales[k].second, scales[next].second, keyFactor(scales, k, time));
+        }
+
+        return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+    }
+};
+
+// Node hierarchy flattened parent-first, so one forward pass computes every global transform
+struct AnimationNode
+{
+    std::string name;
+    int parent;                 // -1 for the root
+    int channel;                // Index into Animation::channels, -1 when the node isn't animated
+    int boneId;                 // -1 when the node doesn't drive any vertices
+    glm::mat4 transform;        // Rest transform relative to the parent
+};
+
+struct Animation
+{
+    std::string name;
+    float duration = 0.0f;          // Ticks
+    float ticksPerSecond = 25.0f;
+    std::vector<BoneChannel> channels;
+    std::vector<AnimationNode> nodes;
+    glm::mat4 globalInverseTransform = glm::mat4(1.0f);
+};
+
+void flattenAnimationNodes(const aiNode* node, int parent, const std::map<std::string, int>& channelIds,
+    const std::map<std::string, BoneInfo>& boneInfoMap, std::vector<AnimationNode>& nodes)
+{
+    AnimationNode flat;
+    flat.name = node->mName.C_Str();
+    flat.parent = parent;
+    auto channel = channelIds.find(flat.name);
+    flat.channel = channel != channelIds.end() ? channel->second : -1;
+    auto bone = boneInfoMap.find(flat.name);
+    flat.boneId = bone != boneInfoMap.end() ? bone->second.id : -1;
+    flat.transform = aiToGlm(node->mTransformation);
+
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(flat);
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+        flattenAnimationNodes(node->mChildren[i], index, channelIds, boneInfoMap, nodes);
+}
+
+Animation loadAnimation(const aiAnimation* anim, const aiScene* scene, const std::map<std::string, BoneInfo>& boneInfoMap)
+{
+    Animation animation;
+    animation.name = anim->mName.C_Str();
+    animation.duration = static_cast<float>(anim->mDuration);
+    if (anim->mTicksPerSecond > 0.0)
+        animation.ticksPerSecond = static_cast<float>(anim->mTicksPerSecond);
+    animation.globalInverseTransform = glm::inverse(aiToGlm(scene->mRootNode->mTransformation));
+
+    std::map<std::string, int> channelIds;
+    for (unsigned int c = 0; c < anim->mNumChannels; c++)
+    {
+        const aiNodeAnim* nodeAnim = anim->mChannels[c];
+        BoneChannel channel;
+        for (unsigned int k = 0; k < nodeAnim->mNumPositionKeys; k++)
+        {
+            const aiVectorKey& key = nodeAnim->mPositionKeys[k];
+            channel.positions.push_back({ static_cast<float>(key.mTime), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
+        }
+        for (unsigned int k = 0; k < nodeAnim->mNumRotationKeys; k++)
+        {
+            const aiQuatKey& key = nodeAnim->mRotationKeys[k];
+            channel.rotations.push_back({ static_cast<float>(key.mTime), glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z) });
+        }
+        for (unsigned int k = 0; k < nodeAnim->mNumScalingKeys; k++)
+        {
+            const aiVectorKey& key = nodeAnim->mScalingKeys[k];
+            channel.scales.push_back({ static_cast<float>(key.mTime), glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
+        }
+        channelIds[nodeAnim->mNodeName.C_Str()] = static_cast<int>(animation.channels.size());
+        animation.channels.push_back(channel);
+    }
+
+    flattenAnimationNodes(scene->mRootNode, -1, channelIds, boneInfoMap, animation.nodes);
+    return animation;
+}
+
+// Plays one animation in a loop and keeps the bone matrix palette for the current time
+class Animator
+{
+public:
+    std::vector<glm::mat4> boneMatrices;
+
+    void play(const Animation* anim, const std::map<std::string, BoneInfo>& boneInfoMap)
+    {
+        animation = anim;
+        currentTime = 0.0f;
+        boneOffsets.assign(boneInfoMap.size(), glm::mat4(1.0f));
+        for (const auto& bone : boneInfoMap)
+            boneOffsets[bone.second.id] = bone.second.offset;
+        boneMatrices.assign(boneOffsets.size(), glm::mat4(1.0f));
+        globalTransforms.resize(anim ? anim->nodes.size() : 0);
+    }
+
+    void update(float deltaTime)
+    {
+        if (!animation)
+            return;
+
+        currentTime += animation->ticksPerSecond * deltaTime;
+        if (animation->duration > 0.0f)
+            currentTime = std::fmod(currentTime, animation->duration);
+
+        for (size_t n = 0; n < animation->nodes.size(); n++)
+        {
+            const AnimationNode& node = animation->nodes[n];
+            glm::mat4 local = node.channel >= 0 ? animation->channels[node.channel].sample(currentTime) : node.transform;
+            globalTransforms[n] = node.parent >= 0 ? globalTransforms[node.parent] * local : local;
+            if (node.boneId >= 0)
+                boneMatrices[node.boneId] = animation->globalInverseTransform * globalTransforms[n] * boneOffsets[node.boneId];
+        }
+    }
+
+private:
+    const Animation* animation = nullptr;
+    float currentTime = 0.0f;
+    std::vector<glm::mat4> boneOffsets;
+    std::vector<glm::mat4> globalTransforms;
+};
+
+// Per-frame timings of the animated model, shown in the GUI
+struct AnimationStats
+{
+    double animateMs = 0.0;     // Sampling keyframes into the bone palette
+    double skinMs = 0.0;
+    double refitMs = 0.0;       // Refit (and wide re-collapse) or full rebuild
+    double uploadMs = 0.0;
+    float sahRatio = 1.0f;      // Refitted SAH cost over the cost right after the last build
+    unsigned int rebuilds = 0;
+    bool rebuilt = false;       // This frame rebuilt instead of refitting
+};
+
+// Linear blend skinning of bind-pose positions and normals, vertices without weights keep the bind pose.
+// Normals blend each bone's inverse transpose, so they stay perpendicular under non-uniform bone scale.
+template <typename VertexT>
+void skinVertices(const std::vector<VertexT>& bindVertices, const std::vector<glm::mat4>& boneMatrices,
+    std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, unsigned int threadCount = 0)
+{
+    positions.resize(bindVertices.size());
+    normals.resize(bindVertices.size());
+
+    // Once per palette entry rather than per vertex, a collapsed (zero scale) bone keeps its plain matrix
+    std::vector<glm::mat3> normalMatrices(boneMatrices.size());
+    for (size_t b = 0; b < boneMatrices.size(); b++)
+    {
+        glm::mat3 bone(boneMatrices[b]);
+        normalMatrices[b] = std::abs(glm::determinant(bone)) > 1e-12f ? glm::inverseTranspose(bone) : bone;
+    }
+
+    parallelFor(0, bindVertices.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t v = begin; v < end; v++)
+        {
+            const VertexT& vertex = bindVertices[v];
+            glm::mat4 skin(0.0f);
+            glm::mat3 normalSkin(0.0f);
+            float total = 0.0f;
+            for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+            {
+                int bone = vertex.BoneIDs[i];
+                if (bone < 0 || bone >= static_cast<int>(boneMatrices.size()) || vertex.Weights[i] <= 0.0f)
+                    continue;
+                skin += boneMatrices[bone] * vertex.Weights[i];
+                normalSkin += normalMatrices[bone] * vertex.Weights[i];
+                total += vertex.Weights[i];
+            }
+            // Renormalise, influences beyond MAX_BONE_INFLUENCE were dropped
+            if (total <= 0.0f)
+            {
+                skin = glm::mat4(1.0f);
+                normalSkin = glm::mat3(1.0f);
+            }
+            else
+                skin /= total;
+
+            // The normal is normalised anyway, so its blend doesn't need dividing by the total
+            positions[v] = glm::vec3(skin * glm::vec4(vertex.Position, 1.0f));
+            normals[v] = glm::normalize(normalSkin * vertex.Normal);
+        }
+    }, threadCount);
+}
+
+#endif // MY_ANIMATION_H
@@ -0,0 +1,542 @@
+#ifndef MY_BVH_H
+#define MY_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <my_parallel.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cfloat>
+
+// Axis-aligned bounding box
+struct AABB
+{
+    glm::vec3 bmin = glm::vec3(FLT_MAX);
+    glm::vec3 bmax = glm::vec3(-FLT_MAX);
+
+    void grow(const glm::vec3& p)
+    {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+
+    void grow(const AABB& b)
+    {
+        bmin = glm::min(bmin, b.bmin);
+        bmax = glm::max(bmax, b.bmax);
+    }
+
+    bool valid() const
+    {
+        return bmin.x <= bmax.x && bmin.y <= bmax.y && bmin.z <= bmax.z;
+    }
+
+    glm::vec3 centroid() const
+    {
+        return 0.5f * (bmin + bmax);
+    }
+
+    // Half surface area (the 2x factor cancels out in every SAH ratio)
+    float area() const
+    {
+        if (!valid())
+            return 0.0f;
+        glm::vec3 e = bmax - bmin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+// Flattened BVH node, 32 bytes, matches BVHNode in raytracing.fs (std430)
+// Interior nodes: leftFirst = index of left child (right child is leftFirst + 1), triCount = 0
+// Leaf nodes: leftFirst = first primitive in the reordered primitive array, triCount = primitive count
+struct GPUBVHNode
+{
+    glm::vec3 aabbMin;
+    unsigned int leftFirst;
+    glm::vec3 aabbMax;
+    unsigned int triCount;
+
+    bool isLeaf() const { return triCount > 0; }
+};
+
+// Quality builds trade build time for trace speed, fast builds the other way round
+enum BVHBuildMode
+{
+    QualityBuild = 0,   // Binned SAH
+    FastBuild = 1,          // LBVH
+    SpatialSplitBuild = 2   // SBVH
+};
+
+// Builder parameters
+struct BVHBuildParams
+{
+    BVHBuildMode mode = QualityBuild;
+    int width = 2;                  // 2 = binary nodes, 4 or 8 = collapse into compressed wide nodes
+    int binCount = 16;              // SAH candidate planes per axis
+    int maxLeafSize = 4;            // Leaves larger than this are always split if possible
+    float traversalCost = 1.0f;     // Relative cost of visiting an interior node
+    float intersectCost = 1.0f;     // Relative cost of a ray-primitive test
+    unsigned int threadCount = 0;   // 0 = one per hardware thread
+    unsigned int taskThreshold = 4096;          // Subtrees at least this big are built on their own task
+    unsigned int parallelBinThreshold = 65536;  // Nodes at least this big bin their primitives in parallel
+    float spatialSplitBudget = 0.3f;    // SBVH: extra references allowed, as a fraction of the primitive count
+    float spatialSplitAlpha = 1e-5f;    // SBVH: child overlap (relative to the root area) that triggers a spatial split search
+};
+
+struct BVH
+{
+    std::vector<GPUBVHNode> nodes;
+    std::vector<unsigned int> primIndices; // Leaf ranges index into this, values index the input primitives
+};
+
+// Per-build telemetry, printed after every build so it can be tracked release to release
+struct BVHBuildStats
+{
+    std::string builder;
+    size_t primCount = 0;
+    size_t referenceCount = 0;  // Primitive references in leaves, above primCount when SBVH duplicates triangles
+    unsigned int nodeCount = 0;
+    unsigned int leafCount = 0;
+    unsigned int maxDepth = 0;
+    unsigned int threadCount = 0;
+    double buildTimeMs = 0.0;
+    size_t peakMemoryBytes = 0;
+    float sahCost = 0.0f;
+    int width = 2;                  // Above 2 when the tree was collapsed into wide nodes
+    unsigned int wideNodeCount = 0;
+    size_t nodeBytes = 0;           // Size of the node buffer uploaded to the GPU
+};
+
+void printBVHBuildStats(const BVHBuildStats& stats)
+{
+    std::cout << "BVH Build (" << stats.builder << "):\n";
+    std::cout << "> Primitives: " << stats.primCount << "\n";
+    if (stats.referenceCount > stats.primCount)
+        std::cout << "> References: " << stats.referenceCount << "\n";
+    std::cout << "> Nodes: " << stats.nodeCount << " (" << stats.leafCount << " leaves, depth " << stats.maxDepth << ")\n";
+    std::cout << "> Threads: " << stats.threadCount << "\n";
+    std::cout << "> Build Time: " << stats.buildTimeMs << " ms\n";
+    std::cout << "> Peak Memory: " << static_cast<double>(stats.peakMemoryBytes) / (1024.0 * 1024.0) << " MB\n";
+    std::cout << "> SAH Cost: " << stats.sahCost << "\n";
+    if (stats.width > 2)
+        std::cout << "> Wide Nodes: " << stats.wideNodeCount << " (BVH" << stats.width << ")\n";
+    std::cout << "> Node Memory: " << static_cast<double>(stats.nodeBytes) / 1024.0 << " KB\n";
+}
+
+// Expected cost of a random ray through the tree relative to the root box, lower traces faster
+float computeSAHCost(const BVH& bvh, const BVHBuildParams& params = BVHBuildParams())
+{
+    if (bvh.nodes.empty())
+        return 0.0f;
+
+    AABB rootBox;
+    rootBox.bmin = bvh.nodes[0].aabbMin;
+    rootBox.bmax = bvh.nodes[0].aabbMax;
+    float rootArea = rootBox.area();
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    double cost = 0.0;
+    for (const GPUBVHNode& node : bvh.nodes)
+    {
+        AABB box;
+        box.bmin = node.aabbMin;
+        box.bmax = node.aabbMax;
+        double weight = box.area() / rootArea;
+        cost += node.isLeaf() ? weight * params.intersectCost * node.triCount : weight * params.traversalCost;
+    }
+    return static_cast<float>(cost);
+}
+
+// Recomputes every node box bottom-up after the primitives moved, keeping the topology. Children are
+// always allocated after their parent, so a reverse sweep reaches both children before the parent.
+void refitBVH(BVH& bvh, const std::vector<AABB>& primBounds)
+{
+    for (size_t n = bvh.nodes.size(); n-- > 0;)
+    {
+        GPUBVHNode& node = bvh.nodes[n];
+        AABB box;
+        if (node.isLeaf())
+        {
+            for (unsigned int i = 0; i < node.triCount; i++)
+                box.grow(primBounds[bvh.primIndices[node.leftFirst + i]]);
+        }
+        else
+        {
+            for (unsigned int c = node.leftFirst; c <= node.leftFirst + 1; c++)
+            {
+                box.grow(bvh.nodes[c].aabbMin);
+                box.grow(bvh.nodes[c].aabbMax);
+            }
+        }
+        node.aabbMin = box.bmin;
+        node.aabbMax = box.bmax;
+    }
+}
+
+// Per-node links for the short-stack and stackless kernels in raytracing.fs: parent << 3 | swap << 2 | axis.
+// axis is the one an interior node's children are furthest apart along and swap is set when the right
+// child comes first along it, so a ray can pick the near child from its direction sign alone.
+std::vector<unsigned int> computeBVHLinks(const BVH& bvh)
+{
+    std::vector<unsigned int> links(bvh.nodes.size(), 0u);
+    for (size_t n = 0; n < bvh.nodes.size(); n++)
+    {
+        const GPUBVHNode& node = bvh.nodes[n];
+        if (node.isLeaf())
+            continue;
+
+        const GPUBVHNode& left = bvh.nodes[node.leftFirst];
+        const GPUBVHNode& right = bvh.nodes[node.leftFirst + 1];
+        glm::vec3 separation = 0.5f * ((right.aabbMin + right.aabbMax) - (left.aabbMin + left.aabbMax));
+        glm::vec3 absSeparation = glm::abs(separation);
+        unsigned int axis = absSeparation.x >= absSeparation.y
+            ? (absSeparation.x >= absSeparation.z ? 0u : 2u)
+            : (absSeparation.y >= absSeparation.z ? 1u : 2u);
+        unsigned int swap = separation[axis] < 0.0f ? 1u : 0u;
+
+        unsigned int parent = static_cast<unsigned int>(n) << 3;
+        links[node.leftFirst] = parent | (links[node.leftFirst] & 7u);
+        links[node.leftFirst + 1] = parent | (links[node.leftFirst + 1] & 7u);
+        links[n] = (links[n] & ~7u) | swap << 2 | axis;
+    }
+    return links;
+}
+
+// Tracks builder allocations (nodes, indices and scratch) to report the peak footprint
+class BuildMemoryTracker
+{
+public:
+    void allocate(size_t bytes)
+    {
+        size_t now = current.fetch_add(bytes) + bytes;
+        size_t prev = peak.load();
+        while (now > prev && !peak.compare_exchange_weak(prev, now))
+            ;
+    }
+
+    void release(size_t bytes)
+    {
+        current.fetch_sub(bytes);
+    }
+
+    size_t peakBytes() const
+    {
+        return peak.load();
+    }
+
+private:
+    std::atomic<size_t> current{ 0 };
+    std::atomic<size_t> peak{ 0 };
+};
+
+// Multithreaded binned SAH builder over arbitrary primitive bounds (triangles today, instances later)
+// Large nodes accumulate their bins in parallel, large subtrees are split off as separate tasks
+class BVHBuilder
+{
+public:
+    BVHBuilder(const std::vector<AABB>& primBounds, const BVHBuildParams& params)
+        : bounds(primBounds), params(params)
+    {
+        threadCount = params.threadCount > 0 ? params.threadCount : defaultThreadCount();
+    }
+
+    BVH build(BVHBuildStats* stats = nullptr)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        BVH bvh;
+        size_t primCount = bounds.size();
+        if (primCount > 0)
+        {
+            // Centroids drive the binning, bounds drive the SAH areas
+            centroids.resize(primCount);
+            bvh.primIndices.resize(primCount);
+            memory.allocate(primCount * (sizeof(glm::vec3) + sizeof(unsigned int)));
+            parallelFor(0, primCount, [&](size_t begin, size_t end, unsigned int)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    centroids[i] = bounds[i].centroid();
+                    bvh.primIndices[i] = static_cast<unsigned int>(i);
+                }
+            }, threadCount);
+
+            // A binary tree with N leaves never needs more than 2N - 1 nodes
+            bvh.nodes.resize(2 * primCount - 1);
+            memory.allocate(bvh.nodes.size() * sizeof(GPUBVHNode));
+            nodesUsed = 1;
+
+            GPUBVHNode& root = bvh.nodes[0];
+            root.leftFirst = 0;
+            root.triCount = static_cast<unsigned int>(primCount);
+            updateNodeBounds(bvh, 0);
+            subdivide(bvh, 0, 0);
+
+            bvh.nodes.resize(nodesUsed);
+            bvh.nodes.shrink_to_fit();
+            memory.release(centroids.size() * sizeof(glm::vec3));
+            centroids.clear();
+            centroids.shrink_to_fit();
+        }
+
+        if (stats)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            stats->builder = "Binned SAH";
+            stats->primCount = primCount;
+            stats->referenceCount = bvh.primIndices.size();
+            stats->nodeCount = static_cast<unsigned int>(bvh.nodes.size());
+            stats->leafCount = leafCount.load();
+            stats->maxDepth = maxDepth.load();
+            stats->threadCount = threadCount;
+            stats->buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+            stats->peakMemoryBytes = memory.peakBytes();
+        }
+        return bvh;
+    }
+
+private:
+    const std::vector<AABB>& bounds;
+    BVHBuildParams params;
+    unsigned int threadCount;
+    std::vector<glm::vec3> centroids;
+    std::atomic<unsigned int> nodesUsed{ 0 };
+    std::atomic<unsigned int> leafCount{ 0 };
+    std::atomic<unsigned int> maxDepth{ 0 };
+    std::atomic<unsigned int> activeTasks{ 0 };
+    BuildMemoryTracker memory;
+
+    struct Bin
+    {
+        AABB box;
+        unsigned int count = 0;
+    };
+
+    void updateNodeBounds(BVH& bvh, unsigned int nodeIdx)
+    {
+        GPUBVHNode& node = bvh.nodes[nodeIdx];
+        AABB box;
+        for (unsigned int i = 0; i < node.triCount; i++)
+            box.grow(bounds[bvh.primIndices[node.leftFirst + i]]);
+        node.aabbMin = box.bmin;
+        node.aabbMax = box.bmax;
+    }
+
+    void makeLeaf(unsigned int depth)
+    {
+        leafCount++;
+        unsigned int prev = maxDepth.load();
+        while (depth > prev && !maxDepth.compare_exchange_weak(prev, depth))
+            ;
+    }
+
+    // Fills bins[axis * binCount + b] for one primitive range
+    void accumulateBins(const BVH& bvh, unsigned int first, unsigned int count,
+        const AABB& centroidBox, std::vector<Bin>& bins) const
+    {
+        int binCount = params.binCount;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float boundsMin = centroidBox.bmin[axis];
+            float boundsMax = centroidBox.bmax[axis];
+            if (boundsMin == boundsMax)
+                continue;
+
+            float scale = static_cast<float>(binCount) / (boundsMax - boundsMin);
+            Bin* axisBins = bins.data() + axis * binCount;
+            for (unsigned int i = 0; i < count; i++)
+            {
+                unsigned int prim = bvh.primIndices[first + i];
+                int binIdx = std::min(binCount - 1, static_cast<int>((centroids[prim][axis] - boundsMin) * scale));
+                axisBins[binIdx].count++;
+                axisBins[binIdx].box.grow(bounds[prim]);
+            }
+        }
+    }
+
+    // Evaluates binCount - 1 split planes per axis, returns the cheapest SAH cost
+    float findBestSplit(const BVH& bvh, const GPUBVHNode& node, int& bestAxis, float& bestPos)
+    {
+        int binCount = params.binCount;
+        bool parallel = node.triCount >= params.parallelBinThreshold && threadCount > 1;
+        std::vector<Bin> bins(3 * binCount);
+        size_t scratchBytes = bins.size() * sizeof(Bin) * (parallel ? threadCount + 1 : 1);
+        memory.allocate(scratchBytes);
+
+        // Bin over centroid bounds, not node bounds, so no bins are wasted
+        AABB centroidBox;
+        if (parallel)
+        {
+            std::vector<AABB> partialBoxes(threadCount);
+            std::vector<std::vector<Bin>> partialBins(threadCount, std::vector<Bin>(3 * binCount));
+            parallelFor(node.leftFirst, node.leftFirst + node.triCount, [&](size_t begin, size_t end, unsigned int t)
+            {
+                for (size_t i = begin; i < end; i++)
+                    partialBoxes[t].grow(centroids[bvh.primIndices[i]]);
+            }, threadCount);
+            for (const AABB& box : partialBoxes)
+                centroidBox.grow(box);
+
+            parallelFor(node.leftFirst, node.leftFirst + node.triCount, [&](size_t begin, size_t end, unsigned int t)
+            {
+                accumulateBins(bvh, static_cast<unsigned int>(begin), static_cast<unsigned int>(end - begin),
+                    centroidBox, partialBins[t]);
+            }, threadCount);
+
+            // Merge per-thread bins
+            for (const auto& threadBins : partialBins)
+            {
+                for (size_t b = 0; b < bins.size(); b++)
+                {
+                    bins[b].count += threadBins[b].count;
+                    bins[b].box.grow(threadBins[b].box);
+                }
+            }
+        }
+        else
+        {
+            for (unsigned int i = 0; i < node.triCount; i++)
+                centroidBox.grow(centroids[bvh.primIndices[node.leftFirst + i]]);
+            accumulateBins(bvh, node.leftFirst, node.triCount, centroidBox, bins);
+        }
+
+        float bestCost = FLT_MAX;
+        std::vector<float> leftArea(binCount - 1), rightArea(binCount - 1);
+        std::vector<unsigned int> leftCount(binCount - 1), rightCount(binCount - 1);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float boundsMin = centroidBox.bmin[axis];
+            float boundsMax = centroidBox.bmax[axis];
+            if (boundsMin == boundsMax)
+                continue;
+
+            // Sweep from both sides to get the area and count on each side of every plane
+            const Bin* axisBins = bins.data() + axis * binCount;
+            AABB leftBox, rightBox;
+            unsigned int leftSum = 0, rightSum = 0;
+            for (int i = 0; i < binCount - 1; i++)
+            {
+                leftSum += axisBins[i].count;
+                leftCount[i] = leftSum;
+                leftBox.grow(axisBins[i].box);
+                leftArea[i] = leftBox.area();
+
+                rightSum += axisBins[binCount - 1 - i].count;
+                rightCount[binCount - 2 - i] = rightSum;
+                rightBox.grow(axisBins[binCount - 1 - i].box);
+                rightArea[binCount - 2 - i] = rightBox.area();
+            }
+
+            float binWidth = (boundsMax - boundsMin) / static_cast<float>(binCount);
+            for (int i = 0; i < binCount - 1; i++)
+            {
+                float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (planeCost < bestCost)
+                {
+                    bestCost = planeCost;
+                    bestAxis = axis;
+                    bestPos = boundsMin + binWidth * static_cast<float>(i + 1);
+                }
+            }
+        }
+
+        memory.release(scratchBytes);
+        return bestCost;
+    }
+
+    void subdivide(BVH& bvh, unsigned int nodeIdx, unsigned int depth)
+    {
+        GPUBVHNode& node = bvh.nodes[nodeIdx];
+        if (node.triCount <= 1)
+        {
+            makeLeaf(depth);
+            return;
+        }
+
+        // SAH: C = Ct + Ci * (Nl * Al + Nr * Ar) / A
+        int axis = -1;
+        float splitPos = 0.0f;
+        float planeCost = findBestSplit(bvh, node, axis, splitPos);
+        if (axis < 0)
+        {
+            makeLeaf(depth); // All centroids coincide, nothing to split
+            return;
+        }
+
+        AABB nodeBox;
+        nodeBox.bmin = node.aabbMin;
+        nodeBox.bmax = node.aabbMax;
+        float splitCost = params.traversalCost + params.intersectCost * planeCost / nodeBox.area();
+        float leafCost = params.intersectCost * static_cast<float>(node.triCount);
+        if (splitCost >= leafCost && node.triCount <= static_cast<unsigned int>(params.maxLeafSize))
+        {
+            makeLeaf(depth);
+            return;
+        }
+
+        // In-place partition of the primitive range
+        unsigned int* first = bvh.primIndices.data() + node.leftFirst;
+        unsigned int* last = first + node.triCount;
+        unsigned int* mid = std::partition(first, last,
+            [&](unsigned int prim) { return centroids[prim][axis] < splitPos; });
+        unsigned int leftCount = static_cast<unsigned int>(mid - first);
+        if (leftCount == 0 || leftCount == node.triCount)
+        {
+            makeLeaf(depth);
+            return;
+        }
+
+        // Create child nodes (always adjacent, so only the left index is stored)
+        unsigned int leftIdx = nodesUsed.fetch_add(2);
+        unsigned int rightIdx = leftIdx + 1;
+        bvh.nodes[leftIdx].leftFirst = node.leftFirst;
+        bvh.nodes[leftIdx].triCount = leftCount;
+        bvh.nodes[rightIdx].leftFirst = node.leftFirst + leftCount;
+        bvh.nodes[rightIdx].triCount = node.triCount - leftCount;
+        node.leftFirst = leftIdx;
+        node.triCount = 0;
+
+        updateNodeBounds(bvh, leftIdx);
+        updateNodeBounds(bvh, rightIdx);
+
+        // Children own disjoint primitive ranges and node slots, so they can be built concurrently. The
+        // task slot is reserved with one fetch_add, a separate check would let concurrent nodes overshoot.
+        bool spawnTask = std::min(leftCount, bvh.nodes[rightIdx].triCount) >= params.taskThreshold;
+        if (spawnTask && activeTasks.fetch_add(1) + 1 >= threadCount)
+        {
+            activeTasks.fetch_sub(1);
+            spawnTask = false;
+        }
+        if (spawnTask)
+        {
+            std::thread leftTask([this, &bvh, leftIdx, depth]()
+            {
+                subdivide(bvh, leftIdx, depth + 1);
+                activeTasks--;
+            });
+            subdivide(bvh, rightIdx, depth + 1);
+            leftTask.join();
+        }
+        else
+        {
+            subdivide(bvh, leftIdx, depth + 1);
+            subdivide(bvh, rightIdx, depth + 1);
+        }
+    }
+};
+
+BVH buildBVH(const std::vector<AABB>& primBounds, const BVHBuildParams& params = BVHBuildParams(),
+    BVHBuildStats* stats = nullptr)
+{
+    BVHBuilder builder(primBounds, params);
+    return builder.build(stats);
+}
+
+#endif // MY_BVH_H
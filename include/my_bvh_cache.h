@@ -0,0 +1,312 @@
+#ifndef MY_BVH_CACHE_H
+#define MY_BVH_CACHE_H
+
+#include <my_bvh.h>
+#include <my_hash.h>
+#include <my_wide_bvh.h>
+
+#include <filesystem> // Requires C++17
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// On-disk cache of built acceleration structures. Each file holds the binary BVH, the wide BVH (if
+// any), the reordered triangle array and the build stats, keyed by a hash of the triangle data and
+// every build parameter that changes the result. Bump BVH_CACHE_VERSION whenever the node or
+// triangle layout, or what the stored stats mean, changes so stale files are rebuilt instead of loaded.
+// Version 2: SAH and LBVH entries saved a reference count left over from an earlier SBVH build.
+
+const char BVH_CACHE_DIR[] = "bvhcache";
+const char BVH_CACHE_MAGIC[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 'A', 'C' };
+const uint32_t BVH_CACHE_VERSION = 2;
+
+struct BVHCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t triangleSize;      // sizeof the triangle struct, guards against layout changes
+    uint64_t key;
+    uint64_t nodeCount;
+    uint64_t primIndexCount;
+    uint64_t triangleCount;
+    uint64_t wideDataCount;     // uvec4 entries
+    uint64_t slotOrderCount;
+    uint32_t wideWidth;
+    uint32_t wideNodeCount;
+
+    // Build stats of the original build
+    uint64_t primCount;
+    uint64_t referenceCount;
+    uint32_t leafCount;
+    uint32_t maxDepth;
+    double buildTimeMs;
+    float sahCost;
+    uint32_t builderLength;
+    char builder[32];
+};
+
+// Key for a triangle array built with the given parameters (thread counts and task thresholds only
+// affect build speed, so they are left out)
+uint64_t computeBVHCacheKey(const void* triangles, size_t bytes, const BVHBuildParams& params)
+{
+    FNVHasher hasher;
+    hasher.add(BVH_CACHE_VERSION);
+    hasher.addBytes(triangles, bytes);
+    hasher.add(static_cast<int>(params.mode));
+    hasher.add(params.width);
+    hasher.add(params.binCount);
+    hasher.add(params.maxLeafSize);
+    hasher.add(params.traversalCost);
+    hasher.add(params.intersectCost);
+    if (params.mode == SpatialSplitBuild)
+    {
+        hasher.add(params.spatialSplitBudget);
+        hasher.add(params.spatialSplitAlpha);
+    }
+    return hasher.value();
+}
+
+std::string bvhCachePath(uint64_t key)
+{
+    std::ostringstream name;
+    name << BVH_CACHE_DIR << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+    return name.str();
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+            return;
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr)
+            return;
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (bytes != nullptr)
+            byteCount = static_cast<size_t>(fileSize.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+            return;
+        void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+            return;
+        bytes = static_cast<const unsigned char*>(mapped);
+        byteCount = static_cast<size_t>(fileStat.st_size);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes != nullptr)
+            UnmapViewOfFile(bytes);
+        if (mappingHandle != nullptr)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+#else
+        if (bytes != nullptr)
+            munmap(const_cast<unsigned char*>(bytes), byteCount);
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return byteCount; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t byteCount = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Copies count elements out of the mapping, advancing offset. Fails if the file is too short.
+template <typename T>
+bool readCacheArray(const MappedFile& file, size_t& offset, uint64_t count, std::vector<T>& out)
+{
+    if (count > (file.size() - offset) / sizeof(T))
+        return false;
+    out.resize(static_cast<size_t>(count));
+    if (count > 0)
+        std::memcpy(out.data(), file.data() + offset, static_cast<size_t>(count) * sizeof(T));
+    offset += static_cast<size_t>(count) * sizeof(T);
+    return true;
+}
+
+// Loads the cache entry for key, returns false (leaving the outputs untouched) if there is no valid entry
+template <typename Triangle>
+bool loadBVHCache(uint64_t key, BVH& bvh, WideBVH& wide, std::vector<Triangle>& triangles, BVHBuildStats& stats)
+{
+    std::string path = bvhCachePath(key);
+    if (!std::filesystem::exists(path))
+        return false;
+
+    MappedFile file(path);
+    if (file.data() == nullptr || file.size() < sizeof(BVHCacheHeader))
+    {
+        std::cout << "BVH cache: could not map " << path << "\n";
+        return false;
+    }
+
+    BVHCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != BVH_CACHE_VERSION
+        || header.triangleSize != sizeof(Triangle)
+        || header.key != key
+        || header.builderLength > sizeof(header.builder))
+    {
+        std::cout << "BVH cache: ignoring stale or foreign file " << path << "\n";
+        return false;
+    }
+
+    BVH loadedBVH;
+    WideBVH loadedWide;
+    std::vector<Triangle> loadedTriangles;
+    size_t offset = sizeof(BVHCacheHeader);
+    if (!readCacheArray(file, offset, header.nodeCount, loadedBVH.nodes)
+        || !readCacheArray(file, offset, header.primIndexCount, loadedBVH.primIndices)
+        || !readCacheArray(file, offset, header.triangleCount, loadedTriangles)
+        || !readCacheArray(file, offset, header.wideDataCount, loadedWide.data)
+        || !readCacheArray(file, offset, header.slotOrderCount, loadedWide.slotOrder))
+    {
+        std::cout << "BVH cache: truncated file " << path << "\n";
+        return false;
+    }
+    loadedWide.width = static_cast<int>(header.wideWidth);
+    loadedWide.nodeCount = header.wideNodeCount;
+
+    bvh = std::move(loadedBVH);
+    wide = std::move(loadedWide);
+    triangles = std::move(loadedTriangles);
+
+    stats = BVHBuildStats();
+    stats.builder = std::string(header.builder, header.builderLength) + ", cached";
+    stats.primCount = static_cast<size_t>(header.primCount);
+    stats.referenceCount = static_cast<size_t>(header.referenceCount);
+    stats.nodeCount = static_cast<unsigned int>(header.nodeCount);
+    stats.leafCount = header.leafCount;
+    stats.maxDepth = header.maxDepth;
+    stats.buildTimeMs = header.buildTimeMs;
+    stats.sahCost = header.sahCost;
+    stats.width = wide.width > 2 ? wide.width : 2;
+    stats.wideNodeCount = wide.nodeCount;
+    stats.nodeBytes = wide.width > 2 ? wide.data.size() * sizeof(glm::uvec4) : bvh.nodes.size() * sizeof(GPUBVHNode);
+    return true;
+}
+
+template <typename T>
+void writeCacheArray(std::ofstream& out, const std::vector<T>& values)
+{
+    if (!values.empty())
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+// Writes the cache entry for key. The file is written under a temporary name and renamed so a
+// crash mid-write never leaves a truncated entry behind.
+template <typename Triangle>
+bool saveBVHCache(uint64_t key, const BVH& bvh, const WideBVH& wide, const std::vector<Triangle>& triangles,
+    const BVHBuildStats& stats)
+{
+    std::error_code error;
+    std::filesystem::create_directories(BVH_CACHE_DIR, error);
+    if (error)
+    {
+        std::cout << "BVH cache: could not create " << BVH_CACHE_DIR << ": " << error.message() << "\n";
+        return false;
+    }
+
+    BVHCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, BVH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = BVH_CACHE_VERSION;
+    header.triangleSize = sizeof(Triangle);
+    header.key = key;
+    header.nodeCount = bvh.nodes.size();
+    header.primIndexCount = bvh.primIndices.size();
+    header.triangleCount = triangles.size();
+    header.wideDataCount = wide.data.size();
+    header.slotOrderCount = wide.slotOrder.size();
+    header.wideWidth = static_cast<uint32_t>(wide.width);
+    header.wideNodeCount = wide.nodeCount;
+    header.primCount = stats.primCount;
+    header.referenceCount = stats.referenceCount;
+    header.leafCount = stats.leafCount;
+    header.maxDepth = stats.maxDepth;
+    header.buildTimeMs = stats.buildTimeMs;
+    header.sahCost = stats.sahCost;
+    header.builderLength = static_cast<uint32_t>(std::min(stats.builder.size(), sizeof(header.builder)));
+    std::memcpy(header.builder, stats.builder.data(), header.builderLength);
+
+    std::string path = bvhCachePath(key);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cout << "BVH cache: could not write " << tempPath << "\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeCacheArray(out, bvh.nodes);
+        writeCacheArray(out, bvh.primIndices);
+        writeCacheArray(out, triangles);
+        writeCacheArray(out, wide.data);
+        writeCacheArray(out, wide.slotOrder);
+        if (!out)
+        {
+            std::cout << "BVH cache: write failed for " << tempPath << "\n";
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+        std::cout << "BVH cache: could not rename " << tempPath << ": " << error.message() << "\n";
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+#endif // MY_BVH_CACHE_H
@@ -0,0 +1,141 @@
+#ifndef MY_COMPUTE_TRACER_H
+#define MY_COMPUTE_TRACER_H
+
+#include <glad/glad.h>
+
+#include <my_shader.h>
+#include <my_shader_reload.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Compute tracer (compute_tracer.comp): the fragment pass's per-pixel path, dispatched as 8x8 tiles
+// in Morton order into an image. Tiled mode launches one work group per tile; persistent mode
+// launches COMPUTE_PERSISTENT_GROUPS groups that pull tiles from an atomic counter.
+#define COMPUTE_TILE_ORDER_BINDING 11
+#define COMPUTE_TILE_COUNTER_BINDING 12
+const int COMPUTE_TILE_SIZE = 8;
+const int COMPUTE_PERSISTENT_GROUPS = 512;  // Several groups per SM on current desktop GPUs
+
+struct ComputeTracer
+{
+    Shader* program = nullptr;  // Created once the GL context exists
+    GLuint tileOrder = 0;       // Tile x | tile y << 16, sorted by Morton code
+    GLuint tileCounter = 0;
+    GLuint output = 0;          // RGBA32F target when not accumulating
+    int tileCount = 0;
+    int width = 0;
+    int height = 0;
+};
+ComputeTracer computeTracer;
+
+void cleanupComputeTracerBuffers()
+{
+    glDeleteBuffers(1, &computeTracer.tileOrder);
+    glDeleteBuffers(1, &computeTracer.tileCounter);
+    glDeleteTextures(1, &computeTracer.output);
+    computeTracer.tileOrder = computeTracer.tileCounter = computeTracer.output = 0;
+    computeTracer.width = computeTracer.height = computeTracer.tileCount = 0;
+}
+
+void cleanupComputeTracer()
+{
+    cleanupComputeTracerBuffers();
+    delete computeTracer.program;
+    computeTracer = ComputeTracer();
+}
+
+// Interleaves the bits of x and y (x in the even bits)
+uint32_t morton2D(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t v)
+    {
+        v &= 0x0000FFFFu;
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Screen tiles sorted by Morton code. Only tiles on screen are listed, so a non-square or
+// non-power-of-two screen doesn't launch empty groups.
+std::vector<uint32_t> mortonTileOrder(int tilesX, int tilesY)
+{
+    std::vector<uint32_t> tiles;
+    tiles.reserve(static_cast<size_t>(tilesX) * tilesY);
+    for (int y = 0; y < tilesY; y++)
+        for (int x = 0; x < tilesX; x++)
+            tiles.push_back(static_cast<uint32_t>(x) | (static_cast<uint32_t>(y) << 16));
+    std::sort(tiles.begin(), tiles.end(), [](uint32_t a, uint32_t b)
+        { return morton2D(a & 0xFFFFu, a >> 16) < morton2D(b & 0xFFFFu, b >> 16); });
+    return tiles;
+}
+
+// (Re)creates the tile order and output, nothing happens when they already have this size
+void setupComputeTracer(int width, int height)
+{
+    if (!computeTracer.program)
+    {
+        computeTracer.program = new Shader("shaders/compute_tracer.comp");
+        shaderHotReload.watch(computeTracer.program);
+    }
+    if (computeTracer.tileOrder != 0 && computeTracer.width == width && computeTracer.height == height)
+        return;
+    cleanupComputeTracerBuffers();
+    computeTracer.width = width;
+    computeTracer.height = height;
+
+    std::vector<uint32_t> tiles = mortonTileOrder((width + COMPUTE_TILE_SIZE - 1) / COMPUTE_TILE_SIZE,
+        (height + COMPUTE_TILE_SIZE - 1) / COMPUTE_TILE_SIZE);
+    computeTracer.tileCount = static_cast<int>(tiles.size());
+    glGenBuffers(1, &computeTracer.tileOrder);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, computeTracer.tileOrder);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, tiles.size() * sizeof(uint32_t), tiles.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &computeTracer.tileCounter);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, computeTracer.tileCounter);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenTextures(1, &computeTracer.output);
+    glBindTexture(GL_TEXTURE_2D, computeTracer.output);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Traces one frame into target (RGBA32F, the size passed to setupComputeTracer), added to it with
+// accumulate. The tracing uniforms, scene SSBOs, skybox and G-buffer are expected to be set on
+// computeTracer.program (see drawModelCompute in main.cpp).
+void traceCompute(GLuint target, bool accumulate, bool persistent)
+{
+    Shader& program = *computeTracer.program;
+    program.use();
+    program.setBool("persistentThreads", persistent);
+    program.setInt("tileCount", computeTracer.tileCount);
+    program.setBool("accumulateOutput", accumulate);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPUTE_TILE_ORDER_BINDING, computeTracer.tileOrder);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPUTE_TILE_COUNTER_BINDING, computeTracer.tileCounter);
+    glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+    if (persistent)
+    {
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, computeTracer.tileCounter);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glDispatchCompute(static_cast<GLuint>(std::min(COMPUTE_PERSISTENT_GROUPS, computeTracer.tileCount)), 1, 1);
+    }
+    else
+        glDispatchCompute(static_cast<GLuint>(computeTracer.tileCount), 1, 1);
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+#endif // MY_COMPUTE_TRACER_H
@@ -0,0 +1,538 @@
+#ifndef MY_CPU_TRACER_H
+#define MY_CPU_TRACER_H
+
+#include <glm/glm.hpp>
+
+#include <my_bvh.h>
+#include <my_wide_bvh.h>
+#include <my_instancing.h>
+#include <my_parallel.h>
+#include <my_raytracing.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+// CPU mirror of the traversal in raytracing.fs, used to measure acceleration structures without a GPU
+
+// Traversal counters, summed over every bounce of every ray
+struct RayStats
+{
+    uint64_t rays = 0;
+    uint64_t nodesVisited = 0;
+    uint64_t trianglesTested = 0;
+    uint64_t nodeBytesRead = 0;
+
+    void add(const RayStats& other)
+    {
+        rays += other.rays;
+        nodesVisited += other.nodesVisited;
+        trianglesTested += other.trianglesTested;
+        nodeBytesRead += other.nodeBytesRead;
+    }
+
+    double nodesPerRay() const
+    {
+        return rays > 0 ? static_cast<double>(nodesVisited) / static_cast<double>(rays) : 0.0;
+    }
+
+    double trianglesPerRay() const
+    {
+        return rays > 0 ? static_cast<double>(trianglesTested) / static_cast<double>(rays) : 0.0;
+    }
+
+    double bytesPerRay() const
+    {
+        return rays > 0 ? static_cast<double>(nodeBytesRead) / static_cast<double>(rays) : 0.0;
+    }
+};
+
+void printRayStats(const std::string& label, const RayStats& stats)
+{
+    std::cout << "> " << label << ": " << stats.rays << " rays, "
+        << stats.nodesPerRay() << " nodes/ray, "
+        << stats.trianglesPerRay() << " triangles/ray, "
+        << stats.bytesPerRay() << " node bytes/ray\n";
+}
+
+struct CPURay
+{
+    glm::vec3 origin;
+    glm::vec3 dir;
+};
+
+// Möller–Trumbore, same epsilon as intersectTriangle() in raytracing.fs
+bool intersectTriangleCPU(const glm::vec3& orig, const glm::vec3& dir,
+    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2,
+    float& t, float& u, float& v)
+{
+    const float EPSILON = 1e-5f;
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    glm::vec3 h = glm::cross(dir, edge2);
+    float a = glm::dot(edge1, h);
+    if (std::abs(a) < EPSILON)
+        return false;
+
+    float f = 1.0f / a;
+    glm::vec3 s = orig - v0;
+    u = f * glm::dot(s, h);
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    v = f * glm::dot(dir, q);
+    if (v < 0.0f || (u + v) > 1.0f)
+        return false;
+
+    t = f * glm::dot(edge2, q);
+    return t > EPSILON;
+}
+
+// Unit triangle test, same as intersectUnitTriangle() in raytracing.fs
+bool intersectUnitTriangleCPU(const glm::vec3& orig, const glm::vec3& dir, const GPUUnitTriangle& tri, float tMax,
+    float& t, float& u, float& v)
+{
+    const float EPSILON = 1e-5f;
+    glm::vec3 r0(tri.row0), r1(tri.row1), r2(tri.row2);
+    float dz = glm::dot(r2, dir);
+    if (dz == 0.0f)
+        return false;
+
+    t = -(glm::dot(r2, orig) + tri.row2.w) / dz;
+    if (t <= EPSILON || t >= tMax)
+        return false;
+
+    u = glm::dot(r0, orig) + tri.row0.w + t * glm::dot(r0, dir);
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    v = glm::dot(r1, orig) + tri.row1.w + t * glm::dot(r1, dir);
+    return v >= 0.0f && (u + v) <= 1.0f;
+}
+
+// Slab test, returns entry distance or 1e30 on a miss
+float intersectAABBCPU(const glm::vec3& orig, const glm::vec3& invDir,
+    const glm::vec3& bmin, const glm::vec3& bmax, float tMax)
+{
+    glm::vec3 t0 = (bmin - orig) * invDir;
+    glm::vec3 t1 = (bmax - orig) * invDir;
+    glm::vec3 tSmall = glm::min(t0, t1);
+    glm::vec3 tBig = glm::max(t0, t1);
+    float tNear = std::max(std::max(tSmall.x, tSmall.y), std::max(tSmall.z, 0.0f));
+    float tFar = std::min(std::min(tBig.x, tBig.y), tBig.z);
+    return (tNear <= tFar && tNear < tMax) ? tNear : 1e30f;
+}
+
+void testTriangleCPU(const GPUTriangle& tri, const CPURay& ray, float& minT, glm::vec3& hitNormal, bool& hit)
+{
+    float t, u, v;
+    if (intersectTriangleCPU(ray.origin, ray.dir, glm::vec3(tri.v0), glm::vec3(tri.v1), glm::vec3(tri.v2), t, u, v)
+        && t < minT)
+    {
+        minT = t;
+        hit = true;
+        float w = 1.0f - u - v;
+        hitNormal = glm::normalize(glm::vec3(tri.n0) * w + glm::vec3(tri.n1) * u + glm::vec3(tri.n2) * v);
+    }
+}
+
+void testTriangleCPU(const GPUUnitTriangle& tri, const CPURay& ray, float& minT, glm::vec3& hitNormal, bool& hit)
+{
+    float t, u, v;
+    if (intersectUnitTriangleCPU(ray.origin, ray.dir, tri, minT, t, u, v))
+    {
+        minT = t;
+        hit = true;
+        float w = 1.0f - u - v;
+        hitNormal = glm::normalize(unpackOctNormal(tri.normals.x) * w + unpackOctNormal(tri.normals.y) * u
+            + unpackOctNormal(tri.normals.z) * v);
+    }
+}
+
+// Same near-child-first stack traversal as traverseBVHStack() in raytracing.fs. The stack grows as
+// needed, so trees deeper than the shader's stack are still traced completely.
+void traverseBVHCPU(const BVH& bvh, const std::vector<GPUTriangle>& tris, unsigned int root, unsigned int triOffset,
+    const CPURay& ray, float& minT, glm::vec3& hitNormal, bool& hit, RayStats& stats)
+{
+    glm::vec3 invDir = glm::vec3(1.0f) / ray.dir;
+    if (intersectAABBCPU(ray.origin, invDir, bvh.nodes[root].aabbMin, bvh.nodes[root].aabbMax, minT) == 1e30f)
+        return;
+
+    std::vector<unsigned int> stack(BVH_STACK_SIZE);
+    int stackPtr = 0;
+    unsigned int nodeIdx = root;
+    while (true)
+    {
+        const GPUBVHNode& node = bvh.nodes[nodeIdx];
+        stats.nodesVisited++;
+        stats.nodeBytesRead += sizeof(GPUBVHNode);
+        if (node.isLeaf())
+        {
+            for (unsigned int i = 0; i < node.triCount; i++)
+                testTriangleCPU(tris[triOffset + node.leftFirst + i], ray, minT, hitNormal, hit);
+            stats.trianglesTested += node.triCount;
+
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+            continue;
+        }
+
+        // Both child boxes are fetched to order them
+        stats.nodeBytesRead += 2 * sizeof(GPUBVHNode);
+        unsigned int child1 = node.leftFirst;
+        unsigned int child2 = node.leftFirst + 1;
+        float dist1 = intersectAABBCPU(ray.origin, invDir, bvh.nodes[child1].aabbMin, bvh.nodes[child1].aabbMax, minT);
+        float dist2 = intersectAABBCPU(ray.origin, invDir, bvh.nodes[child2].aabbMin, bvh.nodes[child2].aabbMax, minT);
+        if (dist1 > dist2)
+        {
+            std::swap(dist1, dist2);
+            std::swap(child1, child2);
+        }
+
+        if (dist1 == 1e30f)
+        {
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+        }
+        else
+        {
+            nodeIdx = child1;
+            if (dist2 != 1e30f)
+            {
+                if (stackPtr == static_cast<int>(stack.size()))
+                    stack.resize(2 * stack.size());
+                stack[stackPtr++] = child2;
+            }
+        }
+    }
+}
+
+bool traceBVHCPU(const BVH& bvh, const std::vector<GPUTriangle>& tris, const CPURay& ray,
+    float& minT, glm::vec3& hitNormal, RayStats& stats)
+{
+    minT = 1e20f;
+    bool hit = false;
+    if (!bvh.nodes.empty())
+        traverseBVHCPU(bvh, tris, 0, 0, ray, minT, hitNormal, hit, stats);
+    return hit;
+}
+
+// Same traversal as traverseWideBVH() in raytracing.fs: leaf children are tested as soon as they are
+// found, internal children are pushed far-to-near. The stack grows as needed instead of dropping nodes.
+void traverseWideBVHCPU(const WideBVH& wide, const std::vector<GPUTriangle>& tris, unsigned int root, unsigned int triOffset,
+    const CPURay& ray, float& minT, glm::vec3& hitNormal, bool& hit, RayStats& stats)
+{
+    glm::vec3 invDir = glm::vec3(1.0f) / ray.dir;
+    std::vector<unsigned int> stack;
+    stack.reserve(BVH_STACK_SIZE);
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        unsigned int nodeIdx = stack.back();
+        stack.pop_back();
+        unsigned int childCount = wide.data[nodeIdx * wide.nodeStride()].w >> 24;
+        stats.nodesVisited++;
+        stats.nodeBytesRead += 2 * sizeof(glm::uvec4) + ((childCount + 1) / 2) * sizeof(glm::uvec4);
+
+        float dists[8];
+        unsigned int ids[8];
+        int hitCount = 0;
+        for (unsigned int c = 0; c < childCount; c++)
+        {
+            WideChild child = decodeWideChild(wide, nodeIdx, c);
+            float dist = intersectAABBCPU(ray.origin, invDir, child.bmin, child.bmax, minT);
+            if (dist == 1e30f)
+                continue;
+
+            if (child.leaf)
+            {
+                for (unsigned int i = 0; i < child.triCount; i++)
+                    testTriangleCPU(tris[triOffset + child.index + i], ray, minT, hitNormal, hit);
+                stats.trianglesTested += child.triCount;
+                continue;
+            }
+
+            // Insertion sort, nearest first
+            int pos = hitCount++;
+            while (pos > 0 && dists[pos - 1] > dist)
+            {
+                dists[pos] = dists[pos - 1];
+                ids[pos] = ids[pos - 1];
+                pos--;
+            }
+            dists[pos] = dist;
+            ids[pos] = child.index;
+        }
+
+        for (int i = hitCount - 1; i >= 0; i--)
+            stack.push_back(ids[i]);
+    }
+}
+
+bool traceWideBVHCPU(const WideBVH& wide, const std::vector<GPUTriangle>& tris, const CPURay& ray,
+    float& minT, glm::vec3& hitNormal, RayStats& stats)
+{
+    minT = 1e20f;
+    bool hit = false;
+    if (wide.nodeCount > 0)
+        traverseWideBVHCPU(wide, tris, 0, 0, ray, minT, hitNormal, hit, stats);
+    return hit;
+}
+
+// Two-level traversal as in traceInstances() in raytracing.fs (the TLAS is walked in plain depth-first
+// order here, the closest hit is the same). The BLAS is wide when wide has nodes, binary otherwise.
+bool traceInstancesCPU(const InstanceScene& scene, const BVH& bvh, const WideBVH& wide,
+    const std::vector<GPUTriangle>& tris, const CPURay& ray, float& minT, glm::vec3& hitNormal, RayStats& stats)
+{
+    minT = 1e20f;
+    bool hit = false;
+    if (scene.tlas.nodes.empty())
+        return false;
+
+    glm::vec3 invDir = glm::vec3(1.0f) / ray.dir;
+    std::vector<unsigned int> stack;
+    stack.reserve(TLAS_STACK_SIZE);
+    stack.push_back(0);
+    while (!stack.empty())
+    {
+        const GPUBVHNode& node = scene.tlas.nodes[stack.back()];
+        stack.pop_back();
+        stats.nodesVisited++;
+        stats.nodeBytesRead += sizeof(GPUBVHNode);
+        if (intersectAABBCPU(ray.origin, invDir, node.aabbMin, node.aabbMax, minT) == 1e30f)
+            continue;
+
+        if (!node.isLeaf())
+        {
+            stack.push_back(node.leftFirst + 1);
+            stack.push_back(node.leftFirst);
+            continue;
+        }
+
+        for (unsigned int i = 0; i < node.triCount; i++)
+        {
+            const GPUInstance& instance = scene.instances[node.leftFirst + i];
+            const glm::vec4& r0 = instance.worldToObject[0];
+            const glm::vec4& r1 = instance.worldToObject[1];
+            const glm::vec4& r2 = instance.worldToObject[2];
+            CPURay objRay;
+            objRay.origin = glm::vec3(
+                glm::dot(glm::vec3(r0), ray.origin) + r0.w,
+                glm::dot(glm::vec3(r1), ray.origin) + r1.w,
+                glm::dot(glm::vec3(r2), ray.origin) + r2.w);
+            objRay.dir = glm::vec3(glm::dot(glm::vec3(r0), ray.dir), glm::dot(glm::vec3(r1), ray.dir), glm::dot(glm::vec3(r2), ray.dir));
+
+            bool instanceHit = false;
+            glm::vec3 objNormal(0.0f);
+            if (wide.nodeCount > 0)
+                traverseWideBVHCPU(wide, tris, instance.blasRoot, instance.blasTriOffset, objRay, minT, objNormal, instanceHit, stats);
+            else
+                traverseBVHCPU(bvh, tris, instance.blasRoot, instance.blasTriOffset, objRay, minT, objNormal, instanceHit, stats);
+            if (instanceHit)
+            {
+                hit = true;
+                hitNormal = glm::normalize(glm::vec3(r0) * objNormal.x + glm::vec3(r1) * objNormal.y + glm::vec3(r2) * objNormal.z);
+            }
+        }
+    }
+    return hit;
+}
+
+// Primary rays through pixel centres, reconstructed the same way as main() in raytracing.fs
+std::vector<CPURay> generatePrimaryRays(const glm::mat4& view, const glm::mat4& projection, int width, int height)
+{
+    glm::mat4 invProjection = glm::inverse(projection);
+    glm::mat4 invView = glm::inverse(view);
+    glm::vec3 origin = glm::vec3(invView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+    std::vector<CPURay> rays(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec2 ndc((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+            glm::vec4 viewPos = invProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+            viewPos /= viewPos.w;
+            glm::vec3 dirView = glm::normalize(glm::vec3(viewPos));
+
+            CPURay& ray = rays[static_cast<size_t>(y) * width + x];
+            ray.origin = origin;
+            ray.dir = glm::normalize(glm::vec3(invView * glm::vec4(dirView, 0.0f)));
+        }
+    }
+    return rays;
+}
+
+// Follows every primary ray through up to maxBounces refractions (the bounce loop in raytracing.fs)
+// and sums traversal counters over all the segments traced. Paths stop once their Fresnel
+// transmittance drops below minThroughput, as pathTerminates() in trace_common.glsl does.
+// trace(ray, minT, hitNormal, stats) finds the closest hit in whichever structure is being measured.
+template <typename TraceFunc>
+RayStats traceRaySetWith(TraceFunc trace, const std::vector<CPURay>& primaryRays, float modelIOR, int maxBounces,
+    float minThroughput)
+{
+    const float airIOR = 1.0f;
+    unsigned int threadCount = defaultThreadCount();
+    std::vector<RayStats> threadStats(threadCount);
+    parallelFor(0, primaryRays.size(), [&](size_t begin, size_t end, unsigned int t)
+    {
+        RayStats& stats = threadStats[t];
+        for (size_t r = begin; r < end; r++)
+        {
+            CPURay ray = primaryRays[r];
+            float currentIOR = airIOR;
+            float throughput = 1.0f;
+            for (int bounce = 0; bounce < maxBounces; bounce++)
+            {
+                float minT;
+                glm::vec3 hitNormal;
+                stats.rays++;
+                if (!trace(ray, minT, hitNormal, stats))
+                    break;
+
+                glm::vec3 hitPoint = ray.origin + ray.dir * minT;
+                glm::vec3 N = glm::dot(hitNormal, ray.dir) < 0.0f ? hitNormal : -hitNormal;
+                float nextIOR = (std::abs(currentIOR - airIOR) < 0.001f) ? modelIOR : airIOR;
+                glm::vec3 T = glm::refract(ray.dir, N, currentIOR / nextIOR);
+                if (glm::length(T) < 0.001f)
+                    ray.dir = glm::reflect(ray.dir, N);
+                else
+                {
+                    // Schlick's approximation, as fresnelSchlick() in trace_common.glsl
+                    float F0 = std::pow((currentIOR - nextIOR) / (currentIOR + nextIOR), 2.0f);
+                    float cosTheta = std::clamp(glm::dot(-ray.dir, N), 0.0f, 1.0f);
+                    throughput *= 1.0f - (F0 + (1.0f - F0) * std::pow(1.0f - cosTheta, 5.0f));
+                    ray.dir = glm::normalize(T);
+                    currentIOR = nextIOR;
+                }
+                ray.origin = hitPoint + ray.dir * 0.001f;
+                if (throughput < minThroughput)
+                    break;
+            }
+        }
+    }, threadCount, 256);
+
+    RayStats total;
+    for (const RayStats& stats : threadStats)
+        total.add(stats);
+    return total;
+}
+
+RayStats traceRaySetCPU(const BVH& bvh, const std::vector<GPUTriangle>& tris, const std::vector<CPURay>& primaryRays,
+    float modelIOR, int maxBounces = 4, float minThroughput = 0.0f)
+{
+    return traceRaySetWith([&](const CPURay& ray, float& minT, glm::vec3& hitNormal, RayStats& stats)
+    {
+        return traceBVHCPU(bvh, tris, ray, minT, hitNormal, stats);
+    }, primaryRays, modelIOR, maxBounces, minThroughput);
+}
+
+RayStats traceRaySetCPU(const WideBVH& wide, const std::vector<GPUTriangle>& tris, const std::vector<CPURay>& primaryRays,
+    float modelIOR, int maxBounces = 4, float minThroughput = 0.0f)
+{
+    return traceRaySetWith([&](const CPURay& ray, float& minT, glm::vec3& hitNormal, RayStats& stats)
+    {
+        return traceWideBVHCPU(wide, tris, ray, minT, hitNormal, stats);
+    }, primaryRays, modelIOR, maxBounces, minThroughput);
+}
+
+// Through the TLAS, each instance entering the BLAS as traceInstancesCPU does
+RayStats traceRaySetCPU(const InstanceScene& scene, const BVH& bvh, const WideBVH& wide, const std::vector<GPUTriangle>& tris,
+    const std::vector<CPURay>& primaryRays, float modelIOR, int maxBounces = 4, float minThroughput = 0.0f)
+{
+    return traceRaySetWith([&](const CPURay& ray, float& minT, glm::vec3& hitNormal, RayStats& stats)
+    {
+        return traceInstancesCPU(scene, bvh, wide, tris, ray, minT, hitNormal, stats);
+    }, primaryRays, modelIOR, maxBounces, minThroughput);
+}
+
+// Closest-hit triangle tests per second for Möller–Trumbore on GPUTriangle against the unit triangle
+// test on GPUUnitTriangle. Every ray is tested against every triangle, so the count is exact and no
+// BVH is involved. rays is thinned out evenly so there are at most maxTests tests per format.
+struct TriangleBenchmark
+{
+    uint64_t tests = 0;
+    double mollerMs = 0.0;
+    double unitMs = 0.0;
+    uint64_t mollerHits = 0;
+    uint64_t unitHits = 0;
+    uint64_t mismatches = 0;    // Rays whose closest hit differs by more than a small relative distance
+
+    double mollerTestsPerSecond() const { return mollerMs > 0.0 ? static_cast<double>(tests) / (mollerMs / 1000.0) : 0.0; }
+    double unitTestsPerSecond() const { return unitMs > 0.0 ? static_cast<double>(tests) / (unitMs / 1000.0) : 0.0; }
+};
+
+TriangleBenchmark benchmarkTriangleTests(const std::vector<GPUTriangle>& tris, const std::vector<CPURay>& rays,
+    uint64_t maxTests = 50000000)
+{
+    TriangleBenchmark result;
+    if (tris.empty() || rays.empty())
+        return result;
+
+    std::vector<GPUUnitTriangle> unitTris = packUnitTriangles(tris);
+    size_t rayCount = static_cast<size_t>(std::max<uint64_t>(1, std::min<uint64_t>(rays.size(), maxTests / tris.size())));
+    size_t stride = rays.size() / rayCount;
+    result.tests = static_cast<uint64_t>(rayCount) * tris.size();
+
+    using Clock = std::chrono::high_resolution_clock;
+    std::vector<float> mollerT(rayCount, 1e20f), unitT(rayCount, 1e20f);
+    unsigned int threadCount = defaultThreadCount();
+
+    auto start = Clock::now();
+    parallelFor(0, rayCount, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t r = begin; r < end; r++)
+        {
+            const CPURay& ray = rays[r * stride];
+            float minT = 1e20f;
+            glm::vec3 hitNormal(0.0f);
+            bool hit = false;
+            for (const GPUTriangle& tri : tris)
+                testTriangleCPU(tri, ray, minT, hitNormal, hit);
+            mollerT[r] = minT;
+        }
+    }, threadCount, 16);
+    result.mollerMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    parallelFor(0, rayCount, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t r = begin; r < end; r++)
+        {
+            const CPURay& ray = rays[r * stride];
+            float minT = 1e20f;
+            glm::vec3 hitNormal(0.0f);
+            bool hit = false;
+            for (const GPUUnitTriangle& tri : unitTris)
+                testTriangleCPU(tri, ray, minT, hitNormal, hit);
+            unitT[r] = minT;
+        }
+    }, threadCount, 16);
+    result.unitMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    for (size_t r = 0; r < rayCount; r++)
+    {
+        result.mollerHits += mollerT[r] < 1e20f;
+        result.unitHits += unitT[r] < 1e20f;
+        if (std::abs(mollerT[r] - unitT[r]) > 1e-3f * std::max(1.0f, mollerT[r]))
+            result.mismatches++;
+    }
+    return result;
+}
+
+void printTriangleBenchmark(const TriangleBenchmark& bench)
+{
+    std::cout << "> Moller-Trumbore: " << bench.mollerTestsPerSecond() / 1e6 << " M tests/s (" << bench.mollerMs << " ms)\n";
+    std::cout << "> Unit Triangle: " << bench.unitTestsPerSecond() / 1e6 << " M tests/s (" << bench.unitMs << " ms)\n";
+    if (bench.mollerMs > 0.0 && bench.unitMs > 0.0)
+        std::cout << "> Unit vs Moller-Trumbore: " << bench.mollerMs / bench.unitMs << "x speed-up\n";
+    std::cout << "> Hits: " << bench.mollerHits << " / " << bench.unitHits << ", " << bench.mismatches << " rays disagree\n";
+}
+
+#endif // MY_CPU_TRACER_H
@@ -0,0 +1,163 @@
+#ifndef MY_DYNAMIC_RESOLUTION_H
+#define MY_DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include <my_shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Dynamic resolution: the traced pass renders at scale * the screen size and upscale.fs stretches it
+// to the screen. A controller reads the pass's GPU time back through a ring of timer queries (results
+// a few frames old, so reading them never stalls) and moves the scale towards the one expected to
+// meet targetMs, assuming the cost follows the pixel count. The scale moves in DYNAMIC_RES_STEP steps
+// and settles for a few frames after each, so the size dependent buffers (G-buffer, compute outputs)
+// aren't recreated every frame.
+const float DYNAMIC_RES_MIN_SCALE = 0.35f;
+const float DYNAMIC_RES_STEP = 1.0f / 32.0f;
+const int DYNAMIC_RES_QUERIES = 4;
+const int DYNAMIC_RES_SETTLE_FRAMES = 6;   // Frames measured at a new scale before it moves again
+
+struct DynamicResolution
+{
+    bool enabled = false;
+    float targetMs = 16.6f;
+    float scale = 1.0f;
+    float gpuMs = 0.0f;         // Smoothed GPU time of the pass at the current scale
+    int width = 0;              // Traced size of the current frame
+    int height = 0;
+
+    GLuint fbo = 0;
+    GLuint texture = 0;         // Screen sized, the fragment pass only fills the bottom-left width x height
+    int screenWidth = 0;
+    int screenHeight = 0;
+    GLuint queries[DYNAMIC_RES_QUERIES] = {};
+    float queryScale[DYNAMIC_RES_QUERIES] = {}; // Scale each query is timing, 0 when it's free
+    int nextQuery = 0;
+    int measuredFrames = 0;     // At the current scale
+};
+DynamicResolution dynamicResolution;
+
+void cleanupDynamicResolution()
+{
+    glDeleteFramebuffers(1, &dynamicResolution.fbo);
+    glDeleteTextures(1, &dynamicResolution.texture);
+    if (dynamicResolution.queries[0] != 0)
+        glDeleteQueries(DYNAMIC_RES_QUERIES, dynamicResolution.queries);
+    dynamicResolution = DynamicResolution();
+}
+
+// (Re)creates the target for this screen size, nothing happens when it already has it
+void setupDynamicResolution(int screenWidth, int screenHeight)
+{
+    if (dynamicResolution.queries[0] == 0)
+        glGenQueries(DYNAMIC_RES_QUERIES, dynamicResolution.queries);
+    if (dynamicResolution.fbo != 0 && dynamicResolution.screenWidth == screenWidth && dynamicResolution.screenHeight == screenHeight)
+        return;
+    glDeleteFramebuffers(1, &dynamicResolution.fbo);
+    glDeleteTextures(1, &dynamicResolution.texture);
+    dynamicResolution.screenWidth = screenWidth;
+    dynamicResolution.screenHeight = screenHeight;
+
+    glGenTextures(1, &dynamicResolution.texture);
+    glBindTexture(GL_TEXTURE_2D, dynamicResolution.texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, screenWidth, screenHeight);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &dynamicResolution.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, dynamicResolution.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dynamicResolution.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::DYNAMIC_RESOLUTION:: Framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Collects the finished timer queries and moves the scale. Frames timed at an older scale are dropped.
+void updateDynamicResolutionScale()
+{
+    DynamicResolution& dr = dynamicResolution;
+    bool measured = false;
+    for (int i = 0; i < DYNAMIC_RES_QUERIES; i++)
+    {
+        if (dr.queryScale[i] == 0.0f)
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(dr.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != GL_TRUE)
+            continue;
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(dr.queries[i], GL_QUERY_RESULT, &elapsedNs);
+        if (dr.queryScale[i] == dr.scale)
+        {
+            float ms = static_cast<float>(elapsedNs) / 1e6f;
+            dr.gpuMs = dr.measuredFrames == 0 ? ms : dr.gpuMs + 0.25f * (ms - dr.gpuMs);
+            dr.measuredFrames++;
+            measured = true;
+        }
+        dr.queryScale[i] = 0.0f;
+    }
+    if (!measured || dr.measuredFrames < DYNAMIC_RES_SETTLE_FRAMES)
+        return;
+
+    // Within 5% of the target is close enough, otherwise the scale would hunt around it
+    float ratio = dr.targetMs / std::max(dr.gpuMs, 0.01f);
+    if (ratio > 0.95f && ratio < 1.05f)
+        return;
+
+    // Pixel count is scale squared. Only go half way, the frame time isn't exactly proportional to it.
+    float ideal = dr.scale * std::sqrt(ratio);
+    float next = std::round((dr.scale + 0.5f * (ideal - dr.scale)) / DYNAMIC_RES_STEP) * DYNAMIC_RES_STEP;
+    if (next == dr.scale)
+        next += ideal > dr.scale ? DYNAMIC_RES_STEP : -DYNAMIC_RES_STEP;
+    next = std::clamp(next, DYNAMIC_RES_MIN_SCALE, 1.0f);
+    if (next != dr.scale)
+    {
+        dr.scale = next;
+        dr.measuredFrames = 0;
+    }
+}
+
+// Picks this frame's traced size (width, height) and starts timing it. Everything up to
+// endDynamicResolutionFrame is timed, so draw the traced pass in between.
+void beginDynamicResolutionFrame(int screenWidth, int screenHeight)
+{
+    DynamicResolution& dr = dynamicResolution;
+    setupDynamicResolution(screenWidth, screenHeight);
+    updateDynamicResolutionScale();
+    dr.width = std::max(1, static_cast<int>(std::lround(screenWidth * dr.scale)));
+    dr.height = std::max(1, static_cast<int>(std::lround(screenHeight * dr.scale)));
+
+    // With every query still in flight this frame just isn't timed
+    if (dr.queryScale[dr.nextQuery] == 0.0f)
+        glBeginQuery(GL_TIME_ELAPSED, dr.queries[dr.nextQuery]);
+}
+
+// Upscales source (the traced frame in its bottom-left width x height texels) into the default
+// framebuffer with a fullscreen triangle (vao), then stops timing the frame
+void endDynamicResolutionFrame(Shader& upscaleShader, GLuint source, GLuint vao)
+{
+    DynamicResolution& dr = dynamicResolution;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, dr.screenWidth, dr.screenHeight);
+    upscaleShader.use();
+    upscaleShader.setInt("source", 0);
+    upscaleShader.setVec2("sourceSize", static_cast<float>(dr.width), static_cast<float>(dr.height));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    if (dr.queryScale[dr.nextQuery] == 0.0f)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        dr.queryScale[dr.nextQuery] = dr.scale;
+        dr.nextQuery = (dr.nextQuery + 1) % DYNAMIC_RES_QUERIES;
+    }
+}
+
+#endif // MY_DYNAMIC_RESOLUTION_H
@@ -0,0 +1,147 @@
+#ifndef MY_FRAME_UNIFORMS_H
+#define MY_FRAME_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <my_shader.h>
+
+#include <cstring>
+
+// Camera data shared by every program through uniform block binding FRAME_UNIFORM_BINDING (FrameData
+// in raytracing.fs and gbuffer.vs). std140 with only mat4s and vec4s, so this layout matches as is.
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 invView;
+    glm::mat4 invProjection;
+    glm::vec4 cameraPosition;   // w unused
+    glm::vec4 cameraForward;    // World-space ray direction through the screen centre (not normalised)
+    glm::vec4 cameraRight;      // Added to cameraForward per unit of NDC x
+    glm::vec4 cameraUp;         // Added to cameraForward per unit of NDC y
+};
+
+#define FRAME_UNIFORM_BINDING 0
+const int FRAME_RING_SIZE = 3;  // Frames the GPU may still be reading while the CPU writes the next
+
+// Inverses and the primary ray basis are computed once here instead of per pixel. Unprojected
+// points on the near plane are affine in NDC for a perspective matrix, so three of them give the
+// basis exactly.
+FrameUniforms makeFrameUniforms(const glm::mat4& view, const glm::mat4& projection)
+{
+    FrameUniforms frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.invView = glm::inverse(view);
+    frame.invProjection = glm::inverse(projection);
+
+    auto unproject = [&](float x, float y)
+    {
+        glm::vec4 viewPos = frame.invProjection * glm::vec4(x, y, -1.0f, 1.0f);
+        return glm::vec3(viewPos) / viewPos.w;
+    };
+    glm::vec3 centre = unproject(0.0f, 0.0f);
+    glm::mat3 viewToWorld(frame.invView);
+    frame.cameraPosition = glm::vec4(glm::vec3(frame.invView[3]), 1.0f);
+    frame.cameraForward = glm::vec4(viewToWorld * centre, 0.0f);
+    frame.cameraRight = glm::vec4(viewToWorld * (unproject(1.0f, 0.0f) - centre), 0.0f);
+    frame.cameraUp = glm::vec4(viewToWorld * (unproject(0.0f, 1.0f) - centre), 0.0f);
+    return frame;
+}
+
+// FrameUniforms streamed through a ring of FRAME_RING_SIZE slots. With GL 4.4 buffer storage the
+// ring is persistently mapped and each slot is fenced once the commands reading it are queued, so a
+// write only waits when the GPU is a whole ring behind. Older contexts fall back to glBufferSubData.
+class FrameUniformRing
+{
+public:
+    void setup()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = (static_cast<GLsizeiptr>(sizeof(FrameUniforms)) + alignment - 1) / alignment * alignment;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        persistent = GLAD_GL_VERSION_4_4 != 0;
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_UNIFORM_BUFFER, stride * FRAME_RING_SIZE, nullptr, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * FRAME_RING_SIZE, flags));
+            persistent = mapped != nullptr;
+        }
+        if (!persistent)
+            glBufferData(GL_UNIFORM_BUFFER, stride * FRAME_RING_SIZE, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Writes the next slot and binds it, uniformCallsReplaced is how many glUniform calls the
+    // programs reading this slot no longer make
+    void update(const glm::mat4& view, const glm::mat4& projection, unsigned int uniformCallsReplaced)
+    {
+        if (buffer == 0)
+            return;
+
+        // Everything queued so far may read the current slot
+        if (persistent && used)
+            fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot = (slot + 1) % FRAME_RING_SIZE;
+        used = true;
+
+        FrameUniforms frame = makeFrameUniforms(view, projection);
+        GLintptr offset = stride * slot;
+        if (persistent)
+        {
+            if (fences[slot])
+            {
+                glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+                glDeleteSync(fences[slot]);
+                fences[slot] = nullptr;
+            }
+            std::memcpy(mapped + offset, &frame, sizeof(FrameUniforms));
+        }
+        else
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(FrameUniforms), &frame);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, buffer, offset, sizeof(FrameUniforms));
+
+        uniformStats.blockUploads++;
+        uniformStats.blockCallsSaved += uniformCallsReplaced;
+    }
+
+    void cleanup()
+    {
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (persistent && buffer != 0)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+    }
+
+private:
+    GLuint buffer = 0;
+    GLsizeiptr stride = 0;
+    unsigned char* mapped = nullptr;
+    bool persistent = false;
+    bool used = false;
+    int slot = 0;
+    GLsync fences[FRAME_RING_SIZE] = {};
+};
+FrameUniformRing frameUniforms;
+
+#endif // MY_FRAME_UNIFORMS_H
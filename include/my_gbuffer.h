@@ -0,0 +1,103 @@
+#ifndef MY_GBUFFER_H
+#define MY_GBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <my_model.h>
+#include <my_shader.h>
+
+#include <iostream>
+
+// Hybrid primary visibility: the traced model is rasterized into a G-buffer and raytracing.fs starts
+// its bounce loop at bounce 1 on covered pixels, uncovered pixels read the skybox straight away
+struct GBuffer
+{
+    GLuint fbo = 0;
+    GLuint position = 0;    // RGBA32F, xyz = world-space first hit, w = coverage (0 where nothing was drawn)
+    GLuint normal = 0;      // RGBA16F, interpolated vertex normal
+    GLuint depth = 0;       // Depth renderbuffer
+    int width = 0;
+    int height = 0;
+};
+GBuffer gBuffer;
+
+void cleanupGBuffer()
+{
+    glDeleteFramebuffers(1, &gBuffer.fbo);
+    glDeleteTextures(1, &gBuffer.position);
+    glDeleteTextures(1, &gBuffer.normal);
+    glDeleteRenderbuffers(1, &gBuffer.depth);
+    gBuffer = GBuffer();
+}
+
+GLuint createGBufferTexture(GLenum internalFormat, GLenum type, int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+// (Re)creates the G-buffer, nothing happens when it already has this size
+void setupGBuffer(int width, int height)
+{
+    if (gBuffer.fbo != 0 && gBuffer.width == width && gBuffer.height == height)
+        return;
+    cleanupGBuffer();
+    gBuffer.width = width;
+    gBuffer.height = height;
+
+    glGenFramebuffers(1, &gBuffer.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.fbo);
+
+    // Positions need full floats, hit points far from the origin lose too much in half floats
+    gBuffer.position = createGBufferTexture(GL_RGBA32F, GL_FLOAT, width, height);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gBuffer.position, 0);
+    gBuffer.normal = createGBufferTexture(GL_RGBA16F, GL_HALF_FLOAT, width, height);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gBuffer.normal, 0);
+    GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, attachments);
+
+    glGenRenderbuffers(1, &gBuffer.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, gBuffer.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gBuffer.depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::GBUFFER:: Framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Rasterizes model's first hits with the same camera as the raytracer (the per-frame UBO), then
+// restores the framebuffer, viewport and blending it was called with
+void renderGBuffer(Shader& shader, Model& model, int width, int height)
+{
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    GLboolean blending = glIsEnabled(GL_BLEND);
+
+    setupGBuffer(width, height);
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.fbo);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f); // Zero coverage wherever the model isn't drawn
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    shader.use();
+    model.draw(shader);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    if (blending)
+        glEnable(GL_BLEND);
+}
+
+#endif // MY_GBUFFER_H
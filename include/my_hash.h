@@ -0,0 +1,49 @@
+#ifndef MY_HASH_H
+#define MY_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// FNV-1a, 64-bit, folded a word at a time so hashing a large mesh stays cheap. Keys the BVH and
+// shader binary caches and the accumulation state.
+class FNVHasher
+{
+public:
+    void addBytes(const void* data, size_t bytes)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        size_t words = bytes / 8;
+        for (size_t i = 0; i < words; i++)
+        {
+            uint64_t word;
+            std::memcpy(&word, p + i * 8, 8);
+            mix(word);
+        }
+        for (size_t i = words * 8; i < bytes; i++)
+            mix(p[i]);
+        mix(bytes);
+    }
+
+    template <typename T>
+    void add(const T& value)
+    {
+        addBytes(&value, sizeof(T));
+    }
+
+    uint64_t value() const
+    {
+        return hash;
+    }
+
+private:
+    uint64_t hash = 14695981039346656037ull;
+
+    void mix(uint64_t word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+};
+
+#endif // MY_HASH_H
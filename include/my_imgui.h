@@ -11,6 +11,14 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <stb_image_write.h>
+#include <my_bvh.h>
+#include <my_animation.h>
+#include <my_shader.h>
+#include <my_accumulation.h>
+#include <my_shader_variants.h>
+#include <my_dynamic_resolution.h>
+#include <my_temporal_reuse.h>
+#include <my_interleaved.h>
 // </includes>
 
 // <Screenshot>
@@ -111,16 +119,65 @@ enum Skyboxes
     Museum = 2
 };
 
+enum TracingBackends
+{
+    MegakernelBackend = 0,
+    WavefrontBackend = 1,
+    ComputeTiledBackend = 2,
+    ComputePersistentBackend = 3
+};
+
 float IOR = 1.5f;
 const char* modelOptions[5] = { "Teapot", "Donut", "Sphere", "Monkey", "Buddha"};
 const char* skyboxOptions[3] = { "Graffiti", "Night Sky", "Museum" };
+const char* buildModeOptions[3] = { "Quality (SAH)", "Fast (LBVH)", "Spatial (SBVH)" };
+BVHBuildMode modelBuildModes[5] = { QualityBuild, QualityBuild, QualityBuild, QualityBuild, QualityBuild };
+const char* bvhWidthOptions[3] = { "Binary", "BVH4", "BVH8" };
+const int bvhWidths[3] = { 2, 4, 8 };
+int selectedBVHWidth = 0;
+const char* bvhKernelOptions[3] = { "Full Stack", "Short Stack", "Stackless" };
+int selectedKernel = 0;
+int selectedInstanceGrid = 1;
+const char* triangleLayoutOptions[3] = { "Full (96 B)", "Indexed", "Precomputed (64 B)" };
+int selectedTriangleLayout = 0;
+const char* backendOptions[4] = { "Megakernel (fragment)", "Wavefront (compute)", "Tiled (compute)", "Persistent (compute)" };
+int selectedBackend = MegakernelBackend;
+const char* interleaveOptions[3] = { "Full", "Checkerboard (1/2)", "Quarter (1/4)" };
 ModelTypes selectedModel = Monkey;
 Skyboxes selectedSkybox = Museum;
 bool enableReflect = true;
+bool useBVH = true;
+bool useHybridPrimary = false;
+int maxBounces = 4;
+float minThroughput = 0.02f;
+bool showBounceHeatmap = false;
+bool useShaderVariants = true;
+bool accumulateSamples = true;
+int targetSamples = 64;
 bool ImGuiUseMouse = true;
 bool modelChanged = false;
 bool takeScreenshot = false;
 bool zoomIn = false;
+bool compareBuilds = false;
+bool compareSplits = false;
+bool compareWidths = false;
+bool compareKernels = false;
+bool instancesChanged = false;
+bool triangleLayoutChanged = false;
+bool compareTriangles = false;
+bool compareBackends = false;
+bool compareInterleaved = false;
+bool compareSampling = false;
+
+// Mean PSNR of the last "Compare Sampling" run
+struct SamplingComparison
+{
+    float uniformPSNR = 0.0f;
+    float adaptivePSNR = 0.0f;
+};
+SamplingComparison samplingComparison;
+bool animateModel = true;
+float rebuildThreshold = 1.5f;
 
 void ImGuiSetup(GLFWwindow* window)
 {
@@ -149,11 +206,11 @@ void ImGuiNewFrame()
     ImGui::NewFrame();
 }
 
-void ImGuiDrawWindow()
+void ImGuiDrawWindow(const BVHBuildStats& buildStats, const AnimationStats* animStats)
 {
     ImGui::SetNextWindowCollapsed(!ImGuiUseMouse);
     ImGui::SetNextWindowPos(ImVec2(50, 50));
-    ImGui::SetNextWindowSize(ImVec2(500, 550));
+    ImGui::SetNextWindowSize(ImVec2(500, animStats ? 2265 : 2155));
     ImGui::Begin("Raytracer");
 
     ImGui::Text("Index of Refraction (IOR):");
@@ -162,11 +219,136 @@ void ImGuiDrawWindow()
     ImGui::Text("Disable Reflectance:");
     ImGui::Checkbox("Reflect:", &enableReflect);
 
+    ImGui::Text("BVH Acceleration (off = brute force):");
+    ImGui::Checkbox("Use BVH:", &useBVH);
+    ImGui::Text("Last Build: %.1f ms, %u nodes, %.1f MB peak", buildStats.buildTimeMs,
+        buildStats.nodeCount, static_cast<double>(buildStats.peakMemoryBytes) / (1024.0 * 1024.0));
+    ImGui::Text("Uniforms: %llu GL calls saved, %llu UBO uploads",
+        static_cast<unsigned long long>(uniformStats.callsSaved()), static_cast<unsigned long long>(uniformStats.blockUploads));
+
+    // Jittered samples are averaged while the view is static, then the result is only presented
+    ImGui::Text("Progressive Accumulation:");
+    ImGui::Checkbox("Accumulate:", &accumulateSamples);
+    ImGui::SliderInt("Samples", &targetSamples, 1, 256);
+    if (accumulateSamples)
+    {
+        unsigned int passes = accumulationPasses(static_cast<unsigned int>(targetSamples),
+            accumulator.adaptive && selectedBackend == MegakernelBackend);
+        ImGui::Text("%u / %u passes%s", accumulator.sampleCount, passes, accumulator.sampleCount >= passes ? " (idle)" : "");
+    }
+
+    // Past a few uniform passes, new samples only go to the pixels with the highest estimated error
+    // (fragment backend)
+    ImGui::Checkbox("Adaptive:", &accumulator.adaptive);
+    ImGui::SliderFloat("Per Pass", &accumulator.adaptiveFraction, 0.05f, 0.5f);
+    if (accumulateSamples && accumulator.adaptive && selectedBackend == MegakernelBackend)
+        ImGui::Text("Traced %.0f%% of pixels, error threshold %.4f", 100.0f * accumulator.tracedFraction, accumulator.errorThreshold);
+    if (ImGui::Button("Compare Sampling", ImVec2(150, 36)))
+        compareSampling = true;
+    if (samplingComparison.uniformPSNR > 0.0f)
+        ImGui::Text("Equal time: uniform %.1f dB, adaptive %.1f dB", samplingComparison.uniformPSNR, samplingComparison.adaptivePSNR);
+
+    // Trace below the screen size to hold the frame time target, upscaled edge-aware (not while accumulating)
+    ImGui::Text("Dynamic Resolution:");
+    ImGui::Checkbox("Scale:", &dynamicResolution.enabled);
+    ImGui::SliderFloat("Target ms", &dynamicResolution.targetMs, 4.0f, 50.0f);
+    if (dynamicResolution.enabled && !accumulateSamples)
+        ImGui::Text("%.0f%% (%dx%d), GPU %.2f ms", 100.0f * dynamicResolution.scale,
+            dynamicResolution.width, dynamicResolution.height, dynamicResolution.gpuMs);
+
+    // The camera only rotates, so last frame's samples are reprojected and only the rest is traced
+    // (fragment backend, takes over from dynamic resolution)
+    ImGui::Text("Temporal Reuse:");
+    ImGui::Checkbox("Reproject:", &temporalReuse.enabled);
+    ImGui::SliderInt("Refresh 1/N", &temporalReuse.refreshPeriod, 2, 16);
+    if (temporalReuse.enabled && !accumulateSamples && selectedBackend == MegakernelBackend)
+        ImGui::Text("Traced %.1f%% of pixels", 100.0f * temporalReuse.tracedFraction);
+
+    // Trace half or a quarter of the pixels per frame, the rest from last frame and the traced neighbours
+    // (fragment backend)
+    ImGui::Text("Interleaved Tracing:");
+    ImGui::Combo("Pattern", &interleaved.pattern, interleaveOptions, IM_ARRAYSIZE(interleaveOptions));
+    if (interleaved.pattern != 0 && !accumulateSamples && selectedBackend == MegakernelBackend)
+        ImGui::Text("Traced 1/%d of pixels, GPU %.2f ms", interleaved.pattern == 1 ? 2 : 4, interleaved.gpuMs);
+    if (ImGui::Button("Compare Interleaved", ImVec2(150, 36)))
+        compareInterleaved = true;
+    if (interleaved.compareMs[0] > 0.0f)
+        ImGui::Text("Pan: full %.1f ms, 1/2 %.1f ms %.1f dB, 1/4 %.1f ms %.1f dB", interleaved.compareMs[0],
+            interleaved.compareMs[1], interleaved.comparePSNR[1], interleaved.compareMs[2], interleaved.comparePSNR[2]);
+
+    // Bounce budget, paths also stop once they leave the scene's bounds or their throughput runs out
+    ImGui::Text("Bounces (heatmap = searches per pixel):");
+    ImGui::SliderInt("Bounces", &maxBounces, 1, 8);
+    ImGui::SliderFloat("Min Throughput", &minThroughput, 0.0f, 0.5f);
+    ImGui::Checkbox("Heatmap:", &showBounceHeatmap);
+
+    // Bake bounces, reflection, triangle layout and traversal kernel into raytracing.fs as constants
+    ImGui::Text("Shader Variants (%zu compiled):", raytracingVariants.size());
+    ImGui::Checkbox("Specialize:", &useShaderVariants);
+    ImGui::Text("Hot Reload: %u swapped, %zu compiling", shaderHotReload.reloadCount(), shaderHotReload.pendingCount());
+
+    // Rasterize bounce 0 (static, non-instanced scenes only, the meshes' vertex buffers are the bind pose)
+    ImGui::Text("Primary Visibility (on = rasterized):");
+    ImGui::Checkbox("Hybrid:", &useHybridPrimary);
+
+    // Fragment megakernel, ray-generation/extend/shade compute kernels over compacted ray queues, or the
+    // per-pixel path in compute over Morton-ordered tiles (one group per tile or persistent groups)
+    ImGui::Text("Tracing Backend:");
+    ImGui::Combo("Backend", &selectedBackend, backendOptions, IM_ARRAYSIZE(backendOptions));
+    if (ImGui::Button("Compare Backends", ImVec2(150, 36)))
+        compareBackends = true;
+
     // Dropdown menu for model selection
     ImGui::Text("Select Model:");
     if (ImGui::Combo("Model", reinterpret_cast<int*>(&selectedModel), modelOptions, IM_ARRAYSIZE(modelOptions)))
         modelChanged = true;
 
+    // Dropdown menu for the selected model's BVH build mode
+    ImGui::Text("BVH Build Mode:");
+    if (ImGui::Combo("Build", reinterpret_cast<int*>(&modelBuildModes[selectedModel]), buildModeOptions, IM_ARRAYSIZE(buildModeOptions)))
+        modelChanged = true;
+    if (ImGui::Button("Compare Builds", ImVec2(150, 36)))
+        compareBuilds = true;
+    ImGui::SameLine();
+    if (ImGui::Button("SBVH vs SAH", ImVec2(150, 36)))
+        compareSplits = true;
+
+    // Dropdown menu for the node width (wide nodes use quantized child boxes)
+    ImGui::Text("BVH Width:");
+    if (ImGui::Combo("Width", &selectedBVHWidth, bvhWidthOptions, IM_ARRAYSIZE(bvhWidthOptions)))
+        modelChanged = true;
+    if (ImGui::Button("Compare Widths", ImVec2(150, 36)))
+        compareWidths = true;
+
+    // Traversal kernel for binary nodes (wide nodes always use their own stack)
+    ImGui::Text("BVH Traversal:");
+    ImGui::Combo("Kernel", &selectedKernel, bvhKernelOptions, IM_ARRAYSIZE(bvhKernelOptions));
+    if (ImGui::Button("Compare Kernels", ImVec2(150, 36)))
+        compareKernels = true;
+
+    // Triangle storage read by the shader, switching only re-uploads (the BVH is shared)
+    ImGui::Text("Triangle Layout:");
+    if (ImGui::Combo("Triangles", &selectedTriangleLayout, triangleLayoutOptions, IM_ARRAYSIZE(triangleLayoutOptions)))
+        triangleLayoutChanged = true;
+    if (ImGui::Button("Compare Triangles", ImVec2(150, 36)))
+        compareTriangles = true;
+
+    // N x N grid of instances sharing the model's BVH (1 = just the model)
+    ImGui::Text("Instance Grid:");
+    if (ImGui::SliderInt("Grid", &selectedInstanceGrid, 1, 10))
+        instancesChanged = true;
+
+    // Skinned models only: refit every frame, rebuild once SAH cost grows past the threshold
+    if (animStats)
+    {
+        ImGui::Text("Animation:");
+        ImGui::Checkbox("Animate:", &animateModel);
+        ImGui::SliderFloat("Rebuild SAH", &rebuildThreshold, 1.05f, 4.0f);
+        ImGui::Text("Skin %.2f ms, %s %.2f ms, upload %.2f ms", animStats->skinMs,
+            animStats->rebuilt ? "rebuild" : "refit", animStats->refitMs, animStats->uploadMs);
+        ImGui::Text("SAH x%.2f, %u rebuilds", animStats->sahRatio, animStats->rebuilds);
+    }
+
     // Dropdown menu for skybox selection
     ImGui::Text("Select Skybox:");
     ImGui::Combo("Skybox", reinterpret_cast<int*>(&selectedSkybox), skyboxOptions, IM_ARRAYSIZE(skyboxOptions));
@@ -180,6 +362,18 @@ void ImGuiDrawWindow()
         std::cout << "> Active Model: " << modelOptions[selectedModel] << "\n";
         std::cout << "> Active Skybox: " << skyboxOptions[selectedSkybox] << "\n";
         std::cout << "> Reflection Active: " << enableReflect << "\n";
+        std::cout << "> BVH Active: " << useBVH << "\n";
+        std::cout << "> Hybrid Primary: " << useHybridPrimary << "\n";
+        std::cout << "> Accumulation: " << (accumulateSamples ? std::to_string(targetSamples) + " samples" : "off") << "\n";
+        std::cout << "> BVH Build: " << buildModeOptions[modelBuildModes[selectedModel]]
+            << " (" << buildStats.buildTimeMs << " ms, SAH " << buildStats.sahCost << ")\n";
+        std::cout << "> BVH Width: " << bvhWidthOptions[selectedBVHWidth] << "\n";
+        std::cout << "> BVH Traversal: " << bvhKernelOptions[selectedKernel] << "\n";
+        std::cout << "> Triangle Layout: " << triangleLayoutOptions[selectedTriangleLayout] << "\n";
+        std::cout << "> Instance Grid: " << selectedInstanceGrid << "x" << selectedInstanceGrid << "\n";
+        if (animStats && animateModel)
+            std::cout << "> Animation: skin " << animStats->skinMs << " ms, refit " << animStats->refitMs
+                << " ms, upload " << animStats->uploadMs << " ms, rebuild at SAH x" << rebuildThreshold << "\n";
         std::cout << "> IOR: " << IOR << "\n";
         std::cout << "****************************\n";
         fpsTracker.start(50);
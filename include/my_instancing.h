@@ -0,0 +1,136 @@
+#ifndef MY_INSTANCING_H
+#define MY_INSTANCING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <my_bvh.h>
+
+#include <vector>
+#include <algorithm>
+
+// Two-level acceleration: a bottom-level BVH (BLAS) keeps the triangles, a top-level BVH (TLAS) over
+// instance bounds picks which instances a ray has to enter. Memory grows by one GPUInstance and
+// roughly two TLAS nodes per instance, the triangles are never duplicated. The BLAS is currently the
+// scene BVH over the whole flattened model (all its meshes), the same tree the other modes trace.
+// Instances address their BLAS by root node and triangle offset, so per-mesh BLASes would only need
+// their nodes and triangles appended to the same buffers.
+
+// Matches struct Instance in raytracing.fs (std430, 64 bytes)
+struct GPUInstance
+{
+    glm::vec4 worldToObject[3];     // Rows of the 3x4 inverse transform
+    unsigned int blasRoot;          // Root node of the instance's BLAS (binary or wide, as bvhWidth)
+    unsigned int blasTriOffset;     // Added to the BLAS's triangle indices
+    unsigned int pad0;
+    unsigned int pad1;
+};
+
+struct InstanceScene
+{
+    std::vector<GPUInstance> instances;    // Reordered into TLAS leaf order
+    BVH tlas;
+};
+
+// World bounds of a BLAS box under objectToWorld (all 8 corners transformed)
+AABB transformBounds(const AABB& box, const glm::mat4& objectToWorld)
+{
+    AABB world;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 p(
+            (corner & 1) ? box.bmax.x : box.bmin.x,
+            (corner & 2) ? box.bmax.y : box.bmin.y,
+            (corner & 4) ? box.bmax.z : box.bmin.z);
+        world.grow(glm::vec3(objectToWorld * glm::vec4(p, 1.0f)));
+    }
+    return world;
+}
+
+GPUInstance makeInstance(const glm::mat4& objectToWorld, unsigned int blasRoot, unsigned int blasTriOffset)
+{
+    // glm is column-major, so row r of the inverse is (m[0][r], m[1][r], m[2][r], m[3][r])
+    glm::mat4 worldToObject = glm::inverse(objectToWorld);
+    GPUInstance instance;
+    for (int r = 0; r < 3; r++)
+        instance.worldToObject[r] = glm::vec4(worldToObject[0][r], worldToObject[1][r], worldToObject[2][r], worldToObject[3][r]);
+    instance.blasRoot = blasRoot;
+    instance.blasTriOffset = blasTriOffset;
+    instance.pad0 = 0;
+    instance.pad1 = 0;
+    return instance;
+}
+
+// gridSize x gridSize copies of one BLAS in the XY plane, scaled down so the whole grid covers about
+// the same area as a single copy, each turned about Y so the copies are visibly distinct
+std::vector<glm::mat4> makeInstanceGrid(const AABB& blasBox, int gridSize)
+{
+    std::vector<glm::mat4> transforms;
+    glm::vec3 center = blasBox.centroid();
+    glm::vec3 extent = blasBox.bmax - blasBox.bmin;
+    float cell = std::max(std::max(extent.x, extent.y), extent.z) * 1.15f;
+    float scale = 1.0f / static_cast<float>(gridSize);
+    for (int y = 0; y < gridSize; y++)
+    {
+        for (int x = 0; x < gridSize; x++)
+        {
+            glm::vec3 offset(
+                (static_cast<float>(x) - 0.5f * static_cast<float>(gridSize - 1)) * cell,
+                (static_cast<float>(y) - 0.5f * static_cast<float>(gridSize - 1)) * cell,
+                0.0f);
+            float angle = glm::radians(37.0f * static_cast<float>(y * gridSize + x));
+            glm::mat4 objectToWorld = glm::translate(glm::mat4(1.0f), center + offset * scale);
+            objectToWorld = glm::scale(objectToWorld, glm::vec3(scale));
+            objectToWorld = glm::rotate(objectToWorld, angle, glm::vec3(0.0f, 1.0f, 0.0f));
+            objectToWorld = glm::translate(objectToWorld, -center);
+            transforms.push_back(objectToWorld);
+        }
+    }
+    return transforms;
+}
+
+// Builds the TLAS over instances of one BLAS with the binned SAH builder and reorders the
+// instances into leaf order. Entering an instance costs a whole BLAS traversal, hence the high
+// intersection cost and single-instance leaves.
+InstanceScene buildInstanceScene(const AABB& blasBox, const std::vector<glm::mat4>& transforms,
+    unsigned int blasRoot, unsigned int blasTriOffset, BVHBuildStats* stats = nullptr)
+{
+    std::vector<AABB> instanceBounds(transforms.size());
+    std::vector<GPUInstance> instances(transforms.size());
+    for (size_t i = 0; i < transforms.size(); i++)
+    {
+        instanceBounds[i] = transformBounds(blasBox, transforms[i]);
+        instances[i] = makeInstance(transforms[i], blasRoot, blasTriOffset);
+    }
+
+    BVHBuildParams tlasParams;
+    tlasParams.maxLeafSize = 1;
+    tlasParams.intersectCost = 4.0f;
+
+    InstanceScene scene;
+    scene.tlas = buildBVH(instanceBounds, tlasParams, stats);
+    scene.instances.resize(scene.tlas.primIndices.size());
+    for (size_t i = 0; i < scene.tlas.primIndices.size(); i++)
+        scene.instances[i] = instances[scene.tlas.primIndices[i]];
+    return scene;
+}
+
+// Refits the TLAS after the shared BLAS's bounds changed (an animated model), every instance keeps
+// its transform
+void refitInstanceScene(InstanceScene& scene, const AABB& blasBox)
+{
+    std::vector<AABB> instanceBounds(scene.instances.size());
+    for (size_t i = 0; i < scene.instances.size(); i++)
+    {
+        glm::mat4 worldToObject(1.0f);
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+                worldToObject[c][r] = scene.instances[i].worldToObject[r][c];
+        }
+        instanceBounds[scene.tlas.primIndices[i]] = transformBounds(blasBox, glm::inverse(worldToObject));
+    }
+    refitBVH(scene.tlas, instanceBounds);
+}
+
+#endif // MY_INSTANCING_H
@@ -0,0 +1,224 @@
+#ifndef MY_INTERLEAVED_H
+#define MY_INTERLEAVED_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <my_shader.h>
+
+#include <cstdint>
+#include <iostream>
+
+// Interleaved tracing: each frame the fragment pass only runs on half the pixels (a checkerboard) or
+// a quarter (one per 2x2 quad), the others being rejected by the stencil test. interleave_resolve.fs
+// fills the skipped pixels from last frame's image, reprojected along the camera's rotation and
+// clamped to the traced neighbours, so every pixel is traced every two or four frames at full
+// output resolution. See interleave_pattern.glsl for the patterns.
+const int INTERLEAVE_QUERIES = 4;
+
+struct InterleavedTracing
+{
+    int pattern = 0;                // 0 off, 1 checkerboard, 2 quarter
+    float gpuMs = 0.0f;             // Smoothed GPU time of a frame (mask, trace and resolve)
+
+    // Last "Compare Interleaved" run, per pattern (0 is the fully traced reference)
+    float compareMs[3] = {};
+    float comparePSNR[3] = {};
+
+    GLuint fbo = 0;                 // traced + stencil
+    GLuint traced = 0;              // RGBA16F, only this frame's pattern is written
+    GLuint stencil = 0;
+    GLuint resolveFbo = 0;
+    GLuint resolved[2] = {};        // RGBA16F, current one written, the other is last frame's
+    int width = 0;
+    int height = 0;
+    int current = 0;
+    bool historyValid = false;
+    uint64_t stateKey = 0;
+    unsigned int frameIndex = 0;
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+    // Timestamp pairs, they don't nest in other timer queries the way GL_TIME_ELAPSED would
+    GLuint queries[INTERLEAVE_QUERIES][2] = {};
+    bool queryIssued[INTERLEAVE_QUERIES] = {};
+    int nextQuery = 0;
+};
+InterleavedTracing interleaved;
+
+GLuint createInterleavedTexture(int width, int height, GLenum filter)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+void cleanupInterleavedBuffers()
+{
+    glDeleteFramebuffers(1, &interleaved.fbo);
+    glDeleteFramebuffers(1, &interleaved.resolveFbo);
+    glDeleteTextures(1, &interleaved.traced);
+    glDeleteTextures(2, interleaved.resolved);
+    glDeleteRenderbuffers(1, &interleaved.stencil);
+    interleaved.fbo = interleaved.resolveFbo = interleaved.traced = interleaved.stencil = 0;
+    interleaved.resolved[0] = interleaved.resolved[1] = 0;
+    interleaved.width = interleaved.height = 0;
+    interleaved.historyValid = false;
+}
+
+void cleanupInterleaved()
+{
+    cleanupInterleavedBuffers();
+    if (interleaved.queries[0][0] != 0)
+        glDeleteQueries(2 * INTERLEAVE_QUERIES, &interleaved.queries[0][0]);
+    interleaved = InterleavedTracing();
+}
+
+// (Re)creates the targets, nothing happens when they already have this size
+void setupInterleaved(int width, int height)
+{
+    if (interleaved.queries[0][0] == 0)
+        glGenQueries(2 * INTERLEAVE_QUERIES, &interleaved.queries[0][0]);
+    if (interleaved.fbo != 0 && interleaved.width == width && interleaved.height == height)
+        return;
+    cleanupInterleavedBuffers();
+    interleaved.width = width;
+    interleaved.height = height;
+
+    interleaved.traced = createInterleavedTexture(width, height, GL_NEAREST);
+    for (int i = 0; i < 2; i++)
+        interleaved.resolved[i] = createInterleavedTexture(width, height, GL_LINEAR);
+    glGenRenderbuffers(1, &interleaved.stencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, interleaved.stencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &interleaved.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, interleaved.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, interleaved.traced, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, interleaved.stencil);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::INTERLEAVED:: Framebuffer is not complete" << std::endl;
+
+    glGenFramebuffers(1, &interleaved.resolveFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, interleaved.resolveFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, interleaved.resolved[0], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::INTERLEAVED:: Resolve framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Folds finished frame timings into gpuMs without waiting on any
+void readInterleavedTimers()
+{
+    for (int i = 0; i < INTERLEAVE_QUERIES; i++)
+    {
+        if (!interleaved.queryIssued[i])
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(interleaved.queries[i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != GL_TRUE)
+            continue;
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(interleaved.queries[i][0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(interleaved.queries[i][1], GL_QUERY_RESULT, &end);
+        float ms = static_cast<float>(end - start) / 1e6f;
+        interleaved.gpuMs = interleaved.gpuMs == 0.0f ? ms : interleaved.gpuMs + 0.1f * (ms - interleaved.gpuMs);
+        interleaved.queryIssued[i] = false;
+    }
+}
+
+// Sets the pattern uniforms shared through interleave_pattern.glsl
+void setInterleavePattern(Shader& shader)
+{
+    shader.setInt("interleavePattern", interleaved.pattern);
+    shader.setInt("frameIndex", static_cast<int>(interleaved.frameIndex));
+}
+
+// Marks this frame's skipped pixels in the stencil buffer and leaves the traced target bound with the
+// stencil test rejecting them. History from another stateKey is dropped. Draw the traced pass in
+// between this and endInterleavedFrame.
+void beginInterleavedFrame(Shader& maskShader, GLuint vao, int width, int height, uint64_t stateKey)
+{
+    InterleavedTracing& il = interleaved;
+    setupInterleaved(width, height);
+    readInterleavedTimers();
+    if (stateKey != il.stateKey)
+    {
+        il.stateKey = stateKey;
+        il.historyValid = false;
+    }
+    if (!il.queryIssued[il.nextQuery])
+        glQueryCounter(il.queries[il.nextQuery][0], GL_TIMESTAMP);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, il.fbo);
+    glViewport(0, 0, width, height);
+    glClearStencil(0);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    maskShader.use();
+    setInterleavePattern(maskShader);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+
+    glStencilFunc(GL_EQUAL, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+}
+
+// Fills the skipped pixels (the FrameData block has to hold this frame's camera, as the traced pass
+// leaves it) and copies the result to the default framebuffer
+void endInterleavedFrame(Shader& resolveShader, GLuint vao, const glm::mat4& projection, const glm::mat4& view)
+{
+    InterleavedTracing& il = interleaved;
+    glDisable(GL_STENCIL_TEST);
+
+    il.current = 1 - il.current;
+    glBindFramebuffer(GL_FRAMEBUFFER, il.resolveFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, il.resolved[il.current], 0);
+    resolveShader.use();
+    setInterleavePattern(resolveShader);
+    resolveShader.setInt("traced", 0);
+    resolveShader.setInt("history", 1);
+    resolveShader.setBool("historyValid", il.historyValid);
+    resolveShader.setMat4("previousViewProjection", il.previousViewProjection);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, il.traced);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, il.resolved[1 - il.current]);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, il.resolveFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, il.width, il.height, 0, 0, il.width, il.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!il.queryIssued[il.nextQuery])
+    {
+        glQueryCounter(il.queries[il.nextQuery][1], GL_TIMESTAMP);
+        il.queryIssued[il.nextQuery] = true;
+        il.nextQuery = (il.nextQuery + 1) % INTERLEAVE_QUERIES;
+    }
+
+    il.previousViewProjection = projection * view;
+    il.historyValid = true;
+    il.frameIndex++;
+}
+
+#endif // MY_INTERLEAVED_H
@@ -0,0 +1,353 @@
+#ifndef MY_LBVH_H
+#define MY_LBVH_H
+
+#include <glm/glm.hpp>
+
+#include <my_bvh.h>
+#include <my_parallel.h>
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+// Linear BVH (Karras 2012) for fast rebuilds: Morton-sorted centroids, radix sort, then
+// every internal node's range and split is found independently. The result is flattened
+// into the same GPUBVHNode layout the SAH builder produces, so the shader can't tell them apart.
+class LBVHBuilder
+{
+public:
+    LBVHBuilder(const std::vector<AABB>& primBounds, const BVHBuildParams& params)
+        : bounds(primBounds), params(params)
+    {
+        threadCount = params.threadCount > 0 ? params.threadCount : defaultThreadCount();
+    }
+
+    BVH build(BVHBuildStats* stats = nullptr)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        BVH bvh;
+        size_t primCount = bounds.size();
+        if (primCount > 0)
+        {
+            computeMortonCodes();
+            radixSort();
+
+            bvh.primIndices = sortedPrims;
+            memory.allocate(primCount * sizeof(unsigned int));
+            if (primCount > 1)
+                emitHierarchy();
+
+            // Flatten into the shared layout, collapsing small ranges into leaves
+            bvh.nodes.resize(2 * primCount - 1);
+            memory.allocate(bvh.nodes.size() * sizeof(GPUBVHNode));
+            nodesUsed = 1;
+            flatten(bvh, 0, 0, static_cast<unsigned int>(primCount - 1), 0);
+            bvh.nodes.resize(nodesUsed);
+            bvh.nodes.shrink_to_fit();
+        }
+
+        if (stats)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            stats->builder = "LBVH";
+            stats->primCount = primCount;
+            stats->referenceCount = bvh.primIndices.size();
+            stats->nodeCount = static_cast<unsigned int>(bvh.nodes.size());
+            stats->leafCount = leafCount.load();
+            stats->maxDepth = maxDepth.load();
+            stats->threadCount = threadCount;
+            stats->buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+            stats->peakMemoryBytes = memory.peakBytes();
+        }
+        return bvh;
+    }
+
+private:
+    const std::vector<AABB>& bounds;
+    BVHBuildParams params;
+    unsigned int threadCount;
+    BuildMemoryTracker memory;
+
+    std::vector<uint32_t> mortonCodes;      // Sorted along with sortedPrims
+    std::vector<unsigned int> sortedPrims;
+    std::vector<unsigned int> splits;       // Karras split position of internal node i
+    std::vector<unsigned int> rangeEnds;    // Far end of internal node i's range (the near end is i)
+
+    std::atomic<unsigned int> nodesUsed{ 0 };
+    std::atomic<unsigned int> leafCount{ 0 };
+    std::atomic<unsigned int> maxDepth{ 0 };
+    std::atomic<unsigned int> activeTasks{ 0 };
+
+    // Spreads the low 10 bits of v so there are two zero bits between each
+    static uint32_t expandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // 30-bit Morton code for a point in the unit cube
+    static uint32_t morton3D(const glm::vec3& p)
+    {
+        glm::vec3 q = glm::clamp(p * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f));
+        return (expandBits(static_cast<uint32_t>(q.x)) << 2)
+            | (expandBits(static_cast<uint32_t>(q.y)) << 1)
+            | expandBits(static_cast<uint32_t>(q.z));
+    }
+
+    void computeMortonCodes()
+    {
+        size_t primCount = bounds.size();
+
+        // Centroid bounds, reduced per thread
+        std::vector<AABB> partialBoxes(threadCount);
+        parallelFor(0, primCount, [&](size_t begin, size_t end, unsigned int t)
+        {
+            for (size_t i = begin; i < end; i++)
+                partialBoxes[t].grow(bounds[i].centroid());
+        }, threadCount);
+        AABB centroidBox;
+        for (const AABB& box : partialBoxes)
+            centroidBox.grow(box);
+
+        glm::vec3 extent = glm::max(centroidBox.bmax - centroidBox.bmin, glm::vec3(1e-20f));
+        mortonCodes.resize(primCount);
+        sortedPrims.resize(primCount);
+        memory.allocate(primCount * (sizeof(uint32_t) + sizeof(unsigned int)));
+        parallelFor(0, primCount, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                mortonCodes[i] = morton3D((bounds[i].centroid() - centroidBox.bmin) / extent);
+                sortedPrims[i] = static_cast<unsigned int>(i);
+            }
+        }, threadCount);
+    }
+
+    // Parallel LSD radix sort, 8 bits per pass: per-thread histograms, a global prefix sum, then a
+    // stable scatter where each thread writes to its own precomputed offsets
+    void radixSort()
+    {
+        const unsigned int RADIX = 256;
+        size_t count = mortonCodes.size();
+        std::vector<uint32_t> codesTmp(count);
+        std::vector<unsigned int> primsTmp(count);
+        memory.allocate(count * (sizeof(uint32_t) + sizeof(unsigned int)));
+
+        // Chunk boundaries must match between the histogram and scatter passes
+        unsigned int chunks = std::max(1u, std::min<unsigned int>(threadCount, static_cast<unsigned int>(count / 4096)));
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        std::vector<size_t> histograms(chunks * RADIX);
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            std::fill(histograms.begin(), histograms.end(), 0);
+            parallelFor(0, chunks, [&](size_t begin, size_t end, unsigned int)
+            {
+                for (size_t c = begin; c < end; c++)
+                {
+                    size_t* hist = histograms.data() + c * RADIX;
+                    size_t last = std::min(count, (c + 1) * chunkSize);
+                    for (size_t i = c * chunkSize; i < last; i++)
+                        hist[(mortonCodes[i] >> shift) & 0xFF]++;
+                }
+            }, threadCount, 1);
+
+            // Exclusive prefix over (digit, chunk) keeps the sort stable
+            size_t sum = 0;
+            for (unsigned int digit = 0; digit < RADIX; digit++)
+            {
+                for (unsigned int c = 0; c < chunks; c++)
+                {
+                    size_t n = histograms[c * RADIX + digit];
+                    histograms[c * RADIX + digit] = sum;
+                    sum += n;
+                }
+            }
+
+            parallelFor(0, chunks, [&](size_t begin, size_t end, unsigned int)
+            {
+                for (size_t c = begin; c < end; c++)
+                {
+                    size_t* offsets = histograms.data() + c * RADIX;
+                    size_t last = std::min(count, (c + 1) * chunkSize);
+                    for (size_t i = c * chunkSize; i < last; i++)
+                    {
+                        size_t dst = offsets[(mortonCodes[i] >> shift) & 0xFF]++;
+                        codesTmp[dst] = mortonCodes[i];
+                        primsTmp[dst] = sortedPrims[i];
+                    }
+                }
+            }, threadCount, 1);
+
+            mortonCodes.swap(codesTmp);
+            sortedPrims.swap(primsTmp);
+        }
+
+        memory.release(count * (sizeof(uint32_t) + sizeof(unsigned int)));
+    }
+
+    // Length of the common prefix of keys i and j, with the sorted index breaking ties between
+    // equal codes. Returns -1 when j is out of range.
+    int delta(int i, int j) const
+    {
+        int count = static_cast<int>(mortonCodes.size());
+        if (j < 0 || j >= count)
+            return -1;
+        uint32_t a = mortonCodes[i];
+        uint32_t b = mortonCodes[j];
+        if (a == b)
+            return 32 + countLeadingZeros(static_cast<uint32_t>(i ^ j));
+        return countLeadingZeros(a ^ b);
+    }
+
+    static int countLeadingZeros(uint32_t v)
+    {
+        if (v == 0)
+            return 32;
+        int n = 0;
+        while ((v & 0x80000000u) == 0)
+        {
+            v <<= 1;
+            n++;
+        }
+        return n;
+    }
+
+    // Karras 2012: every internal node i finds its range and split independently
+    void emitHierarchy()
+    {
+        int internalCount = static_cast<int>(mortonCodes.size()) - 1;
+        splits.resize(internalCount);
+        rangeEnds.resize(internalCount);
+        memory.allocate(internalCount * 2 * sizeof(unsigned int));
+
+        parallelFor(0, internalCount, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++)
+            {
+                // Direction of the range
+                int d = (delta(i, i + 1) - delta(i, i - 1)) >= 0 ? 1 : -1;
+
+                // Upper bound for the range length
+                int deltaMin = delta(i, i - d);
+                int lMax = 2;
+                while (delta(i, i + lMax * d) > deltaMin)
+                    lMax *= 2;
+
+                // Binary search for the other end
+                int l = 0;
+                for (int t = lMax / 2; t >= 1; t /= 2)
+                {
+                    if (delta(i, i + (l + t) * d) > deltaMin)
+                        l += t;
+                }
+                int j = i + l * d;
+
+                // Binary search for the split position
+                int deltaNode = delta(i, j);
+                int s = 0;
+                for (int t = (l + 1) / 2; ; t = (t + 1) / 2)
+                {
+                    if (delta(i, i + (s + t) * d) > deltaNode)
+                        s += t;
+                    if (t == 1)
+                        break;
+                }
+                int gamma = i + s * d + std::min(d, 0);
+
+                splits[i] = static_cast<unsigned int>(gamma);
+                rangeEnds[i] = static_cast<unsigned int>(j);
+            }
+        }, threadCount);
+    }
+
+    void makeLeaf(unsigned int depth)
+    {
+        leafCount++;
+        unsigned int prev = maxDepth.load();
+        while (depth > prev && !maxDepth.compare_exchange_weak(prev, depth))
+            ;
+    }
+
+    // Karras internal node covering [first, last], found from either end of its range
+    unsigned int internalNodeFor(unsigned int first, unsigned int last) const
+    {
+        // Node i's range starts or ends at i; the root (0) always spans everything
+        if (first == 0 && last == mortonCodes.size() - 1)
+            return 0;
+        if (first < rangeEnds.size() && rangeEnds[first] == last)
+            return first;
+        return last;
+    }
+
+    // Writes the subtree for sorted range [first, last] into nodeIdx, returns its bounds
+    AABB flatten(BVH& bvh, unsigned int nodeIdx, unsigned int first, unsigned int last, unsigned int depth)
+    {
+        GPUBVHNode& node = bvh.nodes[nodeIdx];
+        unsigned int count = last - first + 1;
+        if (count <= static_cast<unsigned int>(params.maxLeafSize))
+        {
+            AABB box;
+            for (unsigned int i = first; i <= last; i++)
+                box.grow(bounds[bvh.primIndices[i]]);
+            node.aabbMin = box.bmin;
+            node.aabbMax = box.bmax;
+            node.leftFirst = first;
+            node.triCount = count;
+            makeLeaf(depth);
+            return box;
+        }
+
+        unsigned int split = splits[internalNodeFor(first, last)];
+        unsigned int leftIdx = nodesUsed.fetch_add(2);
+        node.leftFirst = leftIdx;
+        node.triCount = 0;
+
+        // Same task-splitting policy as the SAH builder
+        AABB leftBox, rightBox;
+        unsigned int leftCount = split - first + 1;
+        unsigned int rightCount = last - split;
+        bool spawnTask = std::min(leftCount, rightCount) >= params.taskThreshold;
+        if (spawnTask && activeTasks.fetch_add(1) + 1 >= threadCount)
+        {
+            activeTasks.fetch_sub(1);
+            spawnTask = false;
+        }
+        if (spawnTask)
+        {
+            std::thread leftTask([&, leftIdx]()
+            {
+                leftBox = flatten(bvh, leftIdx, first, split, depth + 1);
+                activeTasks--;
+            });
+            rightBox = flatten(bvh, leftIdx + 1, split + 1, last, depth + 1);
+            leftTask.join();
+        }
+        else
+        {
+            leftBox = flatten(bvh, leftIdx, first, split, depth + 1);
+            rightBox = flatten(bvh, leftIdx + 1, split + 1, last, depth + 1);
+        }
+
+        AABB box = leftBox;
+        box.grow(rightBox);
+        bvh.nodes[nodeIdx].aabbMin = box.bmin;
+        bvh.nodes[nodeIdx].aabbMax = box.bmax;
+        return box;
+    }
+};
+
+BVH buildLBVH(const std::vector<AABB>& primBounds, const BVHBuildParams& params = BVHBuildParams(),
+    BVHBuildStats* stats = nullptr)
+{
+    LBVHBuilder builder(primBounds, params);
+    return builder.build(stats);
+}
+
+#endif // MY_LBVH_H
@@ -7,6 +7,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <my_shader.h>
+#include <my_animation.h>
 
 #include <string>
 #include <vector>
@@ -16,6 +17,10 @@ struct Vertex
     glm::vec3 Position;
     glm::vec3 Normal;
     glm::vec2 TexCoords;
+
+    // Skinning, unused slots have BoneID -1
+    int BoneIDs[MAX_BONE_INFLUENCE] = { -1, -1, -1, -1 };
+    float Weights[MAX_BONE_INFLUENCE] = { 0.0f, 0.0f, 0.0f, 0.0f };
 };
 
 struct Texture
@@ -33,15 +38,16 @@ public:
     std::vector<Texture> textures;
     std::string meshName;
 
-    // Init the mesh
+    // Init the mesh (uploadToGPU = false keeps it CPU-side only, for tools that run without a GL context)
     Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, 
-        const std::vector<Texture>& textures, const std::string& meshName)
+        const std::vector<Texture>& textures, const std::string& meshName, bool uploadToGPU = true)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
         this->meshName = meshName;
-        setupMesh();
+        if (uploadToGPU)
+            setupMesh();
     }
 
     // Draw the mesh
@@ -73,7 +79,7 @@ public:
     }
 
 private:
-    unsigned int VAO, VBO, EBO;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
 
     // Setup
     void setupMesh()
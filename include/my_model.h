@@ -13,6 +13,7 @@
 
 #include <my_mesh.h>
 #include <my_shader.h>
+#include <my_animation.h>
 
 #include <string>
 #include <fstream>
@@ -27,9 +28,13 @@ public:
     // Public for wall constraints
     std::vector<Mesh> meshes;
 
-    // Constructor (expects a filepath to a 3D model)
-    Model(std::string const& objPath, const GLenum& minFilterType)
-        : minFilterMethod(minFilterType)
+    // Skeleton and animations, empty for static models
+    std::map<std::string, BoneInfo> boneInfoMap;
+    std::vector<Animation> animations;
+
+    // Constructor (expects a filepath to a 3D model), uploadToGPU = false loads geometry and bones only
+    Model(std::string const& objPath, const GLenum& minFilterType, bool uploadToGPU = true)
+        : minFilterMethod(minFilterType), uploadToGPU(uploadToGPU)
     {
         loadModel(objPath);
     }
@@ -45,6 +50,9 @@ private:
     // For mipmaps
     GLenum minFilterMethod;
 
+    // False when there's no GL context, textures and vertex buffers are skipped
+    bool uploadToGPU;
+
     // All textures already loaded
     std::vector<Texture> loadedTextures;
 
@@ -53,7 +61,7 @@ private:
     {
         // Read file
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         
         // Check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
@@ -64,6 +72,10 @@ private:
 
         // Process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // Animations need the complete bone map, so they're read after every mesh
+        for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+            animations.push_back(loadAnimation(scene->mAnimations[i], scene, boneInfoMap));
     }
 
     // Processes a node recursively
@@ -132,6 +144,13 @@ private:
                 indices.push_back(face.mIndices[j]);
         }
 
+        // Bone weights
+        extractBoneWeights(vertices, mesh);
+
+        // Textures need a GL context
+        if (!uploadToGPU)
+            return Mesh(vertices, indices, textures, std::string(mesh->mName.C_Str()), false);
+
         // Process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
@@ -155,6 +174,46 @@ private:
         return Mesh(vertices, indices, textures, std::string(mesh->mName.C_Str()));
     }
 
+    // Adds each bone's weights to the vertices it influences, keeping the MAX_BONE_INFLUENCE largest
+    void extractBoneWeights(std::vector<Vertex>& vertices, aiMesh* mesh)
+    {
+        for (unsigned int b = 0; b < mesh->mNumBones; b++)
+        {
+            const aiBone* bone = mesh->mBones[b];
+            std::string boneName = bone->mName.C_Str();
+            if (boneInfoMap.find(boneName) == boneInfoMap.end())
+            {
+                BoneInfo info;
+                info.id = static_cast<int>(boneInfoMap.size());
+                info.offset = aiToGlm(bone->mOffsetMatrix);
+                boneInfoMap[boneName] = info;
+            }
+            int boneId = boneInfoMap[boneName].id;
+
+            for (unsigned int w = 0; w < bone->mNumWeights; w++)
+            {
+                unsigned int vertexId = bone->mWeights[w].mVertexId;
+                float weight = bone->mWeights[w].mWeight;
+                if (vertexId >= vertices.size())
+                    continue;
+
+                // Replace the smallest influence if this one is larger
+                Vertex& vertex = vertices[vertexId];
+                int slot = 0;
+                for (int i = 1; i < MAX_BONE_INFLUENCE; i++)
+                {
+                    if (vertex.Weights[i] < vertex.Weights[slot])
+                        slot = i;
+                }
+                if (weight > vertex.Weights[slot])
+                {
+                    vertex.BoneIDs[slot] = boneId;
+                    vertex.Weights[slot] = weight;
+                }
+            }
+        }
+    }
+
     // Load materials
     std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
     {
@@ -0,0 +1,51 @@
+#ifndef MY_PARALLEL_H
+#define MY_PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller doesn't specify one
+unsigned int defaultThreadCount()
+{
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 4;
+}
+
+// Splits [begin, end) into one contiguous chunk per thread and calls fn(chunkBegin, chunkEnd, threadIdx)
+// Small ranges (below minPerThread items per thread) run inline on the calling thread
+template <typename Func>
+void parallelFor(size_t begin, size_t end, Func fn, unsigned int threadCount = 0, size_t minPerThread = 4096)
+{
+    if (end <= begin)
+        return;
+
+    size_t count = end - begin;
+    if (threadCount == 0)
+        threadCount = defaultThreadCount();
+    threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, (count + minPerThread - 1) / minPerThread));
+    if (threadCount <= 1)
+    {
+        fn(begin, end, 0u);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threadCount - 1);
+    size_t chunk = (count + threadCount - 1) / threadCount;
+    for (unsigned int t = 1; t < threadCount; t++)
+    {
+        size_t chunkBegin = begin + t * chunk;
+        size_t chunkEnd = std::min(end, chunkBegin + chunk);
+        if (chunkBegin >= chunkEnd)
+            break;
+        workers.emplace_back(fn, chunkBegin, chunkEnd, t);
+    }
+
+    // Calling thread takes the first chunk
+    fn(begin, std::min(end, begin + chunk), 0u);
+    for (auto& worker : workers)
+        worker.join();
+}
+
+#endif // MY_PARALLEL_H
@@ -3,12 +3,26 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include <my_model.h>
+#include <my_bvh.h>
+#include <my_lbvh.h>
+#include <my_sbvh.h>
+#include <my_wide_bvh.h>
+#include <my_bvh_cache.h>
+#include <my_instancing.h>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <vector>
 
 // Globals
 GLuint triangleSSBO;
+GLuint bvhSSBO;
+GLuint bvhLinksSSBO;
+GLuint wideBVHSSBO;
+GLuint tlasSSBO, instanceSSBO;
+GLuint vertexSSBO, indexSSBO;
 GLuint fsVAO, fsVBO;
 struct GPUTriangle
 {
@@ -23,6 +37,68 @@ struct GPUTriangle
     glm::vec4 n2;
 };
 std::vector<GPUTriangle> triangleBuffer;
+
+// Indexed layout: vertices shared between triangles, normals octahedral-encoded into two snorm16s
+struct GPUVertex
+{
+    glm::vec3 position;
+    unsigned int normal;
+};
+
+// Precomputed layout (Woop et al. 2004): rows of the affine transform taking the triangle to the unit
+// triangle (0,0,0), (1,0,0), (0,1,0), so a test needs no edges or cross products. The three vertex
+// normals are octahedral-encoded as for GPUVertex.
+struct GPUUnitTriangle
+{
+    glm::vec4 row0;
+    glm::vec4 row1;
+    glm::vec4 row2;
+    glm::uvec4 normals;     // n0, n1, n2, unused
+};
+
+// Which triangle storage the shader reads, only the selected one is uploaded
+enum TriangleLayout
+{
+    FullTriangles = 0,          // GPUTriangle per slot, 96 bytes
+    IndexedTriangles = 1,       // Three vertex indices per slot into a GPUVertex buffer
+    PrecomputedTriangles = 2    // GPUUnitTriangle per slot, 64 bytes
+};
+TriangleLayout triangleLayout = FullTriangles;
+BVH sceneBVH;
+WideBVH sceneWideBVH;
+BVHBuildParams bvhBuildParams;
+BVHBuildStats bvhBuildStats;
+bool bvhCacheEnabled = true;   // Load/save built BVHs under bvhcache/
+InstanceScene sceneInstances;
+Model* sceneModel = nullptr;   // Model the buffers were built from, rasterized by the hybrid G-buffer pass
+unsigned int sceneVersion = 0; // Bumped on every upload of scene data, so cached images know to reset
+int instanceGridSize = 1;      // Above 1 traces an instanceGridSize^2 grid of the model through the TLAS
+const int MAX_BOUNCE_LIMIT = 8;    // Largest bounce budget the shaders accept (MAX_BOUNCE_LIMIT in trace_common.glsl)
+const unsigned int BVH_STACK_SIZE = 64; // Traversal stack entries in the shaders (BVH_STACK_SIZE in trace_common.glsl)
+const unsigned int TLAS_STACK_SIZE = 32;    // TLAS_STACK_SIZE in trace_common.glsl
+bool fullStackFits = true;      // sceneBVH is shallow enough for the full-stack kernel, otherwise the stackless one runs
+
+// Shared-vertex view of the current model, feeds the indexed triangle layout and skinning
+struct SceneMesh
+{
+    std::vector<Vertex> vertices;               // Every mesh's vertices, concatenated
+    std::vector<glm::uvec3> triangles;          // Vertex indices per triangle, in triangleBuffer's pre-build order
+    std::vector<unsigned int> triangleSource;   // triangleBuffer slot -> index into triangles
+};
+SceneMesh sceneMesh;
+
+// Animated model: sceneMesh.vertices is the bind pose, skinned every frame and refitted into the current BVH
+struct SkinnedScene
+{
+    bool animated = false;
+    std::vector<glm::vec3> positions, normals;  // Skinned this frame
+    Animator animator;
+    float buildSAH = 0.0f;                      // SAH cost right after the last full build
+
+    bool active() const { return animated; }
+};
+SkinnedScene sceneSkin;
+AnimationStats animationStats;
 float fullscreenQuad[] = 
 {
     // Positions   // TexCoords
@@ -31,11 +107,318 @@ float fullscreenQuad[] =
     -1.0f,  3.0f,  0.0f, 2.0f
 };
 
+AABB triangleBounds(const GPUTriangle& tri)
+{
+    AABB box;
+    box.grow(glm::vec3(tri.v0));
+    box.grow(glm::vec3(tri.v1));
+    box.grow(glm::vec3(tri.v2));
+    return box;
+}
+
+// The full-stack kernel pushes at most one far child per level, so a tree as deep as its stack could
+// drop nodes. Such trees are traced with the stackless kernel instead.
+void checkBVHStackDepth()
+{
+    fullStackFits = bvhBuildStats.maxDepth < BVH_STACK_SIZE;
+    if (!fullStackFits)
+        std::cout << "WARNING::BVH:: Depth " << bvhBuildStats.maxDepth << " exceeds the " << BVH_STACK_SIZE
+            << " entry traversal stack, the full-stack kernel falls back to stackless traversal\n";
+}
+
+// traverseWideBVH keeps every hit internal child on a BVH_STACK_SIZE stack, wide trees that could
+// need more are not used (the binary tree is traced instead) rather than dropping nodes
+bool wideStackFits(const WideBVH& wide)
+{
+    unsigned int needed = wideBVHStackSize(wide);
+    if (needed <= BVH_STACK_SIZE)
+        return true;
+    std::cout << "WARNING::BVH:: BVH" << wide.width << " traversal could need " << needed << " stack entries, more than "
+        << BVH_STACK_SIZE << ", tracing the binary tree instead\n";
+    return false;
+}
+
+// Builds the BVH over triangleBuffer and reorders the triangles so every leaf is a contiguous range
+// (SBVH leaves may reference a triangle more than once, in which case it is duplicated). When
+// bvhBuildParams.width is 4 or 8 the binary tree is then collapsed into sceneWideBVH, which
+// reorders the triangles a second time, unless the wide tree is too deep for the traversal stack.
+void buildTriangleBVH()
+{
+    // Nothing carries over from the last build, not every builder fills every field
+    bvhBuildStats = BVHBuildStats();
+
+    // Skip the build entirely when this mesh was already built with the same parameters
+    uint64_t cacheKey = 0;
+    if (bvhCacheEnabled)
+    {
+        auto loadStart = std::chrono::high_resolution_clock::now();
+        cacheKey = computeBVHCacheKey(triangleBuffer.data(), triangleBuffer.size() * sizeof(GPUTriangle), bvhBuildParams);
+        if (loadBVHCache(cacheKey, sceneBVH, sceneWideBVH, triangleBuffer, bvhBuildStats))
+        {
+            double loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count();
+            std::cout << "BVH cache: loaded " << bvhCachePath(cacheKey) << " in " << loadMs << " ms\n";
+            printBVHBuildStats(bvhBuildStats);
+            checkBVHStackDepth();
+            return;
+        }
+    }
+
+    std::vector<AABB> primBounds(triangleBuffer.size());
+    parallelFor(0, triangleBuffer.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+            primBounds[i] = triangleBounds(triangleBuffer[i]);
+    }, bvhBuildParams.threadCount);
+
+    if (bvhBuildParams.mode == FastBuild)
+        sceneBVH = buildLBVH(primBounds, bvhBuildParams, &bvhBuildStats);
+    else if (bvhBuildParams.mode == SpatialSplitBuild)
+    {
+        // Spatial splits clip the actual triangles, not just their boxes
+        std::vector<glm::vec3> triVertices(triangleBuffer.size() * 3);
+        for (size_t i = 0; i < triangleBuffer.size(); i++)
+        {
+            triVertices[3 * i] = glm::vec3(triangleBuffer[i].v0);
+            triVertices[3 * i + 1] = glm::vec3(triangleBuffer[i].v1);
+            triVertices[3 * i + 2] = glm::vec3(triangleBuffer[i].v2);
+        }
+        sceneBVH = buildSBVH(triVertices, bvhBuildParams, &bvhBuildStats);
+    }
+    else
+        sceneBVH = buildBVH(primBounds, bvhBuildParams, &bvhBuildStats);
+    bvhBuildStats.sahCost = computeSAHCost(sceneBVH, bvhBuildParams);
+
+    std::vector<GPUTriangle> ordered(sceneBVH.primIndices.size());
+    parallelFor(0, sceneBVH.primIndices.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+            ordered[i] = triangleBuffer[sceneBVH.primIndices[i]];
+    }, bvhBuildParams.threadCount);
+    triangleBuffer.swap(ordered);
+
+    sceneWideBVH = WideBVH();
+    bvhBuildStats.width = 2;
+    bvhBuildStats.nodeBytes = sceneBVH.nodes.size() * sizeof(GPUBVHNode);
+    if (bvhBuildParams.width > 2 && !sceneBVH.nodes.empty())
+    {
+        std::vector<AABB> slotBounds(triangleBuffer.size());
+        for (size_t i = 0; i < triangleBuffer.size(); i++)
+            slotBounds[i] = triangleBounds(triangleBuffer[i]);
+        WideBVH wide = collapseBVH(sceneBVH, slotBounds, bvhBuildParams.width);
+        if (wideStackFits(wide))
+        {
+            sceneWideBVH = std::move(wide);
+            std::vector<GPUTriangle> wideOrdered(sceneWideBVH.slotOrder.size());
+            for (size_t i = 0; i < sceneWideBVH.slotOrder.size(); i++)
+                wideOrdered[i] = triangleBuffer[sceneWideBVH.slotOrder[i]];
+            triangleBuffer.swap(wideOrdered);
+
+            bvhBuildStats.width = sceneWideBVH.width;
+            bvhBuildStats.wideNodeCount = sceneWideBVH.nodeCount;
+            bvhBuildStats.nodeBytes = sceneWideBVH.data.size() * sizeof(glm::uvec4);
+        }
+    }
+
+    printBVHBuildStats(bvhBuildStats);
+    checkBVHStackDepth();
+    if (bvhCacheEnabled && saveBVHCache(cacheKey, sceneBVH, sceneWideBVH, triangleBuffer, bvhBuildStats))
+        std::cout << "BVH cache: saved " << bvhCachePath(cacheKey) << "\n";
+}
+
+// Rebuilds the TLAS over a grid of instances of the current model, the model's BVH (over all its
+// meshes) is the only BLAS
+void buildSceneInstances()
+{
+    sceneInstances = InstanceScene();
+    if (instanceGridSize <= 1 || sceneBVH.nodes.empty())
+        return;
+
+    AABB blasBox;
+    blasBox.bmin = sceneBVH.nodes[0].aabbMin;
+    blasBox.bmax = sceneBVH.nodes[0].aabbMax;
+    BVHBuildStats tlasStats;
+    sceneInstances = buildInstanceScene(blasBox, makeInstanceGrid(blasBox, instanceGridSize), 0, 0, &tlasStats);
+
+    // traceInstances pushes one far child per TLAS level, a deeper tree would drop instances
+    if (tlasStats.maxDepth >= TLAS_STACK_SIZE)
+    {
+        std::cout << "WARNING::TLAS:: Depth " << tlasStats.maxDepth << " exceeds the " << TLAS_STACK_SIZE
+            << " entry traversal stack, tracing the model without instances\n";
+        sceneInstances = InstanceScene();
+        return;
+    }
+    size_t instanceBytes = sceneInstances.tlas.nodes.size() * sizeof(GPUBVHNode) + sceneInstances.instances.size() * sizeof(GPUInstance);
+    std::cout << "TLAS: " << sceneInstances.instances.size() << " instances, " << tlasStats.nodeCount << " nodes, "
+        << tlasStats.buildTimeMs << " ms, " << static_cast<double>(instanceBytes) / 1024.0 << " KB on top of the shared BLAS\n";
+}
+
+// Root bounds of whatever the shaders trace, rays in air leaving them can't hit anything else. The
+// binary tree's root is kept up to date by refits and is the same box the wide nodes cover.
+AABB sceneBounds()
+{
+    AABB box;
+    if (!sceneInstances.instances.empty())
+    {
+        box.bmin = sceneInstances.tlas.nodes[0].aabbMin;
+        box.bmax = sceneInstances.tlas.nodes[0].aabbMax;
+    }
+    else if (!sceneBVH.nodes.empty())
+    {
+        box.bmin = sceneBVH.nodes[0].aabbMin;
+        box.bmax = sceneBVH.nodes[0].aabbMax;
+    }
+    else
+    {
+        for (const GPUTriangle& tri : triangleBuffer)
+            box.grow(triangleBounds(tri));
+    }
+    return box;
+}
+
+// Where every triangleBuffer slot came from after the BVH reordered (and possibly collapsed) it
+void updateTriangleSource()
+{
+    sceneMesh.triangleSource.resize(triangleBuffer.size());
+    for (size_t i = 0; i < triangleBuffer.size(); i++)
+    {
+        unsigned int binarySlot = sceneWideBVH.slotOrder.empty() ? static_cast<unsigned int>(i) : sceneWideBVH.slotOrder[i];
+        sceneMesh.triangleSource[i] = sceneBVH.primIndices[binarySlot];
+    }
+}
+
+// Octahedral normal encoding: project onto the octahedron, fold the lower half over the diagonals
+unsigned int packOctNormal(const glm::vec3& n)
+{
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum <= 0.0f)
+        return glm::packSnorm2x16(glm::vec2(0.0f));
+
+    glm::vec2 oct = glm::vec2(n.x, n.y) / sum;
+    if (n.z < 0.0f)
+    {
+        glm::vec2 folded = 1.0f - glm::abs(glm::vec2(oct.y, oct.x));
+        oct = glm::vec2(oct.x >= 0.0f ? folded.x : -folded.x, oct.y >= 0.0f ? folded.y : -folded.y);
+    }
+    return glm::packSnorm2x16(oct);
+}
+
+glm::vec3 unpackOctNormal(unsigned int packed)
+{
+    glm::vec2 e = glm::unpackSnorm2x16(packed);
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if (n.z < 0.0f)
+    {
+        glm::vec2 folded = 1.0f - glm::abs(glm::vec2(n.y, n.x));
+        n.x = n.x >= 0.0f ? folded.x : -folded.x;
+        n.y = n.y >= 0.0f ? folded.y : -folded.y;
+    }
+    return glm::normalize(n);
+}
+
+// World space = v0 + x * edge1 + y * edge2 + z * (edge1 x edge2), inverted. Degenerate triangles keep
+// zeroed rows, which the intersection test rejects.
+GPUUnitTriangle makeUnitTriangle(const GPUTriangle& tri)
+{
+    GPUUnitTriangle out = GPUUnitTriangle();
+    out.normals = glm::uvec4(packOctNormal(glm::vec3(tri.n0)), packOctNormal(glm::vec3(tri.n1)), packOctNormal(glm::vec3(tri.n2)), 0u);
+
+    glm::vec3 v0(tri.v0);
+    glm::vec3 edge1 = glm::vec3(tri.v1) - v0;
+    glm::vec3 edge2 = glm::vec3(tri.v2) - v0;
+    glm::vec3 normal = glm::cross(edge1, edge2);
+    if (glm::dot(normal, normal) <= 1e-30f)
+        return out;
+
+    glm::mat4 toWorld(glm::vec4(edge1, 0.0f), glm::vec4(edge2, 0.0f), glm::vec4(normal, 0.0f), glm::vec4(v0, 1.0f));
+    glm::mat4 toUnit = glm::inverse(toWorld);
+    out.row0 = glm::vec4(toUnit[0][0], toUnit[1][0], toUnit[2][0], toUnit[3][0]);
+    out.row1 = glm::vec4(toUnit[0][1], toUnit[1][1], toUnit[2][1], toUnit[3][1]);
+    out.row2 = glm::vec4(toUnit[0][2], toUnit[1][2], toUnit[2][2], toUnit[3][2]);
+    return out;
+}
+
+// Precomputed layout in triangleBuffer's slot order
+std::vector<GPUUnitTriangle> packUnitTriangles(const std::vector<GPUTriangle>& tris)
+{
+    std::vector<GPUUnitTriangle> unitTris(tris.size());
+    parallelFor(0, tris.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+            unitTris[i] = makeUnitTriangle(tris[i]);
+    }, bvhBuildParams.threadCount);
+    return unitTris;
+}
+
+// Shared vertices for the indexed layout, skinned this frame when the model is animated
+std::vector<GPUVertex> packSceneVertices()
+{
+    bool skinned = sceneSkin.active() && sceneSkin.positions.size() == sceneMesh.vertices.size();
+    std::vector<GPUVertex> vertices(sceneMesh.vertices.size());
+    parallelFor(0, vertices.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            vertices[i].position = skinned ? sceneSkin.positions[i] : sceneMesh.vertices[i].Position;
+            vertices[i].normal = packOctNormal(skinned ? sceneSkin.normals[i] : sceneMesh.vertices[i].Normal);
+        }
+    }, bvhBuildParams.threadCount);
+    return vertices;
+}
+
+// Vertex indices per triangleBuffer slot, so BVH leaves index both layouts the same way
+std::vector<glm::uvec3> packSceneIndices()
+{
+    std::vector<glm::uvec3> indices(sceneMesh.triangleSource.size());
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = sceneMesh.triangles[sceneMesh.triangleSource[i]];
+    return indices;
+}
+
+size_t indexedTriangleBytes()
+{
+    return sceneMesh.vertices.size() * sizeof(GPUVertex) + sceneMesh.triangleSource.size() * sizeof(glm::uvec3);
+}
+
+void printTriangleMemory()
+{
+    if (triangleBuffer.empty())
+        return;
+    double fullBytes = static_cast<double>(triangleBuffer.size() * sizeof(GPUTriangle));
+    double indexedBytes = static_cast<double>(indexedTriangleBytes());
+    double unitBytes = static_cast<double>(triangleBuffer.size() * sizeof(GPUUnitTriangle));
+    double triangles = static_cast<double>(triangleBuffer.size());
+    std::cout << "Triangles: " << triangleBuffer.size() << " slots, " << sceneMesh.vertices.size() << " vertices\n";
+    std::cout << "> Full: " << fullBytes / (1024.0 * 1024.0) << " MB (" << fullBytes / triangles << " B/triangle)\n";
+    std::cout << "> Indexed: " << indexedBytes / (1024.0 * 1024.0) << " MB (" << indexedBytes / triangles << " B/triangle)\n";
+    std::cout << "> Precomputed: " << unitBytes / (1024.0 * 1024.0) << " MB (" << unitBytes / triangles << " B/triangle)\n";
+}
+
+GPUTriangle skinnedTriangle(unsigned int tri)
+{
+    const glm::uvec3& idx = sceneMesh.triangles[tri];
+    GPUTriangle out;
+    out.v0 = glm::vec4(sceneSkin.positions[idx.x], 1.0f);
+    out.v1 = glm::vec4(sceneSkin.positions[idx.y], 1.0f);
+    out.v2 = glm::vec4(sceneSkin.positions[idx.z], 1.0f);
+    out.n0 = glm::vec4(sceneSkin.normals[idx.x], 0.0f);
+    out.n1 = glm::vec4(sceneSkin.normals[idx.y], 0.0f);
+    out.n2 = glm::vec4(sceneSkin.normals[idx.z], 0.0f);
+    return out;
+}
+
 void getTriangleBuffer(Model& model)
 {
+    sceneModel = &model;
+    sceneMesh = SceneMesh();
+    sceneSkin = SkinnedScene();
+    sceneSkin.animated = !model.animations.empty() && !model.boneInfoMap.empty();
+
     triangleBuffer.clear();
     for (const auto& mesh : model.meshes)
     {
+        unsigned int vertexBase = static_cast<unsigned int>(sceneMesh.vertices.size());
+        sceneMesh.vertices.insert(sceneMesh.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+
         for (size_t i = 0; i < mesh.indices.size(); i += 3)
         {
             GPUTriangle tri;
@@ -53,20 +436,302 @@ void getTriangleBuffer(Model& model)
             tri.n1 = glm::vec4(glm::normalize(v1.Normal), 0.0f);
             tri.n2 = glm::vec4(glm::normalize(v2.Normal), 0.0f);
             triangleBuffer.push_back(tri);
+
+            sceneMesh.triangles.push_back(vertexBase + glm::uvec3(mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2]));
         }
     }
+
+    // Build the acceleration structure over the new triangles
+    buildTriangleBVH();
+    updateTriangleSource();
+    buildSceneInstances();
+    printTriangleMemory();
+
+    if (sceneSkin.animated)
+    {
+        sceneSkin.buildSAH = computeSAHCost(sceneBVH, bvhBuildParams);
+        sceneSkin.animator.play(&model.animations[0], model.boneInfoMap);
+        animationStats = AnimationStats();
+        std::cout << "Animation: " << model.animations[0].name << ", " << model.boneInfoMap.size() << " bones, "
+            << sceneMesh.vertices.size() << " skinned vertices\n";
+    }
 }
 
-void setupSSBO()
+// TLAS nodes and instances, one zeroed entry each when instancing is off so the bindings stay valid
+void setupInstanceSSBO()
+{
+    if (tlasSSBO == 0)
+        glGenBuffers(1, &tlasSSBO);
+    if (instanceSSBO == 0)
+        glGenBuffers(1, &instanceSSBO);
+
+    std::vector<GPUBVHNode> tlasNodes = sceneInstances.tlas.nodes;
+    std::vector<GPUInstance> instances = sceneInstances.instances;
+    if (tlasNodes.empty())
+        tlasNodes.resize(1, GPUBVHNode());
+    if (instances.empty())
+        instances.resize(1, GPUInstance());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlasSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        tlasNodes.size() * sizeof(GPUBVHNode),
+        tlasNodes.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, tlasSSBO);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        instances.size() * sizeof(GPUInstance),
+        instances.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, instanceSSBO);
+    sceneVersion++;
+}
+
+// Triangles in the selected layout, the other layout's buffers get one zeroed entry so their bindings stay valid
+void setupTriangleSSBO()
 {
     if (triangleSSBO == 0)
         glGenBuffers(1, &triangleSSBO);
+    if (vertexSSBO == 0)
+        glGenBuffers(1, &vertexSSBO);
+    if (indexSSBO == 0)
+        glGenBuffers(1, &indexSSBO);
+
+    // The full and precomputed layouts both live in the triangles buffer (binding 0)
+    bool indexed = triangleLayout == IndexedTriangles;
+    std::vector<GPUVertex> vertices = indexed ? packSceneVertices() : std::vector<GPUVertex>();
+    std::vector<glm::uvec3> indices = indexed ? packSceneIndices() : std::vector<glm::uvec3>();
+    if (vertices.empty())
+        vertices.resize(1, GPUVertex());
+    if (indices.empty())
+        indices.resize(1, glm::uvec3(0u));
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER,
-        triangleBuffer.size() * sizeof(GPUTriangle),
-        triangleBuffer.data(), GL_DYNAMIC_DRAW); // Use dynamic since re-uploading when changing model
+    if (triangleLayout == PrecomputedTriangles && !triangleBuffer.empty())
+    {
+        std::vector<GPUUnitTriangle> unitTris = packUnitTriangles(triangleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+            unitTris.size() * sizeof(GPUUnitTriangle),
+            unitTris.data(), GL_DYNAMIC_DRAW);
+    }
+    else if (triangleLayout == FullTriangles && !triangleBuffer.empty())
+    {
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+            triangleBuffer.size() * sizeof(GPUTriangle),
+            triangleBuffer.data(), GL_DYNAMIC_DRAW); // Use dynamic since re-uploading when changing model
+    }
+    else
+    {
+        GPUTriangle emptyTriangle = GPUTriangle();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPUTriangle), &emptyTriangle, GL_DYNAMIC_DRAW);
+    }
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleSSBO);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertexSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        vertices.size() * sizeof(GPUVertex),
+        vertices.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, vertexSSBO);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        indices.size() * sizeof(glm::uvec3),
+        indices.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, indexSSBO);
+    sceneVersion++;
+}
+
+void setupSSBO()
+{
+    setupTriangleSSBO();
+
+    // BVH nodes
+    if (bvhSSBO == 0)
+        glGenBuffers(1, &bvhSSBO);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        sceneBVH.nodes.size() * sizeof(GPUBVHNode),
+        sceneBVH.nodes.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvhSSBO);
+
+    // Parent links for the short-stack and stackless kernels, one zeroed entry when there are no nodes
+    if (bvhLinksSSBO == 0)
+        glGenBuffers(1, &bvhLinksSSBO);
+
+    std::vector<unsigned int> bvhLinks = computeBVHLinks(sceneBVH);
+    if (bvhLinks.empty())
+        bvhLinks.push_back(0u);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhLinksSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        bvhLinks.size() * sizeof(unsigned int),
+        bvhLinks.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bvhLinksSSBO);
+
+    // Compressed wide nodes, a single zeroed node when the binary tree is in use so the binding stays valid
+    if (wideBVHSSBO == 0)
+        glGenBuffers(1, &wideBVHSSBO);
+
+    std::vector<glm::uvec4> wideData = sceneWideBVH.data;
+    if (wideData.empty())
+        wideData.assign(4, glm::uvec4(0u));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, wideBVHSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+        wideData.size() * sizeof(glm::uvec4),
+        wideData.data(), GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, wideBVHSSBO);
+
+    setupInstanceSSBO();
+}
+
+// Skins the animated model for this frame and refits its BVH, or rebuilds it once the refitted tree's
+// SAH cost is more than rebuildThreshold times what the last build produced. Triangles and nodes are
+// re-uploaded in place, the instance TLAS (if any) is refitted around the new BLAS bounds.
+void animateScene(float deltaTime, float rebuildThreshold)
+{
+    if (!sceneSkin.active())
+        return;
+
+    using Clock = std::chrono::high_resolution_clock;
+    auto elapsedMs = [](Clock::time_point since) { return std::chrono::duration<double, std::milli>(Clock::now() - since).count(); };
+
+    auto stageStart = Clock::now();
+    sceneSkin.animator.update(deltaTime);
+    animationStats.animateMs = elapsedMs(stageStart);
+
+    stageStart = Clock::now();
+    skinVertices(sceneMesh.vertices, sceneSkin.animator.boneMatrices, sceneSkin.positions, sceneSkin.normals,
+        bvhBuildParams.threadCount);
+    animationStats.skinMs = elapsedMs(stageStart);
+
+    // Bounds are indexed like the BVH's primitives, i.e. by source triangle
+    stageStart = Clock::now();
+    std::vector<AABB> primBounds(sceneMesh.triangles.size());
+    parallelFor(0, primBounds.size(), [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const glm::uvec3& idx = sceneMesh.triangles[i];
+            primBounds[i] = AABB();
+            primBounds[i].grow(sceneSkin.positions[idx.x]);
+            primBounds[i].grow(sceneSkin.positions[idx.y]);
+            primBounds[i].grow(sceneSkin.positions[idx.z]);
+        }
+    }, bvhBuildParams.threadCount);
+    refitBVH(sceneBVH, primBounds);
+    animationStats.sahRatio = sceneSkin.buildSAH > 0.0f ? computeSAHCost(sceneBVH, bvhBuildParams) / sceneSkin.buildSAH : 1.0f;
+    animationStats.rebuilt = animationStats.sahRatio > rebuildThreshold;
+
+    if (animationStats.rebuilt)
+    {
+        // Full build from the skinned triangles in source order, never cached since poses don't repeat
+        triangleBuffer.resize(sceneMesh.triangles.size());
+        parallelFor(0, triangleBuffer.size(), [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t i = begin; i < end; i++)
+                triangleBuffer[i] = skinnedTriangle(static_cast<unsigned int>(i));
+        }, bvhBuildParams.threadCount);
+
+        bool cacheEnabled = bvhCacheEnabled;
+        bvhCacheEnabled = false;
+        buildTriangleBVH();
+        bvhCacheEnabled = cacheEnabled;
+        updateTriangleSource();
+        sceneSkin.buildSAH = computeSAHCost(sceneBVH, bvhBuildParams);
+        animationStats.rebuilds++;
+    }
+    else
+    {
+        // Wide nodes are quantized against their parent, so they're collapsed again from the refitted tree.
+        // A collapse that no longer fits the traversal stack drops back to the binary tree.
+        if (bvhBuildStats.width > 2)
+        {
+            std::vector<AABB> slotBounds(sceneBVH.primIndices.size());
+            for (size_t i = 0; i < slotBounds.size(); i++)
+                slotBounds[i] = primBounds[sceneBVH.primIndices[i]];
+            sceneWideBVH = collapseBVH(sceneBVH, slotBounds, bvhBuildParams.width);
+            if (wideStackFits(sceneWideBVH))
+            {
+                bvhBuildStats.wideNodeCount = sceneWideBVH.nodeCount;
+                bvhBuildStats.nodeBytes = sceneWideBVH.data.size() * sizeof(glm::uvec4);
+            }
+            else
+            {
+                sceneWideBVH = WideBVH();
+                bvhBuildStats.width = 2;
+                bvhBuildStats.wideNodeCount = 0;
+                bvhBuildStats.nodeBytes = sceneBVH.nodes.size() * sizeof(GPUBVHNode);
+            }
+            updateTriangleSource();
+        }
+
+        parallelFor(0, triangleBuffer.size(), [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t i = begin; i < end; i++)
+                triangleBuffer[i] = skinnedTriangle(sceneMesh.triangleSource[i]);
+        }, bvhBuildParams.threadCount);
+    }
+
+    if (!sceneInstances.instances.empty())
+    {
+        AABB blasBox;
+        blasBox.bmin = sceneBVH.nodes[0].aabbMin;
+        blasBox.bmax = sceneBVH.nodes[0].aabbMax;
+        refitInstanceScene(sceneInstances, blasBox);
+    }
+    animationStats.refitMs = elapsedMs(stageStart);
+
+    // A rebuild can change every buffer's size, a refit only the wide nodes'
+    stageStart = Clock::now();
+    if (animationStats.rebuilt)
+        setupSSBO();
+    else
+    {
+        if (triangleLayout == IndexedTriangles)
+        {
+            // Indices only move when the wide tree was collapsed again
+            std::vector<GPUVertex> vertices = packSceneVertices();
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertexSSBO);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, vertices.size() * sizeof(GPUVertex), vertices.data());
+            if (bvhBuildParams.width > 2)
+            {
+                std::vector<glm::uvec3> indices = packSceneIndices();
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexSSBO);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(glm::uvec3), indices.data());
+            }
+        }
+        else if (triangleLayout == PrecomputedTriangles)
+        {
+            std::vector<GPUUnitTriangle> unitTris = packUnitTriangles(triangleBuffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, unitTris.size() * sizeof(GPUUnitTriangle), unitTris.data());
+        }
+        else
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, triangleBuffer.size() * sizeof(GPUTriangle), triangleBuffer.data());
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sceneBVH.nodes.size() * sizeof(GPUBVHNode), sceneBVH.nodes.data());
+
+        // Parents don't move on a refit but the near-child axes can
+        std::vector<unsigned int> bvhLinks = computeBVHLinks(sceneBVH);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhLinksSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bvhLinks.size() * sizeof(unsigned int), bvhLinks.data());
+        if (!sceneWideBVH.data.empty())
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, wideBVHSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sceneWideBVH.data.size() * sizeof(glm::uvec4),
+                sceneWideBVH.data.data(), GL_DYNAMIC_DRAW);
+        }
+        if (!sceneInstances.tlas.nodes.empty())
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlasSSBO);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sceneInstances.tlas.nodes.size() * sizeof(GPUBVHNode),
+                sceneInstances.tlas.nodes.data());
+        }
+    }
+    animationStats.uploadMs = elapsedMs(stageStart);
+    sceneVersion++;
 }
 
 void setupFullscreenQuad()
@@ -85,6 +750,13 @@ void setupFullscreenQuad()
 void cleanupRayTracing()
 {
     glDeleteBuffers(1, &triangleSSBO);
+    glDeleteBuffers(1, &bvhSSBO);
+    glDeleteBuffers(1, &bvhLinksSSBO);
+    glDeleteBuffers(1, &wideBVHSSBO);
+    glDeleteBuffers(1, &tlasSSBO);
+    glDeleteBuffers(1, &instanceSSBO);
+    glDeleteBuffers(1, &vertexSSBO);
+    glDeleteBuffers(1, &indexSSBO);
     glDeleteVertexArrays(1, &fsVAO);
     glDeleteBuffers(1, &fsVBO);
 }
@@ -0,0 +1,491 @@
+#ifndef MY_SBVH_H
+#define MY_SBVH_H
+
+#include <glm/glm.hpp>
+
+#include <my_bvh.h>
+#include <my_parallel.h>
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Spatial-split BVH (Stich et al. 2009). Where object-split children overlap heavily (long sliver
+// triangles), references are clipped at a spatial plane and stored in both children instead.
+// The number of extra references is capped by params.spatialSplitBudget. Leaves can share
+// triangles, so primIndices may contain duplicates.
+class SBVHBuilder
+{
+public:
+    // triVertices holds 3 positions per triangle
+    SBVHBuilder(const std::vector<glm::vec3>& triVertices, const BVHBuildParams& params)
+        : vertices(triVertices), params(params)
+    {
+        threadCount = params.threadCount > 0 ? params.threadCount : defaultThreadCount();
+    }
+
+    BVH build(BVHBuildStats* stats = nullptr)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        BVH bvh;
+        size_t primCount = vertices.size() / 3;
+        if (primCount > 0)
+        {
+            std::vector<Reference> refs(primCount);
+            AABB rootBox;
+            for (size_t i = 0; i < primCount; i++)
+            {
+                refs[i].prim = static_cast<unsigned int>(i);
+                for (int v = 0; v < 3; v++)
+                    refs[i].box.grow(vertices[3 * i + v]);
+                rootBox.grow(refs[i].box);
+            }
+            rootArea = rootBox.area();
+            memory.allocate(refs.size() * sizeof(Reference));
+
+            // Everything is preallocated for the worst case the budget allows, so subtrees can be
+            // built concurrently with atomic slot allocation
+            maxReferences = primCount + static_cast<size_t>(params.spatialSplitBudget * static_cast<float>(primCount));
+            referenceCount = primCount;
+            bvh.nodes.resize(2 * maxReferences - 1);
+            bvh.primIndices.resize(maxReferences);
+            memory.allocate(bvh.nodes.size() * sizeof(GPUBVHNode) + bvh.primIndices.size() * sizeof(unsigned int));
+            nodesUsed = 1;
+            primsUsed = 0;
+
+            buildNode(bvh, 0, refs, 0);
+
+            bvh.nodes.resize(nodesUsed);
+            bvh.nodes.shrink_to_fit();
+            bvh.primIndices.resize(primsUsed);
+            bvh.primIndices.shrink_to_fit();
+        }
+
+        if (stats)
+        {
+            auto endTime = std::chrono::high_resolution_clock::now();
+            stats->builder = "SBVH";
+            stats->primCount = primCount;
+            stats->referenceCount = bvh.primIndices.size();
+            stats->nodeCount = static_cast<unsigned int>(bvh.nodes.size());
+            stats->leafCount = leafCount.load();
+            stats->maxDepth = maxDepth.load();
+            stats->threadCount = threadCount;
+            stats->buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+            stats->peakMemoryBytes = memory.peakBytes();
+        }
+        return bvh;
+    }
+
+private:
+    struct Reference
+    {
+        AABB box;           // Clipped bounds, a sub-box of the triangle's bounds after spatial splits
+        unsigned int prim;
+    };
+
+    struct Split
+    {
+        float cost = FLT_MAX;   // Nl * Al + Nr * Ar
+        int axis = -1;
+        float pos = 0.0f;
+        AABB leftBox, rightBox;
+        unsigned int leftCount = 0, rightCount = 0;
+    };
+
+    struct SpatialBin
+    {
+        AABB box;
+        unsigned int entries = 0;
+        unsigned int exits = 0;
+    };
+
+    const std::vector<glm::vec3>& vertices;
+    BVHBuildParams params;
+    unsigned int threadCount;
+    float rootArea = 0.0f;
+    size_t maxReferences = 0;
+    BuildMemoryTracker memory;
+
+    std::atomic<size_t> referenceCount{ 0 };
+    std::atomic<unsigned int> nodesUsed{ 0 };
+    std::atomic<unsigned int> primsUsed{ 0 };
+    std::atomic<unsigned int> leafCount{ 0 };
+    std::atomic<unsigned int> maxDepth{ 0 };
+    std::atomic<unsigned int> activeTasks{ 0 };
+
+    static AABB intersect(const AABB& a, const AABB& b)
+    {
+        AABB result;
+        result.bmin = glm::max(a.bmin, b.bmin);
+        result.bmax = glm::min(a.bmax, b.bmax);
+        return result;
+    }
+
+    // Clips ref's triangle against the plane axis = pos, both halves stay within ref.box
+    void splitReference(const Reference& ref, int axis, float pos, Reference& left, Reference& right) const
+    {
+        left.prim = right.prim = ref.prim;
+        left.box = AABB();
+        right.box = AABB();
+
+        const glm::vec3* v = &vertices[3 * ref.prim];
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec3& a = v[i];
+            const glm::vec3& b = v[(i + 1) % 3];
+            if (a[axis] <= pos)
+                left.box.grow(a);
+            if (a[axis] >= pos)
+                right.box.grow(a);
+
+            // Edge crosses the plane
+            if ((a[axis] < pos && b[axis] > pos) || (a[axis] > pos && b[axis] < pos))
+            {
+                float t = (pos - a[axis]) / (b[axis] - a[axis]);
+                glm::vec3 p = a + (b - a) * glm::clamp(t, 0.0f, 1.0f);
+                p[axis] = pos;
+                left.box.grow(p);
+                right.box.grow(p);
+            }
+        }
+
+        left.box.bmax[axis] = pos;
+        right.box.bmin[axis] = pos;
+        left.box = intersect(left.box, ref.box);
+        right.box = intersect(right.box, ref.box);
+    }
+
+    Split findObjectSplit(const std::vector<Reference>& refs) const
+    {
+        Split best;
+        int binCount = params.binCount;
+        AABB centroidBox;
+        for (const Reference& ref : refs)
+            centroidBox.grow(ref.box.centroid());
+
+        std::vector<AABB> binBoxes(binCount);
+        std::vector<unsigned int> binCounts(binCount);
+        std::vector<AABB> rightBoxes(binCount - 1);
+        std::vector<unsigned int> rightCounts(binCount - 1);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float boundsMin = centroidBox.bmin[axis];
+            float boundsMax = centroidBox.bmax[axis];
+            if (boundsMin == boundsMax)
+                continue;
+
+            std::fill(binBoxes.begin(), binBoxes.end(), AABB());
+            std::fill(binCounts.begin(), binCounts.end(), 0u);
+            float scale = static_cast<float>(binCount) / (boundsMax - boundsMin);
+            for (const Reference& ref : refs)
+            {
+                int binIdx = std::min(binCount - 1, static_cast<int>((ref.box.centroid()[axis] - boundsMin) * scale));
+                binCounts[binIdx]++;
+                binBoxes[binIdx].grow(ref.box);
+            }
+
+            AABB rightBox;
+            unsigned int rightSum = 0;
+            for (int i = binCount - 1; i > 0; i--)
+            {
+                rightSum += binCounts[i];
+                rightBox.grow(binBoxes[i]);
+                rightBoxes[i - 1] = rightBox;
+                rightCounts[i - 1] = rightSum;
+            }
+
+            AABB leftBox;
+            unsigned int leftSum = 0;
+            float binWidth = (boundsMax - boundsMin) / static_cast<float>(binCount);
+            for (int i = 0; i < binCount - 1; i++)
+            {
+                leftSum += binCounts[i];
+                leftBox.grow(binBoxes[i]);
+                float cost = leftSum * leftBox.area() + rightCounts[i] * rightBoxes[i].area();
+                if (cost < best.cost && leftSum > 0 && rightCounts[i] > 0)
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.pos = boundsMin + binWidth * static_cast<float>(i + 1);
+                    best.leftBox = leftBox;
+                    best.rightBox = rightBoxes[i];
+                    best.leftCount = leftSum;
+                    best.rightCount = rightCounts[i];
+                }
+            }
+        }
+        return best;
+    }
+
+    // Bins clipped reference pieces along each axis; entry/exit counters give the child counts
+    Split findSpatialSplit(const std::vector<Reference>& refs, const AABB& nodeBox) const
+    {
+        Split best;
+        int binCount = params.binCount;
+        std::vector<SpatialBin> bins(binCount);
+        std::vector<AABB> rightBoxes(binCount - 1);
+        std::vector<unsigned int> rightCounts(binCount - 1);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float boundsMin = nodeBox.bmin[axis];
+            float boundsMax = nodeBox.bmax[axis];
+            if (boundsMin == boundsMax)
+                continue;
+
+            std::fill(bins.begin(), bins.end(), SpatialBin());
+            float binWidth = (boundsMax - boundsMin) / static_cast<float>(binCount);
+            float scale = 1.0f / binWidth;
+            for (const Reference& ref : refs)
+            {
+                int firstBin = glm::clamp(static_cast<int>((ref.box.bmin[axis] - boundsMin) * scale), 0, binCount - 1);
+                int lastBin = glm::clamp(static_cast<int>((ref.box.bmax[axis] - boundsMin) * scale), firstBin, binCount - 1);
+
+                // Chop the reference at every bin boundary it crosses
+                Reference current = ref;
+                for (int b = firstBin; b < lastBin; b++)
+                {
+                    Reference leftPart, rightPart;
+                    splitReference(current, axis, boundsMin + binWidth * static_cast<float>(b + 1), leftPart, rightPart);
+                    bins[b].box.grow(leftPart.box);
+                    current = rightPart;
+                }
+                bins[lastBin].box.grow(current.box);
+                bins[firstBin].entries++;
+                bins[lastBin].exits++;
+            }
+
+            AABB rightBox;
+            unsigned int rightSum = 0;
+            for (int i = binCount - 1; i > 0; i--)
+            {
+                rightSum += bins[i].exits;
+                rightBox.grow(bins[i].box);
+                rightBoxes[i - 1] = rightBox;
+                rightCounts[i - 1] = rightSum;
+            }
+
+            AABB leftBox;
+            unsigned int leftSum = 0;
+            for (int i = 0; i < binCount - 1; i++)
+            {
+                leftSum += bins[i].entries;
+                leftBox.grow(bins[i].box);
+                float cost = leftSum * leftBox.area() + rightCounts[i] * rightBoxes[i].area();
+                if (cost < best.cost && leftSum > 0 && rightCounts[i] > 0)
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.pos = boundsMin + binWidth * static_cast<float>(i + 1);
+                    best.leftBox = leftBox;
+                    best.rightBox = rightBoxes[i];
+                    best.leftCount = leftSum;
+                    best.rightCount = rightCounts[i];
+                }
+            }
+        }
+        return best;
+    }
+
+    void partitionObject(const std::vector<Reference>& refs, const Split& split,
+        std::vector<Reference>& left, std::vector<Reference>& right) const
+    {
+        for (const Reference& ref : refs)
+        {
+            if (ref.box.centroid()[split.axis] < split.pos)
+                left.push_back(ref);
+            else
+                right.push_back(ref);
+        }
+    }
+
+    // Straddling references are split unless moving them whole to one side is cheaper (unsplitting)
+    void partitionSpatial(const std::vector<Reference>& refs, const Split& split,
+        std::vector<Reference>& left, std::vector<Reference>& right) const
+    {
+        int axis = split.axis;
+        AABB leftBox = split.leftBox, rightBox = split.rightBox;
+        float leftCount = static_cast<float>(split.leftCount);
+        float rightCount = static_cast<float>(split.rightCount);
+        for (const Reference& ref : refs)
+        {
+            if (ref.box.bmax[axis] <= split.pos)
+                left.push_back(ref);
+            else if (ref.box.bmin[axis] >= split.pos)
+                right.push_back(ref);
+            else
+            {
+                AABB leftWith = leftBox, rightWith = rightBox;
+                leftWith.grow(ref.box);
+                rightWith.grow(ref.box);
+                float splitCost = leftBox.area() * leftCount + rightBox.area() * rightCount;
+                float allLeftCost = leftWith.area() * leftCount + rightBox.area() * (rightCount - 1.0f);
+                float allRightCost = leftBox.area() * (leftCount - 1.0f) + rightWith.area() * rightCount;
+
+                if (allLeftCost < splitCost && allLeftCost <= allRightCost)
+                {
+                    left.push_back(ref);
+                    leftBox = leftWith;
+                    rightCount -= 1.0f;
+                }
+                else if (allRightCost < splitCost)
+                {
+                    right.push_back(ref);
+                    rightBox = rightWith;
+                    leftCount -= 1.0f;
+                }
+                else
+                {
+                    Reference leftPart, rightPart;
+                    splitReference(ref, axis, split.pos, leftPart, rightPart);
+                    if (leftPart.box.valid())
+                        left.push_back(leftPart);
+                    if (rightPart.box.valid())
+                        right.push_back(rightPart);
+                }
+            }
+        }
+    }
+
+    void makeLeaf(BVH& bvh, unsigned int nodeIdx, const std::vector<Reference>& refs, unsigned int depth)
+    {
+        unsigned int first = primsUsed.fetch_add(static_cast<unsigned int>(refs.size()));
+        for (size_t i = 0; i < refs.size(); i++)
+            bvh.primIndices[first + i] = refs[i].prim;
+
+        GPUBVHNode& node = bvh.nodes[nodeIdx];
+        node.leftFirst = first;
+        node.triCount = static_cast<unsigned int>(refs.size());
+
+        leafCount++;
+        unsigned int prev = maxDepth.load();
+        while (depth > prev && !maxDepth.compare_exchange_weak(prev, depth))
+            ;
+    }
+
+    void buildNode(BVH& bvh, unsigned int nodeIdx, std::vector<Reference>& refs, unsigned int depth)
+    {
+        AABB nodeBox;
+        for (const Reference& ref : refs)
+            nodeBox.grow(ref.box);
+        bvh.nodes[nodeIdx].aabbMin = nodeBox.bmin;
+        bvh.nodes[nodeIdx].aabbMax = nodeBox.bmax;
+
+        unsigned int count = static_cast<unsigned int>(refs.size());
+        if (count <= 1)
+        {
+            makeLeaf(bvh, nodeIdx, refs, depth);
+            return;
+        }
+
+        // Spatial splits are only tried where object-split children overlap noticeably
+        float nodeArea = std::max(nodeBox.area(), 1e-20f);
+        Split objectSplit = findObjectSplit(refs);
+        Split spatialSplit;
+        size_t reserved = 0;
+        if (objectSplit.axis >= 0 && referenceCount.load() < maxReferences)
+        {
+            AABB overlap = intersect(objectSplit.leftBox, objectSplit.rightBox);
+            if (overlap.valid() && overlap.area() / rootArea > params.spatialSplitAlpha)
+                spatialSplit = findSpatialSplit(refs, nodeBox);
+        }
+        else if (objectSplit.axis < 0)
+            spatialSplit = findSpatialSplit(refs, nodeBox);
+
+        // Reserve budget for the worst-case duplicates of the spatial split
+        bool useSpatial = spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost;
+        if (useSpatial)
+        {
+            reserved = spatialSplit.leftCount + spatialSplit.rightCount - count;
+            if (referenceCount.fetch_add(reserved) + reserved > maxReferences)
+            {
+                referenceCount.fetch_sub(reserved);
+                reserved = 0;
+                useSpatial = false;
+            }
+        }
+
+        const Split& split = useSpatial ? spatialSplit : objectSplit;
+        float splitCost = params.traversalCost + params.intersectCost * split.cost / nodeArea;
+        float leafCost = params.intersectCost * static_cast<float>(count);
+        if (split.axis < 0 || (splitCost >= leafCost && count <= static_cast<unsigned int>(params.maxLeafSize)))
+        {
+            referenceCount.fetch_sub(reserved);
+            makeLeaf(bvh, nodeIdx, refs, depth);
+            return;
+        }
+
+        std::vector<Reference> left, right;
+        left.reserve(split.leftCount);
+        right.reserve(split.rightCount);
+        if (useSpatial)
+            partitionSpatial(refs, split, left, right);
+        else
+            partitionObject(refs, split, left, right);
+
+        // Settle the reservation against what the partition actually duplicated
+        size_t duplicates = left.size() + right.size() - count;
+        if (duplicates > reserved)
+            referenceCount.fetch_add(duplicates - reserved);
+        else
+            referenceCount.fetch_sub(reserved - duplicates);
+
+        // Degenerate, or a spatial split that went over budget: undo the duplicates and fall back to the
+        // object split. Object splits duplicate nothing, so the budget never turns them into a leaf.
+        if (left.empty() || right.empty() || (useSpatial && referenceCount.load() > maxReferences))
+        {
+            referenceCount.fetch_sub(duplicates);
+            left.clear();
+            right.clear();
+            if (useSpatial && objectSplit.axis >= 0)
+                partitionObject(refs, objectSplit, left, right);
+            if (left.empty() || right.empty())
+            {
+                makeLeaf(bvh, nodeIdx, refs, depth);
+                return;
+            }
+        }
+
+        // The parent's references aren't needed once partitioned
+        memory.allocate((left.size() + right.size()) * sizeof(Reference));
+        memory.release(refs.size() * sizeof(Reference));
+        std::vector<Reference>().swap(refs);
+
+        unsigned int leftIdx = nodesUsed.fetch_add(2);
+        bvh.nodes[nodeIdx].leftFirst = leftIdx;
+        bvh.nodes[nodeIdx].triCount = 0;
+
+        bool spawnTask = std::min(left.size(), right.size()) >= params.taskThreshold;
+        if (spawnTask && activeTasks.fetch_add(1) + 1 >= threadCount)
+        {
+            activeTasks.fetch_sub(1);
+            spawnTask = false;
+        }
+        if (spawnTask)
+        {
+            std::thread leftTask([this, &bvh, &left, leftIdx, depth]()
+            {
+                buildNode(bvh, leftIdx, left, depth + 1);
+                activeTasks--;
+            });
+            buildNode(bvh, leftIdx + 1, right, depth + 1);
+            leftTask.join();
+        }
+        else
+        {
+            buildNode(bvh, leftIdx, left, depth + 1);
+            buildNode(bvh, leftIdx + 1, right, depth + 1);
+        }
+    }
+};
+
+BVH buildSBVH(const std::vector<glm::vec3>& triVertices, const BVHBuildParams& params = BVHBuildParams(),
+    BVHBuildStats* stats = nullptr)
+{
+    SBVHBuilder builder(triVertices, params);
+    return builder.build(stats);
+}
+
+#endif // MY_SBVH_H
@@ -4,150 +4,298 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <my_shader_cache.h>
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+
+// GL calls avoided by the cached uniform locations (and the per-frame UBO), summed over every Shader
+struct UniformStats
+{
+    uint64_t lookupsSaved = 0;      // glGetUniformLocation calls replaced by the link-time table
+    uint64_t redundantSkipped = 0;  // Scalar sets skipped because the program already held the value
+    uint64_t inactiveSkipped = 0;   // Sets of uniforms the compiler removed
+    uint64_t blockUploads = 0;      // Per-frame UBO updates (see my_frame_uniforms.h)
+    uint64_t blockCallsSaved = 0;   // glUniform calls the per-frame UBO replaced
+
+    uint64_t callsSaved() const { return lookupsSaved + redundantSkipped + inactiveSkipped + blockCallsSaved; }
+};
+UniformStats uniformStats;
+
+// Typed handle to a uniform, resolved once with Shader::uniform<T>() and set with Shader::set()
+template <typename T>
+struct Uniform
+{
+    int index = -1;     // Into the shader's reflected uniforms, -1 when the program doesn't use it
+
+    bool valid() const { return index >= 0; }
+};
 
 class Shader
 {
 public:
     unsigned int ID;
 
-    Shader(const char* vertexPath, const char* fragmentPath)
+    struct ShaderStage
+    {
+        GLenum type;
+        std::string source;     // Preprocessed (see loadShaderSource and injectDefines)
+    };
+
+    // defines (a block of #define lines) is inserted after the #version line of both stages
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
+        : stagePaths{ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, defines(defines)
+    {
+        buildProgram(fragmentPath, preprocess());
+    }
+
+    // Compute program
+    explicit Shader(const char* computePath, const std::string& defines = "")
+        : stagePaths{ { GL_COMPUTE_SHADER, computePath } }, defines(defines)
     {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
+        buildProgram(computePath, preprocess());
+    }
 
-        // Ensure ifstream objects can throw exceptions
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
+    // Every stage's source with includes expanded and defines injected. Only reads files, so the hot
+    // reloader calls it off the GL thread.
+    std::vector<ShaderStage> preprocess() const
+    {
+        std::vector<ShaderStage> stages;
+        for (const auto& stage : stagePaths)
+            stages.push_back({ stage.first, injectDefines(loadShaderSource(stage.second), defines) });
+        return stages;
+    }
+
+    // File the program is logged under (the fragment or compute stage)
+    const std::string& name() const
+    {
+        return stagePaths.back().second;
+    }
+
+    // Swaps in a program linked from this shader's (edited) source. Uniform handles resolved against the
+    // old program are stale afterwards, so callers that cache them key the cache on ID.
+    void adoptProgram(unsigned int program)
+    {
+        glDeleteProgram(ID);
+        ID = program;
+        uniforms.clear();
+        uniformIndex.clear();
+        reflectUniforms();
+    }
+
+    // Reads a shader file, replacing every #include "file" line (relative to the including file) with
+    // that file's source. #line directives keep compiler errors pointing at the right line; the
+    // source string number is the include depth.
+    static std::string loadShaderSource(const std::string& path, int depth = 0)
+    {
+        std::ifstream file(path);
+        if (!file)
         {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-
-            // Read file's buffer contents into streams
-            std::stringstream vShaderStream, fShaderStream;
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-
-            // Close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-
-            // Convert stream to string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return std::string();
         }
-        catch (std::ifstream::failure& e)
+        if (depth > 8)
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            std::cout << "ERROR::SHADER::INCLUDE_TOO_DEEP: " << path << std::endl;
+            return std::string();
         }
 
-        // Convert string to C-string
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::stringstream source;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line))
+        {
+            lineNumber++;
+            size_t quote = line.find('"');
+            if (line.compare(0, 8, "#include") == 0 && quote != std::string::npos)
+            {
+                std::string includePath = directory + line.substr(quote + 1, line.find('"', quote + 1) - quote - 1);
+                source << "#line 1 " << depth + 1 << "\n";
+                source << loadShaderSource(includePath, depth + 1);
+                source << "#line " << lineNumber + 1 << " " << depth << "\n";
+            }
+            else
+                source << line << "\n";
+        }
+        return source.str();
+    }
 
-        // Compile shaders
-        unsigned int vertex, fragment;
+    // Inserts defines after the #version line (which has to come first), then resets the line number
+    // so errors still point at the file's own lines
+    static std::string injectDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty() || source.compare(0, 8, "#version") != 0)
+            return source;
+        size_t versionEnd = source.find('\n');
+        if (versionEnd == std::string::npos)
+            return source;
+        return source.substr(0, versionEnd + 1) + defines + "\n#line 2 0\n" + source.substr(versionEnd + 1);
+    }
 
-        // Vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "Vertex");
+    // Activates the shader
+    void use()
+    {
+        glUseProgram(ID);
+    }
 
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "Fragment");
+    // Typed handle lookup, invalid (and ignored by set()) when the program has no such active uniform
+    template <typename T>
+    Uniform<T> uniform(const std::string& name) const
+    {
+        Uniform<T> handle;
+        handle.index = findUniform(name);
+        return handle;
+    }
 
-        // Shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "Program");
+    // Typed setters, scalars are only sent when the value changed
+    void set(Uniform<bool> handle, bool value) const
+    {
+        set(Uniform<int>{ handle.index }, static_cast<int>(value));
+    }
 
-        // Delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+    void set(Uniform<int> handle, int value) const
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        if (!skipScalar(handle.index, bits))
+            glUniform1i(uniforms[handle.index].location, value);
     }
 
-    // Activates the shader
-    void use()
+    void set(Uniform<float> handle, float value) const
     {
-        glUseProgram(ID);
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        if (!skipScalar(handle.index, bits))
+            glUniform1f(uniforms[handle.index].location, value);
+    }
+
+    void set(Uniform<glm::vec2> handle, const glm::vec2& value) const
+    {
+        if (active(handle.index))
+            glUniform2fv(uniforms[handle.index].location, 1, &value[0]);
     }
 
-    // Uniform functions
+    void set(Uniform<glm::vec3> handle, const glm::vec3& value) const
+    {
+        if (active(handle.index))
+            glUniform3fv(uniforms[handle.index].location, 1, &value[0]);
+    }
+
+    void set(Uniform<glm::vec4> handle, const glm::vec4& value) const
+    {
+        if (active(handle.index))
+            glUniform4fv(uniforms[handle.index].location, 1, &value[0]);
+    }
+
+    void set(Uniform<glm::mat2> handle, const glm::mat2& mat) const
+    {
+        if (active(handle.index))
+            glUniformMatrix2fv(uniforms[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    void set(Uniform<glm::mat3> handle, const glm::mat3& mat) const
+    {
+        if (active(handle.index))
+            glUniformMatrix3fv(uniforms[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    void set(Uniform<glm::mat4> handle, const glm::mat4& mat) const
+    {
+        if (active(handle.index))
+            glUniformMatrix4fv(uniforms[handle.index].location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // Uniform functions (by name, through the cached locations)
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        set(uniform<bool>(name), value);
     }
 
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        set(uniform<int>(name), value);
     }
 
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        set(uniform<float>(name), value);
     }
 
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        set(uniform<glm::vec2>(name), value);
     }
 
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        set(uniform<glm::vec2>(name), glm::vec2(x, y));
     }
 
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        set(uniform<glm::vec3>(name), value);
     }
 
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        set(uniform<glm::vec3>(name), glm::vec3(x, y, z));
     }
 
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        set(uniform<glm::vec4>(name), value);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        set(uniform<glm::vec4>(name), glm::vec4(x, y, z, w));
     }
 
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        set(uniform<glm::mat2>(name), mat);
     }
 
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        set(uniform<glm::mat3>(name), mat);
     }
 
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        set(uniform<glm::mat4>(name), mat);
+    }
+
+    // Program binary cache key of these stages on the current driver
+    static uint64_t cacheKey(const std::vector<ShaderStage>& stages)
+    {
+        std::vector<std::string> sources;
+        for (const ShaderStage& stage : stages)
+            sources.push_back(std::to_string(stage.type) + stage.source);
+        return computeShaderCacheKey(sources);
+    }
+
+    static std::string stageName(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_VERTEX_SHADER: return "Vertex";
+        case GL_FRAGMENT_SHADER: return "Fragment";
+        case GL_COMPUTE_SHADER: return "Compute";
+        default: return "Shader";
+        }
     }
 
-private:
     // Checks shader compilation/linking errors
-    void checkCompileErrors(GLuint shader, std::string type)
+    static void checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -170,6 +318,136 @@ private:
             }
         }
     }
+
+private:
+    std::vector<std::pair<GLenum, std::string>> stagePaths;
+    std::string defines;
+
+    // Links ID from the program binary cache when it has this exact source for this driver, otherwise
+    // compiles every stage and stores the result. Either way the time taken is logged under name.
+    void buildProgram(const std::string& name, const std::vector<ShaderStage>& stages)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        auto elapsedMs = [&]()
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        };
+
+        ID = glCreateProgram();
+        bool useCache = shaderCacheEnabled && programBinariesSupported();
+        uint64_t key = 0;
+        if (useCache)
+        {
+            key = cacheKey(stages);
+            if (loadProgramBinary(key, ID))
+            {
+                std::cout << "Shader cache: loaded " << name << " in " << elapsedMs() << " ms\n";
+                reflectUniforms();
+                return;
+            }
+        }
+
+        // Compile shaders
+        std::vector<unsigned int> shaders;
+        for (const ShaderStage& stage : stages)
+        {
+            const char* code = stage.source.c_str();
+            unsigned int shader = glCreateShader(stage.type);
+            glShaderSource(shader, 1, &code, NULL);
+            glCompileShader(shader);
+            checkCompileErrors(shader, stageName(stage.type));
+            glAttachShader(ID, shader);
+            shaders.push_back(shader);
+        }
+
+        // Shader Program
+        if (useCache)
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "Program");
+
+        // Delete the shaders as they're linked into our program now and no longer necessary
+        for (unsigned int shader : shaders)
+            glDeleteShader(shader);
+
+        std::cout << "Shader: compiled " << name << " in " << elapsedMs() << " ms\n";
+        GLint linked = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if (useCache && linked == GL_TRUE)
+            saveProgramBinary(key, ID);
+
+        reflectUniforms();
+    }
+
+    // One entry per active default-block uniform, filled in after linking
+    struct UniformInfo
+    {
+        GLint location;
+        GLenum type;
+        bool hasValue = false;  // bits holds the last scalar sent
+        uint32_t bits = 0;
+    };
+    mutable std::vector<UniformInfo> uniforms;
+    std::unordered_map<std::string, int> uniformIndex;
+
+    // Reads every active uniform's location once, arrays are found both as "name" and "name[0]"
+    void reflectUniforms()
+    {
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, static_cast<GLuint>(i), sizeof(name), &length, &size, &type, name);
+            GLint location = glGetUniformLocation(ID, name);
+            if (location < 0)
+                continue; // Lives in a uniform block
+
+            UniformInfo info;
+            info.location = location;
+            info.type = type;
+            std::string uniformName(name, length);
+            uniformIndex[uniformName] = static_cast<int>(uniforms.size());
+            size_t bracket = uniformName.find('[');
+            if (bracket != std::string::npos)
+                uniformIndex[uniformName.substr(0, bracket)] = static_cast<int>(uniforms.size());
+            uniforms.push_back(info);
+        }
+    }
+
+    int findUniform(const std::string& name) const
+    {
+        uniformStats.lookupsSaved++;
+        auto it = uniformIndex.find(name);
+        return it != uniformIndex.end() ? it->second : -1;
+    }
+
+    bool active(int index) const
+    {
+        if (index >= 0)
+            return true;
+        uniformStats.inactiveSkipped++;
+        return false;
+    }
+
+    // True when the call can be skipped, otherwise records bits as the program's current value
+    bool skipScalar(int index, uint32_t bits) const
+    {
+        if (!active(index))
+            return true;
+        UniformInfo& info = uniforms[index];
+        if (info.hasValue && info.bits == bits)
+        {
+            uniformStats.redundantSkipped++;
+            return true;
+        }
+        info.hasValue = true;
+        info.bits = bits;
+        return false;
+    }
 };
 #endif // MY_SHADER_H
 
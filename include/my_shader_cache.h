@@ -0,0 +1,145 @@
+#ifndef MY_SHADER_CACHE_H
+#define MY_SHADER_CACHE_H
+
+#include <glad/glad.h>
+
+#include <my_hash.h>
+
+#include <filesystem> // Requires C++17
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary). Entries are keyed by
+// the preprocessed source of every stage (includes expanded, permutation defines injected) and the
+// driver's vendor, renderer and version strings, since binaries are only valid on the driver that
+// produced them. Loading can still fail after a driver update, in which case the program is compiled
+// from source and the entry rewritten.
+
+const char SHADER_CACHE_DIR[] = "shadercache";
+const char SHADER_CACHE_MAGIC[8] = { 'R', 'T', 'P', 'R', 'O', 'G', 'B', 'N' };
+const uint32_t SHADER_CACHE_VERSION = 1;
+bool shaderCacheEnabled = true;
+
+struct ShaderCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t binaryFormat;
+    uint64_t key;
+    uint64_t binarySize;
+};
+
+// Whether the context can hand out program binaries at all
+bool programBinariesSupported()
+{
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+void addGLString(FNVHasher& hasher, GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    if (value)
+        hasher.addBytes(value, std::strlen(reinterpret_cast<const char*>(value)));
+}
+
+// Key for a program built from these preprocessed stage sources on the current driver
+uint64_t computeShaderCacheKey(const std::vector<std::string>& sources)
+{
+    FNVHasher hasher;
+    hasher.add(SHADER_CACHE_VERSION);
+    addGLString(hasher, GL_VENDOR);
+    addGLString(hasher, GL_RENDERER);
+    addGLString(hasher, GL_VERSION);
+    for (const std::string& source : sources)
+        hasher.addBytes(source.data(), source.size());
+    return hasher.value();
+}
+
+std::string shaderCachePath(uint64_t key)
+{
+    std::ostringstream name;
+    name << SHADER_CACHE_DIR << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+    return name.str();
+}
+
+// Loads the entry for key into program, true only when the driver accepted it and it linked
+bool loadProgramBinary(uint64_t key, GLuint program)
+{
+    std::ifstream in(shaderCachePath(key), std::ios::binary);
+    if (!in)
+        return false;
+
+    ShaderCacheHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SHADER_CACHE_VERSION || header.key != key)
+        return false;
+
+    std::vector<char> binary(static_cast<size_t>(header.binarySize));
+    if (!in.read(binary.data(), static_cast<std::streamsize>(binary.size())))
+        return false;
+
+    glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked == GL_TRUE;
+}
+
+// Writes program's binary under key, through a temporary file so a crash never leaves a partial entry
+bool saveProgramBinary(uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<char> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return false;
+
+    std::error_code error;
+    std::filesystem::create_directories(SHADER_CACHE_DIR, error);
+    if (error)
+    {
+        std::cout << "Shader cache: could not create " << SHADER_CACHE_DIR << ": " << error.message() << "\n";
+        return false;
+    }
+
+    ShaderCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SHADER_CACHE_VERSION;
+    header.binaryFormat = format;
+    header.key = key;
+    header.binarySize = static_cast<uint64_t>(written);
+
+    std::string path = shaderCachePath(key);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cout << "Shader cache: could not write " << tempPath << "\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        if (!out)
+            return false;
+    }
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
+
+#endif // MY_SHADER_CACHE_H
@@ -0,0 +1,295 @@
+#ifndef MY_SHADER_RELOAD_H
+#define MY_SHADER_RELOAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <my_shader.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem> // Requires C++17
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// KHR_parallel_shader_compile isn't in the loader, so it's fetched by hand
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (*PFNMAXSHADERCOMPILERTHREADSKHR)(GLuint count);
+
+// Hot reload of every watched Shader while the app runs. A background thread waits for changes in the
+// shader directory (inotify on Linux, modification times elsewhere), re-preprocesses the watched
+// programs and queues the ones whose source actually changed (an edited include reloads everything
+// that includes it). The GL thread then submits the compiles in update() and only swaps a program in
+// once it has linked, checking completion with KHR_parallel_shader_compile so frames never wait on
+// the compiler. Without the extension the status query waits for the driver instead. Failed builds
+// log their errors and keep the old program.
+class ShaderHotReload
+{
+public:
+    void start(const std::string& shaderDirectory)
+    {
+        directory = shaderDirectory;
+        parallelCompile = glfwExtensionSupported("GL_KHR_parallel_shader_compile") == GLFW_TRUE;
+        if (parallelCompile)
+        {
+            auto maxThreads = reinterpret_cast<PFNMAXSHADERCOMPILERTHREADSKHR>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+            if (maxThreads)
+                maxThreads(0xFFFFFFFFu); // Let the driver choose
+        }
+        running = true;
+        worker = std::thread(&ShaderHotReload::watchLoop, this);
+        std::cout << "Shader hot reload: watching " << directory << (parallelCompile ? " (parallel compile)" : "") << "\n";
+    }
+
+    void stop()
+    {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+        for (PendingBuild& build : building)
+            discard(build);
+        building.clear();
+    }
+
+    // Reload shader whenever its source changes, it has to outlive stop()
+    void watch(Shader* shader)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watched.push_back({ shader, joinSources(shader->preprocess()) });
+    }
+
+    // Starts the builds the watcher queued and swaps in every one that has finished, once per frame on
+    // the GL thread
+    void update()
+    {
+        std::vector<ChangedSource> changes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            changes.swap(changed);
+        }
+        for (ChangedSource& change : changes)
+            building.push_back(submit(change));
+
+        for (size_t i = 0; i < building.size();)
+        {
+            if (!finished(building[i]))
+            {
+                i++;
+                continue;
+            }
+            complete(building[i]);
+            building.erase(building.begin() + i);
+        }
+    }
+
+    unsigned int reloadCount() const { return reloads; }
+    size_t pendingCount() const { return building.size(); }
+
+private:
+    struct WatchedShader
+    {
+        Shader* shader;
+        std::string source;     // Preprocessed source of the program currently in use
+    };
+
+    struct ChangedSource
+    {
+        Shader* shader;
+        std::vector<Shader::ShaderStage> stages;
+    };
+
+    struct PendingBuild
+    {
+        Shader* shader;
+        GLuint program;
+        std::vector<GLuint> shaders;
+        uint64_t cacheKey;
+        std::chrono::high_resolution_clock::time_point start;
+    };
+
+    std::string directory;
+    bool parallelCompile = false;
+    std::atomic<bool> running{ false };
+    std::thread worker;
+    std::mutex mutex;                       // Guards watched and changed
+    std::vector<WatchedShader> watched;
+    std::vector<ChangedSource> changed;
+    std::vector<PendingBuild> building;     // GL thread only
+    unsigned int reloads = 0;
+
+    static std::string joinSources(const std::vector<Shader::ShaderStage>& stages)
+    {
+        std::string joined;
+        for (const Shader::ShaderStage& stage : stages)
+            joined += stage.source;
+        return joined;
+    }
+
+    // Background thread: blocks until the directory changes, then queues every watched program whose
+    // preprocessed source differs from the one in use
+    void watchLoop()
+    {
+#ifndef _WIN32
+        int fd = inotify_init1(IN_NONBLOCK);
+        if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+        {
+            std::cout << "Shader hot reload: could not watch " << directory << "\n";
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        while (running)
+        {
+            pollfd request = { fd, POLLIN, 0 };
+            if (poll(&request, 1, 200) <= 0)
+                continue;
+            char events[4096];
+            while (read(fd, events, sizeof(events)) > 0) {}
+
+            // Editors often write a file in several steps, let them finish
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            while (read(fd, events, sizeof(events)) > 0) {}
+            queueChangedSources();
+        }
+        close(fd);
+#else
+        auto lastWrite = latestWriteTime();
+        while (running)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            auto write = latestWriteTime();
+            if (write == lastWrite)
+                continue;
+            lastWrite = write;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            queueChangedSources();
+        }
+#endif
+    }
+
+#ifdef _WIN32
+    std::filesystem::file_time_type latestWriteTime() const
+    {
+        std::filesystem::file_time_type latest{};
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+            latest = std::max(latest, entry.last_write_time(error));
+        return latest;
+    }
+#endif
+
+    void queueChangedSources()
+    {
+        std::vector<WatchedShader> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshot = watched;
+        }
+
+        // File reads happen outside the lock so watch() never waits on them
+        std::vector<ChangedSource> found;
+        for (WatchedShader& entry : snapshot)
+        {
+            std::vector<Shader::ShaderStage> stages = entry.shader->preprocess();
+            if (joinSources(stages) == entry.source)
+                continue;
+            found.push_back({ entry.shader, std::move(stages) });
+        }
+        if (found.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (ChangedSource& change : found)
+        {
+            for (WatchedShader& entry : watched)
+                if (entry.shader == change.shader)
+                    entry.source = joinSources(change.stages);
+            changed.push_back(std::move(change));
+        }
+    }
+
+    // Queues the compiles and the link without asking for any result, so nothing waits here
+    PendingBuild submit(const ChangedSource& change)
+    {
+        PendingBuild build;
+        build.shader = change.shader;
+        build.start = std::chrono::high_resolution_clock::now();
+        build.cacheKey = Shader::cacheKey(change.stages);
+        build.program = glCreateProgram();
+        for (const Shader::ShaderStage& stage : change.stages)
+        {
+            const char* code = stage.source.c_str();
+            GLuint shader = glCreateShader(stage.type);
+            glShaderSource(shader, 1, &code, NULL);
+            glCompileShader(shader);
+            glAttachShader(build.program, shader);
+            build.shaders.push_back(shader);
+        }
+        if (shaderCacheEnabled && programBinariesSupported())
+            glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(build.program);
+        return build;
+    }
+
+    bool finished(const PendingBuild& build) const
+    {
+        if (!parallelCompile)
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    void complete(PendingBuild& build)
+    {
+        GLint linked = GL_FALSE;
+        glGetProgramiv(build.program, GL_LINK_STATUS, &linked);
+        if (linked != GL_TRUE)
+        {
+            std::cout << "Shader hot reload: " << build.shader->name() << " failed, keeping the old program\n";
+            for (GLuint shader : build.shaders)
+            {
+                GLint type = 0;
+                glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+                Shader::checkCompileErrors(shader, Shader::stageName(static_cast<GLenum>(type)));
+            }
+            Shader::checkCompileErrors(build.program, "Program");
+            discard(build);
+            return;
+        }
+
+        for (GLuint shader : build.shaders)
+        {
+            glDetachShader(build.program, shader);
+            glDeleteShader(shader);
+        }
+        if (shaderCacheEnabled && programBinariesSupported())
+            saveProgramBinary(build.cacheKey, build.program);
+        build.shader->adoptProgram(build.program);
+        reloads++;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - build.start).count();
+        std::cout << "Shader hot reload: " << build.shader->name() << " swapped in after " << ms << " ms\n";
+    }
+
+    static void discard(PendingBuild& build)
+    {
+        for (GLuint shader : build.shaders)
+            glDeleteShader(shader);
+        glDeleteProgram(build.program);
+    }
+};
+ShaderHotReload shaderHotReload;
+
+#endif // MY_SHADER_RELOAD_H
@@ -0,0 +1,75 @@
+#ifndef MY_SHADER_VARIANTS_H
+#define MY_SHADER_VARIANTS_H
+
+#include <glad/glad.h>
+
+#include <my_shader.h>
+#include <my_shader_reload.h>
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <iostream>
+#include <unordered_map>
+
+// Settings baked into a raytracing.fs permutation as VARIANT_* defines (see trace_common.glsl)
+struct ShaderVariantKey
+{
+    int maxBounces = 4;
+    bool reflect = true;
+    int triangleLayout = 0;
+    int bvhKernel = 0;
+
+    std::string defines() const
+    {
+        std::ostringstream block;
+        block << "#define VARIANT_MAX_BOUNCES " << maxBounces << "\n"
+            << "#define VARIANT_REFLECT " << (reflect ? 1 : 0) << "\n"
+            << "#define VARIANT_TRIANGLE_LAYOUT " << triangleLayout << "\n"
+            << "#define VARIANT_BVH_KERNEL " << bvhKernel << "\n";
+        return block.str();
+    }
+};
+
+// Permutations of one vertex/fragment program, each compiled the first time it's asked for
+class ShaderVariantCache
+{
+public:
+    ShaderVariantCache(const std::string& vertexPath, const std::string& fragmentPath)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath) {}
+
+    Shader& get(const ShaderVariantKey& key)
+    {
+        std::string defines = key.defines();
+        auto it = variants.find(defines);
+        if (it != variants.end())
+            return *it->second;
+
+        // Shader logs the compile (or program binary cache load) time
+        std::cout << "Shader variant " << variants.size() + 1 << ": " << key.maxBounces << " bounces, reflect "
+            << (key.reflect ? "on" : "off") << ", layout " << key.triangleLayout << ", kernel " << key.bvhKernel << "\n";
+        std::unique_ptr<Shader> shader = std::make_unique<Shader>(vertexPath.c_str(), fragmentPath.c_str(), defines);
+
+        Shader& result = *shader;
+        shaderHotReload.watch(&result);
+        variants.emplace(defines, std::move(shader));
+        return result;
+    }
+
+    size_t size() const { return variants.size(); }
+
+    void clear()
+    {
+        for (auto& variant : variants)
+            glDeleteProgram(variant.second->ID);
+        variants.clear();
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::unordered_map<std::string, std::unique_ptr<Shader>> variants;  // Keyed by the define block
+};
+ShaderVariantCache raytracingVariants("shaders/raytracing.vs", "shaders/raytracing.fs");
+
+#endif // MY_SHADER_VARIANTS_H
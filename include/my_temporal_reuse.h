@@ -0,0 +1,219 @@
+#ifndef MY_TEMPORAL_REUSE_H
+#define MY_TEMPORAL_REUSE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <my_shader.h>
+#include <my_frame_uniforms.h>
+
+#include <cstdint>
+#include <iostream>
+
+// Temporal reuse for a camera that only rotates (the main loop pins its position). With the origin
+// fixed a pixel's colour only depends on its ray direction, so reproject.fs carries last frame's
+// samples over along the rotation and marks them in the stencil buffer, and the fragment pass then
+// only runs on the unmarked pixels. Each sample keeps the direction it was actually traced along and
+// is only reused while that direction still falls inside the pixel, so the error never exceeds half
+// a pixel and doesn't build up. A rotating 1 / refreshPeriod of the pixels is always traced again.
+// Anything besides the view (scene, settings, camera position, size) drops the whole history.
+const int TEMPORAL_QUERIES = 3;
+
+struct TemporalReuse
+{
+    bool enabled = false;
+    int refreshPeriod = 8;
+    float tracedFraction = 1.0f;    // Of the pixels, from the last finished occlusion query on reproject.fs
+
+    GLuint fbo = 0;
+    GLuint color[2] = {};           // RGBA16F, a = 1 where the pixel holds a sample
+    GLuint direction[2] = {};       // RGBA32F, direction a reused sample was traced along, zero if traced this frame
+    GLuint stencil = 0;             // Depth-stencil, stencil 1 marks reused pixels
+    int width = 0;
+    int height = 0;
+    int current = 0;                // History being written, the other one is last frame's
+    bool historyValid = false;
+    uint64_t stateKey = 0;
+    unsigned int frameIndex = 0;
+    glm::mat4 previousView = glm::mat4(1.0f);
+    glm::mat4 previousProjection = glm::mat4(1.0f);
+
+    GLuint queries[TEMPORAL_QUERIES] = {};
+    bool queryIssued[TEMPORAL_QUERIES] = {};
+    int nextQuery = 0;
+};
+TemporalReuse temporalReuse;
+
+void cleanupTemporalReuse()
+{
+    glDeleteFramebuffers(1, &temporalReuse.fbo);
+    glDeleteTextures(2, temporalReuse.color);
+    glDeleteTextures(2, temporalReuse.direction);
+    glDeleteRenderbuffers(1, &temporalReuse.stencil);
+    if (temporalReuse.queries[0] != 0)
+        glDeleteQueries(TEMPORAL_QUERIES, temporalReuse.queries);
+    bool enabled = temporalReuse.enabled;
+    int refreshPeriod = temporalReuse.refreshPeriod;
+    temporalReuse = TemporalReuse();
+    temporalReuse.enabled = enabled;
+    temporalReuse.refreshPeriod = refreshPeriod;
+}
+
+GLuint createTemporalTexture(GLenum format, int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+// (Re)creates both histories, nothing happens when they already have this size
+void setupTemporalReuse(int width, int height)
+{
+    if (temporalReuse.fbo != 0 && temporalReuse.width == width && temporalReuse.height == height)
+        return;
+    cleanupTemporalReuse();
+    temporalReuse.width = width;
+    temporalReuse.height = height;
+
+    for (int i = 0; i < 2; i++)
+    {
+        temporalReuse.color[i] = createTemporalTexture(GL_RGBA16F, width, height);
+        temporalReuse.direction[i] = createTemporalTexture(GL_RGBA32F, width, height);
+    }
+    glGenRenderbuffers(1, &temporalReuse.stencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, temporalReuse.stencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &temporalReuse.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, temporalReuse.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, temporalReuse.stencil);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, temporalReuse.color[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, temporalReuse.direction[0], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::TEMPORAL_REUSE:: Framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenQueries(TEMPORAL_QUERIES, temporalReuse.queries);
+}
+
+// Reads the traced fraction from finished occlusion queries (they count the reused pixels), never
+// waiting on one
+void readTemporalQueries()
+{
+    for (int i = 0; i < TEMPORAL_QUERIES; i++)
+    {
+        if (!temporalReuse.queryIssued[i])
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(temporalReuse.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available != GL_TRUE)
+            continue;
+        GLuint samples = 0;
+        glGetQueryObjectuiv(temporalReuse.queries[i], GL_QUERY_RESULT, &samples);
+        temporalReuse.tracedFraction = 1.0f - static_cast<float>(samples) / (static_cast<float>(temporalReuse.width) * temporalReuse.height);
+        temporalReuse.queryIssued[i] = false;
+    }
+}
+
+// Reprojects last frame into the current history (when it's still valid for stateKey) and leaves the
+// history bound with the stencil test passing only the pixels that have to be traced. Draw the
+// traced pass in between this and endTemporalFrame.
+void beginTemporalFrame(Shader& reprojectShader, GLuint vao, int width, int height, uint64_t stateKey,
+    const glm::mat4& projection, const glm::mat4& view)
+{
+    TemporalReuse& tr = temporalReuse;
+    setupTemporalReuse(width, height);
+    readTemporalQueries();
+    if (stateKey != tr.stateKey)
+    {
+        tr.stateKey = stateKey;
+        tr.historyValid = false;
+    }
+
+    int previous = tr.current;
+    tr.current = 1 - tr.current;
+    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glBindFramebuffer(GL_FRAMEBUFFER, tr.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tr.color[tr.current], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, tr.direction[tr.current], 0);
+    glDrawBuffers(2, drawBuffers);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClearStencil(0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    // The FrameData block still holds last frame here, both bases are passed in
+    glEnable(GL_STENCIL_TEST);
+    if (!tr.historyValid)
+        tr.tracedFraction = 1.0f;
+    else
+    {
+        FrameUniforms frame = makeFrameUniforms(view, projection);
+        FrameUniforms previousFrame = makeFrameUniforms(tr.previousView, tr.previousProjection);
+        reprojectShader.use();
+        reprojectShader.setInt("historyColor", 0);
+        reprojectShader.setInt("historyDirection", 1);
+        reprojectShader.setMat4("viewProjection", projection * view);
+        reprojectShader.setVec3("forward", glm::vec3(frame.cameraForward));
+        reprojectShader.setVec3("right", glm::vec3(frame.cameraRight));
+        reprojectShader.setVec3("up", glm::vec3(frame.cameraUp));
+        reprojectShader.setMat4("previousViewProjection", tr.previousProjection * tr.previousView);
+        reprojectShader.setVec3("previousForward", glm::vec3(previousFrame.cameraForward));
+        reprojectShader.setVec3("previousRight", glm::vec3(previousFrame.cameraRight));
+        reprojectShader.setVec3("previousUp", glm::vec3(previousFrame.cameraUp));
+        reprojectShader.setInt("frameIndex", static_cast<int>(tr.frameIndex));
+        reprojectShader.setInt("refreshPeriod", tr.refreshPeriod);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tr.color[previous]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, tr.direction[previous]);
+
+        // Every pixel reproject.fs doesn't discard was reused
+        glStencilFunc(GL_ALWAYS, 1, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+        bool timed = !tr.queryIssued[tr.nextQuery];
+        if (timed)
+            glBeginQuery(GL_SAMPLES_PASSED, tr.queries[tr.nextQuery]);
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        if (timed)
+        {
+            glEndQuery(GL_SAMPLES_PASSED);
+            tr.queryIssued[tr.nextQuery] = true;
+            tr.nextQuery = (tr.nextQuery + 1) % TEMPORAL_QUERIES;
+        }
+    }
+
+    // The traced pass only writes colour, the direction stays zero for its pixels
+    glDrawBuffers(1, drawBuffers);
+    glStencilFunc(GL_EQUAL, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+    tr.previousView = view;
+    tr.previousProjection = projection;
+}
+
+// Copies the finished history to the default framebuffer
+void endTemporalFrame()
+{
+    TemporalReuse& tr = temporalReuse;
+    glDisable(GL_STENCIL_TEST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, tr.fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, tr.width, tr.height, 0, 0, tr.width, tr.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    tr.historyValid = true;
+    tr.frameIndex++;
+}
+
+#endif // MY_TEMPORAL_REUSE_H
@@ -0,0 +1,184 @@
+#ifndef MY_WAVEFRONT_H
+#define MY_WAVEFRONT_H
+
+#include <glad/glad.h>
+
+#include <my_shader.h>
+#include <my_shader_reload.h>
+#include <my_raytracing.h>
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+// Wavefront backend: the fragment megakernel (raytracing.fs) split into compute kernels that talk
+// through queues in SSBOs. Ray generation fills a ray queue, then every bounce extends the live rays
+// (closest hit only) and shades them, with shade appending the rays that are still refracting to the
+// other queue. Each bounce is dispatched indirectly for just the rays left, so threads aren't held
+// by pixels that missed early. See the wavefront_*.comp shaders.
+#define WAVEFRONT_RAY_BINDING 8
+#define WAVEFRONT_HIT_BINDING 9
+#define WAVEFRONT_COUNTER_BINDING 10
+const int WAVEFRONT_RAY_BYTES = 48;         // WavefrontRay
+
+// WavefrontCounters in wavefront_common.glsl (std430)
+struct WavefrontCounters
+{
+    GLuint dispatchArgs[4];
+    GLuint queueCount[2];
+    GLuint liveRays[MAX_BOUNCE_LIMIT];
+};
+
+struct WavefrontTracer
+{
+    Shader* raygen = nullptr;   // Programs, created once the GL context exists
+    Shader* prepare = nullptr;
+    Shader* extend = nullptr;
+    Shader* shade = nullptr;
+
+    GLuint rayQueues = 0;   // Two queues of width * height rays
+    GLuint hitQueue = 0;
+    GLuint counters = 0;
+    GLuint output = 0;      // RGBA32F target when not accumulating
+    int width = 0;
+    int height = 0;
+    GLsizeiptr reportedPixels = 0;  // Largest allocation printed so far, dynamic resolution only shrinks below it
+};
+WavefrontTracer wavefront;
+
+void cleanupWavefrontBuffers()
+{
+    glDeleteBuffers(1, &wavefront.rayQueues);
+    glDeleteBuffers(1, &wavefront.hitQueue);
+    glDeleteBuffers(1, &wavefront.counters);
+    glDeleteTextures(1, &wavefront.output);
+    wavefront.rayQueues = wavefront.hitQueue = wavefront.counters = wavefront.output = 0;
+    wavefront.width = wavefront.height = 0;
+}
+
+void cleanupWavefront()
+{
+    cleanupWavefrontBuffers();
+    delete wavefront.raygen;
+    delete wavefront.prepare;
+    delete wavefront.extend;
+    delete wavefront.shade;
+    wavefront = WavefrontTracer();
+}
+
+void setupWavefrontPrograms()
+{
+    if (wavefront.raygen)
+        return;
+    wavefront.raygen = new Shader("shaders/wavefront_raygen.comp");
+    wavefront.prepare = new Shader("shaders/wavefront_prepare.comp");
+    wavefront.extend = new Shader("shaders/wavefront_extend.comp");
+    wavefront.shade = new Shader("shaders/wavefront_shade.comp");
+    for (Shader* kernel : { wavefront.raygen, wavefront.prepare, wavefront.extend, wavefront.shade })
+        shaderHotReload.watch(kernel);
+}
+
+GLuint createWavefrontBuffer(GLsizeiptr size)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+}
+
+// (Re)creates the queues and output, nothing happens when they already have this size
+void setupWavefront(int width, int height)
+{
+    setupWavefrontPrograms();
+    if (wavefront.rayQueues != 0 && wavefront.width == width && wavefront.height == height)
+        return;
+    cleanupWavefrontBuffers();
+    wavefront.width = width;
+    wavefront.height = height;
+
+    GLsizeiptr pixels = static_cast<GLsizeiptr>(width) * height;
+    wavefront.rayQueues = createWavefrontBuffer(2 * pixels * WAVEFRONT_RAY_BYTES);
+    wavefront.hitQueue = createWavefrontBuffer(pixels * 4 * sizeof(float));
+    wavefront.counters = createWavefrontBuffer(sizeof(WavefrontCounters));
+
+    glGenTextures(1, &wavefront.output);
+    glBindTexture(GL_TEXTURE_2D, wavefront.output);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (pixels > wavefront.reportedPixels)
+    {
+        wavefront.reportedPixels = pixels;
+        std::cout << "Wavefront queues: " << (2 * pixels * WAVEFRONT_RAY_BYTES + pixels * 16) / (1024 * 1024) << " MB\n";
+    }
+}
+
+// Runs the kernels for one frame into target (RGBA32F, the size passed to setupWavefront). The scene
+// SSBOs, skybox, G-buffer and the tracing uniforms of raygen, extend and shade are expected to be set
+// (see drawModelCompute in main.cpp). firstBounce is 1 when raygen starts from the G-buffer. With
+// accumulate the frame is added to target (alpha counts samples) instead of replacing it.
+void traceWavefront(GLuint target, bool accumulate, int firstBounce, int maxBounces)
+{
+    const GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, wavefront.counters);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAY_BINDING, wavefront.rayQueues);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_HIT_BINDING, wavefront.hitQueue);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_COUNTER_BINDING, wavefront.counters);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, wavefront.counters);
+    glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+    int capacity = wavefront.width * wavefront.height;
+    auto useKernel = [&](Shader& kernel, int bounce)
+    {
+        kernel.use();
+        kernel.setInt("bounce", bounce);
+        kernel.setInt("queueCapacity", capacity);
+        kernel.setInt("firstBounce", firstBounce);
+        kernel.setBool("accumulateOutput", accumulate);
+    };
+
+    // Primary rays (every pixel, or only the ones the G-buffer covered)
+    useKernel(*wavefront.raygen, firstBounce);
+    glDispatchCompute((wavefront.width + 7) / 8, (wavefront.height + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    int bounceCount = std::min(maxBounces, MAX_BOUNCE_LIMIT);
+    for (int bounce = firstBounce; bounce < bounceCount; bounce++)
+    {
+        // Group count for this bounce's queue, written on the GPU so nothing is read back
+        useKernel(*wavefront.prepare, bounce);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        useKernel(*wavefront.extend, bounce);
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        useKernel(*wavefront.shade, bounce);
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// Rays extended per bounce in the last traceWavefront (waits for the GPU)
+std::vector<GLuint> readWavefrontLiveRays()
+{
+    WavefrontCounters counters = {};
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, wavefront.counters);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(WavefrontCounters), &counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return std::vector<GLuint>(counters.liveRays, counters.liveRays + MAX_BOUNCE_LIMIT);
+}
+
+#endif // MY_WAVEFRONT_H
@@ -0,0 +1,321 @@
+#ifndef MY_WIDE_BVH_H
+#define MY_WIDE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <my_bvh.h>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+
+// Compressed wide BVH (in the spirit of Ylitie et al. 2017): binary nodes are collapsed into 4- or
+// 8-wide nodes whose child boxes are quantized to 8 bits per plane relative to the parent box.
+//
+// Each node is (2 + width / 2) uvec4s, matches traceWideBVH() in raytracing.fs:
+//   [0].xyz  parent box origin (float bits)
+//   [0].w    exponent x | exponent y << 8 | exponent z << 16 | child count << 24 (exponents biased by 127)
+//   [1].x    index of the first internal child (internal children are contiguous)
+//   [1].y    index of the first triangle (leaf children's triangles are contiguous)
+//   then one uvec2 per child:
+//   .x       qlo.x | qlo.y << 8 | qlo.z << 16 | qhi.x << 24
+//   .y       qhi.y | qhi.z << 8 | meta << 16
+// meta: leaf = 0x8000 | triCount << 11 | triangle offset, internal = child node offset
+
+const unsigned int WIDE_LEAF_FLAG = 0x8000u;
+const unsigned int WIDE_MAX_LEAF_TRIS = 15u;
+
+struct WideBVH
+{
+    int width = 0;
+    unsigned int nodeCount = 0;
+    std::vector<glm::uvec4> data;
+    std::vector<unsigned int> slotOrder; // New triangle slot -> slot in the binary BVH's triangle order
+
+    unsigned int nodeStride() const
+    {
+        return 2u + static_cast<unsigned int>(width) / 2u;
+    }
+};
+
+// Decoded child, shared by the collapse and the CPU traversal
+struct WideChild
+{
+    glm::vec3 bmin, bmax;
+    bool leaf;
+    unsigned int index;     // Child node index, or first triangle for leaves
+    unsigned int triCount;
+};
+
+// Reads child c of a wide node
+WideChild decodeWideChild(const WideBVH& wide, unsigned int nodeIdx, unsigned int c)
+{
+    const glm::uvec4* node = &wide.data[nodeIdx * wide.nodeStride()];
+    glm::vec3 origin;
+    std::memcpy(&origin.x, &node[0].x, sizeof(float));
+    std::memcpy(&origin.y, &node[0].y, sizeof(float));
+    std::memcpy(&origin.z, &node[0].z, sizeof(float));
+    glm::vec3 scale(
+        std::ldexp(1.0f, static_cast<int>(node[0].w & 0xFFu) - 127),
+        std::ldexp(1.0f, static_cast<int>((node[0].w >> 8) & 0xFFu) - 127),
+        std::ldexp(1.0f, static_cast<int>((node[0].w >> 16) & 0xFFu) - 127));
+
+    const glm::uvec4& pair = node[2 + c / 2];
+    unsigned int lo = (c & 1u) == 0 ? pair.x : pair.z;
+    unsigned int hi = (c & 1u) == 0 ? pair.y : pair.w;
+    glm::vec3 qlo(static_cast<float>(lo & 0xFFu), static_cast<float>((lo >> 8) & 0xFFu), static_cast<float>((lo >> 16) & 0xFFu));
+    glm::vec3 qhi(static_cast<float>(lo >> 24), static_cast<float>(hi & 0xFFu), static_cast<float>((hi >> 8) & 0xFFu));
+    unsigned int meta = hi >> 16;
+
+    WideChild child;
+    child.bmin = origin + qlo * scale;
+    child.bmax = origin + qhi * scale;
+    child.leaf = (meta & WIDE_LEAF_FLAG) != 0;
+    child.index = child.leaf ? node[1].y + (meta & 0x7FFu) : node[1].x + (meta & 0x7u);
+    child.triCount = child.leaf ? (meta >> 11) & 0xFu : 0u;
+    return child;
+}
+
+class WideBVHCollapser
+{
+public:
+    // slotBounds[i] bounds triangle slot i of the binary BVH's reordered triangle array
+    WideBVHCollapser(const BVH& bvh, const std::vector<AABB>& slotBounds, int width)
+        : bvh(bvh), slotBounds(slotBounds), width(width)
+    {
+    }
+
+    WideBVH collapse()
+    {
+        WideBVH wide;
+        wide.width = width;
+        if (bvh.nodes.empty())
+            return wide;
+
+        // Breadth-first so each node's internal children can be allocated contiguously
+        std::vector<Item> pending = { rootItem() };
+        std::vector<unsigned int> pendingNodes = { 0 };
+        wide.nodeCount = 1;
+        for (size_t q = 0; q < pending.size(); q++)
+        {
+            std::vector<Item> children = open(pending[q]);
+
+            // Greedily open the largest openable child until the node is full
+            while (static_cast<int>(children.size()) < width)
+            {
+                int best = -1;
+                float bestArea = -1.0f;
+                for (size_t c = 0; c < children.size(); c++)
+                {
+                    if (openable(children[c]) && children[c].box.area() > bestArea)
+                    {
+                        best = static_cast<int>(c);
+                        bestArea = children[c].box.area();
+                    }
+                }
+                if (best < 0)
+                    break;
+                std::vector<Item> opened = open(children[best]);
+                children[best] = opened[0];
+                children.insert(children.begin() + best + 1, opened.begin() + 1, opened.end());
+            }
+
+            unsigned int childBase = wide.nodeCount;
+            unsigned int triBase = static_cast<unsigned int>(wide.slotOrder.size());
+            unsigned int internalCount = 0;
+            std::vector<unsigned int> meta(children.size());
+            for (size_t c = 0; c < children.size(); c++)
+            {
+                if (openable(children[c]))
+                {
+                    meta[c] = internalCount++;
+                    pending.push_back(children[c]);
+                    pendingNodes.push_back(childBase + meta[c]);
+                }
+                else
+                {
+                    unsigned int offset = static_cast<unsigned int>(wide.slotOrder.size()) - triBase;
+                    meta[c] = WIDE_LEAF_FLAG | (children[c].count << 11) | offset;
+                    for (unsigned int i = 0; i < children[c].count; i++)
+                        wide.slotOrder.push_back(children[c].first + i);
+                }
+            }
+            wide.nodeCount += internalCount;
+            encodeNode(wide, pendingNodes[q], pending[q].box, children, meta, childBase, triBase);
+        }
+        return wide;
+    }
+
+private:
+    // Either a binary interior node or a contiguous range of triangle slots
+    struct Item
+    {
+        AABB box;
+        bool isRange;
+        unsigned int node;          // Binary node index when !isRange
+        unsigned int first, count;  // Triangle slots when isRange
+    };
+
+    const BVH& bvh;
+    const std::vector<AABB>& slotBounds;
+    int width;
+
+    Item itemForNode(unsigned int nodeIdx) const
+    {
+        const GPUBVHNode& node = bvh.nodes[nodeIdx];
+        Item item;
+        item.box.bmin = node.aabbMin;
+        item.box.bmax = node.aabbMax;
+        item.isRange = node.isLeaf();
+        item.node = nodeIdx;
+        item.first = node.isLeaf() ? node.leftFirst : 0;
+        item.count = node.isLeaf() ? node.triCount : 0;
+        return item;
+    }
+
+    Item itemForRange(unsigned int first, unsigned int count) const
+    {
+        Item item;
+        item.isRange = true;
+        item.node = 0;
+        item.first = first;
+        item.count = count;
+        for (unsigned int i = 0; i < count; i++)
+            item.box.grow(slotBounds[first + i]);
+        return item;
+    }
+
+    Item rootItem() const
+    {
+        return itemForNode(0);
+    }
+
+    // Binary interior nodes can be opened, as can leaves too big for the 4-bit count
+    bool openable(const Item& item) const
+    {
+        return !item.isRange || item.count > WIDE_MAX_LEAF_TRIS;
+    }
+
+    std::vector<Item> open(const Item& item) const
+    {
+        if (!item.isRange)
+        {
+            const GPUBVHNode& node = bvh.nodes[item.node];
+            return { itemForNode(node.leftFirst), itemForNode(node.leftFirst + 1) };
+        }
+        if (item.count <= WIDE_MAX_LEAF_TRIS)
+            return { item };
+        unsigned int half = item.count / 2;
+        return { itemForRange(item.first, half), itemForRange(item.first + half, item.count - half) };
+    }
+
+    void encodeNode(WideBVH& wide, unsigned int nodeIdx, const AABB& box, const std::vector<Item>& children,
+        const std::vector<unsigned int>& meta, unsigned int childBase, unsigned int triBase)
+    {
+        size_t stride = wide.nodeStride();
+        if (wide.data.size() < (nodeIdx + 1) * stride)
+            wide.data.resize((nodeIdx + 1) * stride, glm::uvec4(0u));
+        glm::uvec4* node = &wide.data[nodeIdx * stride];
+
+        // Smallest power-of-two scale per axis that spans the parent box in 255 steps
+        glm::vec3 origin = box.bmin;
+        int exponents[3];
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = box.bmax[axis] - box.bmin[axis];
+            int e = -126;
+            if (extent > 0.0f)
+            {
+                int exp2;
+                std::frexp(extent / 255.0f, &exp2);
+                e = std::max(-126, std::min(127, exp2));
+            }
+            exponents[axis] = e;
+            scale[axis] = std::ldexp(1.0f, e);
+        }
+
+        node[0] = glm::uvec4(floatBits(origin.x), floatBits(origin.y), floatBits(origin.z),
+            static_cast<unsigned int>(exponents[0] + 127)
+            | static_cast<unsigned int>(exponents[1] + 127) << 8
+            | static_cast<unsigned int>(exponents[2] + 127) << 16
+            | static_cast<unsigned int>(children.size()) << 24);
+        node[1] = glm::uvec4(childBase, triBase, 0u, 0u);
+
+        for (size_t c = 0; c < children.size(); c++)
+        {
+            unsigned int qlo[3], qhi[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                // Round outwards, then nudge until the decoded float box really contains the child
+                int lo = static_cast<int>(std::floor((children[c].box.bmin[axis] - origin[axis]) / scale[axis]));
+                int hi = static_cast<int>(std::ceil((children[c].box.bmax[axis] - origin[axis]) / scale[axis]));
+                lo = std::max(0, std::min(255, lo));
+                hi = std::max(0, std::min(255, hi));
+                while (lo > 0 && origin[axis] + static_cast<float>(lo) * scale[axis] > children[c].box.bmin[axis])
+                    lo--;
+                while (hi < 255 && origin[axis] + static_cast<float>(hi) * scale[axis] < children[c].box.bmax[axis])
+                    hi++;
+                qlo[axis] = static_cast<unsigned int>(lo);
+                qhi[axis] = static_cast<unsigned int>(hi);
+            }
+
+            unsigned int lo = qlo[0] | qlo[1] << 8 | qlo[2] << 16 | qhi[0] << 24;
+            unsigned int hi = qhi[1] | qhi[2] << 8 | meta[c] << 16;
+            glm::uvec4& pair = node[2 + c / 2];
+            if ((c & 1) == 0)
+            {
+                pair.x = lo;
+                pair.y = hi;
+            }
+            else
+            {
+                pair.z = lo;
+                pair.w = hi;
+            }
+        }
+    }
+
+    static unsigned int floatBits(float f)
+    {
+        unsigned int bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+};
+
+WideBVH collapseBVH(const BVH& bvh, const std::vector<AABB>& slotBounds, int width)
+{
+    WideBVHCollapser collapser(bvh, slotBounds, width);
+    return collapser.collapse();
+}
+
+// Worst-case stack entries for the far-to-near traversal: every internal level pops one node and
+// pushes at most width internal children, so the stack grows by width - 1 per level below the root
+unsigned int wideBVHStackSize(const WideBVH& wide)
+{
+    if (wide.nodeCount == 0)
+        return 0;
+
+    unsigned int levels = 0;
+    std::vector<std::pair<unsigned int, unsigned int>> pending = { { 0u, 1u } }; // Node, internal level
+    while (!pending.empty())
+    {
+        auto [nodeIdx, level] = pending.back();
+        pending.pop_back();
+        levels = std::max(levels, level);
+        unsigned int childCount = wide.data[nodeIdx * wide.nodeStride()].w >> 24;
+        for (unsigned int c = 0; c < childCount; c++)
+        {
+            WideChild child = decodeWideChild(wide, nodeIdx, c);
+            if (!child.leaf)
+                pending.push_back({ child.index, level + 1 });
+        }
+    }
+    return (levels - 1) * static_cast<unsigned int>(wide.width - 1) + 1;
+}
+
+#endif // MY_WIDE_BVH_H
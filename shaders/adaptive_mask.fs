@@ -0,0 +1,24 @@
+#version 430 core
+
+// Accumulated so far (see my_accumulation.h)
+uniform sampler2D accumulation;     // Sum of samples in rgb, sample count in a
+uniform sampler2D moments;          // Sum of squared luminance in r
+uniform float errorThreshold;
+
+// Marks the pixels whose estimated error is already below the threshold in the stencil buffer, the
+// next adaptive sample is only traced for the others (colour writes are off)
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 sum = texelFetch(accumulation, pixel, 0);
+    float n = sum.a;
+    if (n < 2.0)
+        discard;
+
+    // Standard error of the mean luminance relative to it, floored so dark pixels don't dominate
+    float mean = dot(sum.rgb, vec3(0.2126, 0.7152, 0.0722)) / n;
+    float variance = max(texelFetch(moments, pixel, 0).r / n - mean * mean, 0.0) * n / (n - 1.0);
+    float error = sqrt(variance / n) / (mean + 0.05);
+    if (error > errorThreshold)
+        discard;
+}
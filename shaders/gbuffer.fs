@@ -0,0 +1,13 @@
+#version 430 core
+
+in vec3 WorldPos;
+in vec3 Normal;
+
+layout(location = 0) out vec4 gPosition;  // xyz = first hit, w = coverage
+layout(location = 1) out vec4 gNormal;
+
+void main()
+{
+    gPosition = vec4(WorldPos, 1.0);
+    gNormal = vec4(normalize(Normal), 0.0);
+}
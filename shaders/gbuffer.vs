@@ -0,0 +1,16 @@
+#version 430 core
+layout(location = 0) in vec3 aPos;      // Mesh layout (see Mesh::setupMesh)
+layout(location = 1) in vec3 aNormal;
+
+out vec3 WorldPos;
+out vec3 Normal;
+
+#include "frame_data.glsl"
+
+void main()
+{
+    // The raytracer uses model space as world space, so there's no model matrix
+    WorldPos = aPos;
+    Normal = aNormal;
+    gl_Position = projection * view * vec4(aPos, 1.0);
+}
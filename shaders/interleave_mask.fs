@@ -0,0 +1,10 @@
+#version 430 core
+
+#include "interleave_pattern.glsl"
+
+// Marks the pixels skipped this frame in the stencil buffer, colour writes are off
+void main()
+{
+    if (tracedThisFrame(ivec2(gl_FragCoord.xy)))
+        discard;
+}
@@ -0,0 +1,14 @@
+// Pixels traced this frame in interleaved mode (see my_interleaved.h): pattern 1 is a checkerboard
+// alternating every frame, pattern 2 one pixel of every 2x2 quad, visiting all four over four frames
+
+uniform int interleavePattern;
+uniform int frameIndex;
+
+const int quadOrder[4] = int[4](0, 3, 1, 2);    // Diagonal first, so two frames already cover both axes
+
+bool tracedThisFrame(ivec2 pixel)
+{
+    if (interleavePattern == 1)
+        return ((pixel.x + pixel.y + frameIndex) & 1) == 0;
+    return (pixel.x & 1) + 2 * (pixel.y & 1) == quadOrder[frameIndex & 3];
+}
@@ -0,0 +1,64 @@
+#version 430 core
+
+out vec4 FragColor;
+in vec2 TexCoords;
+
+#include "frame_data.glsl"
+#include "interleave_pattern.glsl"
+
+uniform sampler2D traced;               // This frame, only the pattern's pixels were written
+uniform sampler2D history;              // Last frame's resolved image (bilinear)
+uniform bool historyValid;
+uniform mat4 previousViewProjection;
+
+// Traced pixels are kept as they are. The others take last frame's image where the camera's rotation
+// carries it (the position is pinned), clamped to the range of their traced neighbours so
+// disocclusions and lighting changes don't smear, or the neighbours' mean without a history.
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(traced, 0);
+    if (tracedThisFrame(pixel))
+    {
+        FragColor = vec4(texelFetch(traced, pixel, 0).rgb, 1.0);
+        return;
+    }
+
+    // Every 3x3 window holds at least one traced pixel for both patterns
+    vec3 lo = vec3(1e30);
+    vec3 hi = vec3(-1e30);
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int dy = -1; dy <= 1; dy++)
+    {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+            ivec2 neighbour = pixel + ivec2(dx, dy);
+            if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, size)) || !tracedThisFrame(neighbour))
+                continue;
+            vec3 color = texelFetch(traced, neighbour, 0).rgb;
+            float w = (dx == 0 || dy == 0) ? 1.0 : 0.5;
+            sum += w * color;
+            weightSum += w;
+            lo = min(lo, color);
+            hi = max(hi, color);
+        }
+    }
+    if (weightSum == 0.0)
+    {
+        FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    vec3 spatial = sum / weightSum;
+
+    vec2 ndc = TexCoords * 2.0 - 1.0;
+    vec3 dir = cameraForward.xyz + ndc.x * cameraRight.xyz + ndc.y * cameraUp.xyz;
+    vec4 previousClip = previousViewProjection * vec4(dir, 0.0);
+    vec2 uv = previousClip.xy / previousClip.w * 0.5 + 0.5;
+    if (!historyValid || previousClip.w <= 0.0 || any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+    {
+        FragColor = vec4(spatial, 1.0);
+        return;
+    }
+    FragColor = vec4(clamp(texture(history, uv).rgb, lo, hi), 1.0);
+}
@@ -0,0 +1,13 @@
+// Image the compute tracers write to. Sum of samples (rgb) and sample count (a) when accumulating,
+// otherwise just the last frame, shown with present.fs either way.
+
+layout(rgba32f, binding = 0) uniform image2D outputImage;
+uniform bool accumulateOutput;
+
+void writeOutput(ivec2 coord, vec3 color)
+{
+    vec4 value = vec4(color, 1.0);
+    if (accumulateOutput)
+        value += imageLoad(outputImage, coord);
+    imageStore(outputImage, coord, value);
+}
@@ -0,0 +1,13 @@
+#version 430 core
+
+out vec4 FragColor;
+in vec2 TexCoords;
+
+// Sum of every sample so far in rgb, sample count in a (see my_accumulation.h)
+uniform sampler2D accumulation;
+
+void main()
+{
+    vec4 sum = texelFetch(accumulation, ivec2(gl_FragCoord.xy), 0);
+    FragColor = vec4(sum.a > 0.0 ? sum.rgb / sum.a : vec3(0.0), 1.0);
+}
@@ -0,0 +1,35 @@
+// Primary rays shared by raytracing.fs and the compute tracers, include after frame_data.glsl and
+// trace_common.glsl
+
+uniform bool hybridPrimary;    // Bounce 0 comes from the rasterized G-buffer instead of a traced ray
+uniform sampler2D gPosition;   // xyz = first hit, w = coverage (see my_gbuffer.h)
+uniform sampler2D gNormal;
+
+// Ray through ndc (the centre of pixel) with the camera basis precomputed on the CPU. In hybrid mode the
+// first hit was rasterized and the ray already left it (firstBounce 1); pixels the model doesn't cover
+// return false and only see the skybox along dir (or with the heatmap, the colour of no searches).
+bool primaryRay(ivec2 pixel, vec2 ndc, out vec3 origin, out vec3 dir, out float currentIOR, out vec3 N,
+    out int firstBounce, out float throughput)
+{
+    origin = cameraPosition.xyz;
+    dir = normalize(cameraForward.xyz + ndc.x * cameraRight.xyz + ndc.y * cameraUp.xyz);
+    currentIOR = airIOR;
+    N = vec3(0.0);
+    firstBounce = 0;
+    throughput = 1.0;
+    if (!hybridPrimary)
+        return true;
+
+    vec4 primaryHit = texelFetch(gPosition, pixel, 0);
+    if (primaryHit.w == 0.0)
+        return false;
+    throughput = scatterAtHit(primaryHit.xyz, texelFetch(gNormal, pixel, 0).xyz, origin, dir, currentIOR, N);
+    firstBounce = 1;
+    return true;
+}
+
+// Colour of a pixel primaryRay() returned false for
+vec3 uncoveredColor(vec3 dir)
+{
+    return showBounceHeatmap ? bounceHeatmap(0) : texture(skybox, dir).rgb;
+}
@@ -0,0 +1,66 @@
+#version 430 core
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 SampleDirection;
+in vec2 TexCoords;
+
+// This frame's camera, the FrameData block isn't updated until the traced pass
+uniform mat4 viewProjection;
+uniform vec3 forward;                   // Ray basis, as in FrameData
+uniform vec3 right;
+uniform vec3 up;
+
+// Last frame (see my_temporal_reuse.h). Pixels traced last frame have a zero direction, their sample
+// lies on the pixel centre of the previous camera basis.
+uniform sampler2D historyColor;         // a = 1 where the pixel holds a sample
+uniform sampler2D historyDirection;
+uniform mat4 previousViewProjection;
+uniform vec3 previousForward;
+uniform vec3 previousRight;
+uniform vec3 previousUp;
+uniform int frameIndex;
+uniform int refreshPeriod;              // Every pixel is traced again at least this often
+
+// 4x4 Bayer matrix, so each frame's refreshed pixels are spread evenly over the screen
+const int refreshOrder[16] = int[16](0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5);
+
+// Pixel position (in pixels, centres at +0.5) a direction projects to, w <= 0 behind the camera
+vec3 projectDirection(mat4 viewProjection, vec3 dir, vec2 size)
+{
+    vec4 clip = viewProjection * vec4(dir, 0.0);
+    return vec3((clip.xy / clip.w * 0.5 + 0.5) * size, clip.w);
+}
+
+// Discarded pixels are left for the traced pass, the rest are marked in the stencil buffer
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec2 size = vec2(textureSize(historyColor, 0));
+    if (refreshOrder[(pixel.y & 3) * 4 + (pixel.x & 3)] % refreshPeriod == frameIndex % refreshPeriod)
+        discard;
+
+    // The camera only rotated, so the pixel's direction finds its colour in the last frame
+    vec2 ndc = TexCoords * 2.0 - 1.0;
+    vec3 dir = forward + ndc.x * right + ndc.y * up;
+    vec3 previousPixel = projectDirection(previousViewProjection, dir, size);
+    ivec2 source = ivec2(floor(previousPixel.xy));
+    if (previousPixel.z <= 0.0 || any(lessThan(source, ivec2(0))) || any(greaterThanEqual(source, ivec2(size))))
+        discard;
+    vec4 color = texelFetch(historyColor, source, 0);
+    if (color.a == 0.0)
+        discard;
+
+    // Where that sample was actually traced, it's only reused while that still lies inside this pixel
+    vec3 sampleDir = texelFetch(historyDirection, source, 0).xyz;
+    if (sampleDir == vec3(0.0))
+    {
+        vec2 sourceNdc = (vec2(source) + 0.5) / size * 2.0 - 1.0;
+        sampleDir = previousForward + sourceNdc.x * previousRight + sourceNdc.y * previousUp;
+    }
+    vec3 samplePixel = projectDirection(viewProjection, sampleDir, size);
+    if (samplePixel.z <= 0.0 || any(greaterThan(abs(samplePixel.xy - (vec2(pixel) + 0.5)), vec2(0.5))))
+        discard;
+
+    FragColor = vec4(color.rgb, 1.0);
+    SampleDirection = vec4(sampleDir, 0.0);
+}
@@ -0,0 +1,799 @@
+// Scene buffers, intersection and traversal shared by raytracing.fs and the wavefront kernels
+// (wavefront_*.comp). Included after #version, see Shader::loadShaderSource().
+
+// A program compiled with VARIANT_* defines (see my_shader_variants.h) gets these settings as
+// constants, so the branches on them fold away. Without them they stay uniforms.
+#ifdef VARIANT_REFLECT
+const bool reflectEnable = VARIANT_REFLECT != 0;
+#else
+uniform bool reflectEnable;
+#endif
+#ifdef VARIANT_BVH_KERNEL
+const int bvhKernel = VARIANT_BVH_KERNEL;
+#else
+uniform int bvhKernel;     // Binary traversal: 0 = full stack, 1 = short stack with parent fallback, 2 = stackless
+#endif
+#ifdef VARIANT_TRIANGLE_LAYOUT
+const int triangleLayout = VARIANT_TRIANGLE_LAYOUT;
+#else
+uniform int triangleLayout;    // 0 = full triangles, 1 = indexed through triIndices/vertices, 2 = precomputed unit triangles
+#endif
+#ifdef VARIANT_MAX_BOUNCES
+const int maxBounces = VARIANT_MAX_BOUNCES;
+#else
+uniform int maxBounces;        // Bounce budget, at most MAX_BOUNCE_LIMIT
+#endif
+
+uniform samplerCube skybox;
+uniform float modelIOR;    
+uniform bool useBVH;
+uniform int bvhWidth;      // 2 = binary nodes, 4 or 8 = compressed wide nodes
+uniform bool useInstances; // Trace the instance grid through the TLAS
+uniform float minThroughput;   // Paths whose transmitted energy drops below this stop bouncing (0 = off)
+uniform vec3 sceneBoundsMin;   // Root bounds of whatever is traced (BLAS or TLAS)
+uniform vec3 sceneBoundsMax;
+uniform bool showBounceHeatmap;    // Colour pixels by intersection searches instead of shading them
+
+const float airIOR = 1.0;
+const int MAX_BOUNCE_LIMIT = 8;    // Matches MAX_BOUNCE_LIMIT in my_raytracing.h
+
+// SSBO binding
+layout(std430, binding = 0) buffer Triangles 
+{
+    // Full layout: each 6 consecutive entries = 1 triangle (v0, v1, v2), each in homogeneous coords (x, y, z, w) with normals (n0, n1, n2)
+    // Precomputed layout: each 4 consecutive entries = 1 triangle (see GPUUnitTriangle in my_raytracing.h),
+    // three rows of the world-to-unit-triangle transform then the packed normals as uint bits
+    vec4 triangles[]; 
+};
+
+// Indexed layout (see GPUVertex in my_raytracing.h): shared vertices with octahedral normals, and three
+// vertex indices per triangle slot in the same order as triangles[]
+struct PackedVertex
+{
+    vec3 position;
+    uint normal;
+};
+
+layout(std430, binding = 6) buffer Vertices
+{
+    PackedVertex vertices[];
+};
+
+layout(std430, binding = 7) buffer TriangleIndices
+{
+    uint triIndices[];
+};
+
+// BVH nodes, triCount == 0 marks an interior node whose children are leftFirst and leftFirst + 1
+struct BVHNode
+{
+    vec3 aabbMin;
+    uint leftFirst;
+    vec3 aabbMax;
+    uint triCount;
+};
+
+layout(std430, binding = 1) buffer BVHNodes
+{
+    BVHNode bvhNodes[];
+};
+
+// Per-node parent << 3 | swap << 2 | axis (see computeBVHLinks() in my_bvh.h). Sibling pairs always
+// start at an odd index, so a node's sibling is found from its own index.
+layout(std430, binding = 5) buffer BVHLinks
+{
+    uint bvhLinks[];
+};
+
+// Compressed wide nodes (see my_wide_bvh.h), (2 + bvhWidth / 2) entries per node:
+// [0] = parent origin bits + biased exponents and child count, [1] = first internal child / first triangle,
+// then two 8-bit quantized children per entry
+layout(std430, binding = 2) buffer WideBVHNodes
+{
+    uvec4 wideNodes[];
+};
+
+// Top-level BVH over instances, leaves index instances[]
+layout(std430, binding = 3) buffer TLASNodes
+{
+    BVHNode tlasNodes[];
+};
+
+// Rows of the 3x4 world-to-object transform, plus where the instance's BLAS lives in the node and
+// triangle buffers
+struct Instance
+{
+    vec4 worldToObject[3];
+    uint blasRoot;
+    uint blasTriOffset;
+    uint pad0;
+    uint pad1;
+};
+
+layout(std430, binding = 4) buffer Instances
+{
+    Instance instances[];
+};
+
+const int BVH_STACK_SIZE = 64;
+const int SHORT_STACK_SIZE = 4;
+const int TLAS_STACK_SIZE = 32;
+const uint WIDE_LEAF_FLAG = 0x8000u;
+
+// Fresnel-Schlick approximation
+float fresnelSchlick(float cosTheta, float F0)
+{
+    return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+// Möller–Trumbore ray-triangle intersection
+bool intersectTriangle(vec3 orig, vec3 dir,
+    vec3 v0, vec3 v1, vec3 v2,
+    out float t, out float u, out float v)
+{
+    const float EPSILON = 1e-5;
+    vec3 edge1 = v1 - v0;
+    vec3 edge2 = v2 - v0;
+    vec3 h = cross(dir, edge2);
+    float a = dot(edge1, h);
+    if (abs(a) < EPSILON) 
+        return false;
+
+    float f = 1.0 / a;
+    vec3 s = orig - v0;
+    u = f * dot(s, h);
+    if (u < 0.0 || u > 1.0) 
+        return false;
+
+    vec3 q = cross(s, edge1);
+    v = f * dot(dir, q);
+    if (v < 0.0 || (u + v) > 1.0) 
+        return false;
+
+    t = f * dot(edge2, q);
+    return t > EPSILON;
+}
+
+// Unit triangle test (Woop et al. 2004): r0, r1, r2 map world space to the space where the triangle is
+// (0,0,0), (1,0,0), (0,1,0), so the hit distance comes from z alone and u, v are the hit's x and y.
+// Rejects hits at or beyond tMax before computing the barycentrics.
+bool intersectUnitTriangle(vec3 orig, vec3 dir, vec4 r0, vec4 r1, vec4 r2, float tMax,
+    out float t, out float u, out float v)
+{
+    const float EPSILON = 1e-5;
+    float dz = dot(r2.xyz, dir);
+    if (dz == 0.0)
+        return false;
+
+    t = -(dot(r2.xyz, orig) + r2.w) / dz;
+    if (t <= EPSILON || t >= tMax)
+        return false;
+
+    u = dot(r0.xyz, orig) + r0.w + t * dot(r0.xyz, dir);
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    v = dot(r1.xyz, orig) + r1.w + t * dot(r1.xyz, dir);
+    return v >= 0.0 && (u + v) <= 1.0;
+}
+
+// Slab test, returns entry distance or 1e30 on a miss (or when further than tMax)
+float intersectAABB(vec3 orig, vec3 invDir, vec3 bmin, vec3 bmax, float tMax)
+{
+    vec3 t0 = (bmin - orig) * invDir;
+    vec3 t1 = (bmax - orig) * invDir;
+    vec3 tSmall = min(t0, t1);
+    vec3 tBig = max(t0, t1);
+    float tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, 0.0));
+    float tFar = min(min(tBig.x, tBig.y), tBig.z);
+    return (tNear <= tFar && tNear < tMax) ? tNear : 1e30;
+}
+
+// Inverse of packOctNormal() in my_raytracing.h
+vec3 decodeOctNormal(uint bits)
+{
+    vec2 e = unpackSnorm2x16(bits);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// Tests triangle tri and updates the closest hit
+void testTriangle(uint tri, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    if (triangleLayout == 2)
+    {
+        uint j = tri * 4;
+        float t, u, v;
+        if (intersectUnitTriangle(orig, dir, triangles[j], triangles[j + 1], triangles[j + 2], minT, t, u, v))
+        {
+            minT = t;
+            hit = true;
+            uvec3 packedNormals = floatBitsToUint(triangles[j + 3].xyz);
+            float w = 1.0 - u - v;
+            hitNormal = normalize(w * decodeOctNormal(packedNormals.x) + u * decodeOctNormal(packedNormals.y)
+                + v * decodeOctNormal(packedNormals.z));
+        }
+        return;
+    }
+
+    uint i = tri * 6;
+    uvec3 idx = uvec3(0u);
+
+    // Only positions are read until the triangle is actually hit
+    vec3 v0, v1, v2;
+    if (triangleLayout == 1)
+    {
+        idx = uvec3(triIndices[tri * 3], triIndices[tri * 3 + 1], triIndices[tri * 3 + 2]);
+        v0 = vertices[idx.x].position;
+        v1 = vertices[idx.y].position;
+        v2 = vertices[idx.z].position;
+    }
+    else
+    {
+        // Triangle vertices (first 3 elements)
+        v0 = triangles[i].xyz;
+        v1 = triangles[i + 1].xyz;
+        v2 = triangles[i + 2].xyz;
+    }
+
+    float t, u, v;
+    if (intersectTriangle(orig, dir, v0, v1, v2, t, u, v) && t < minT)
+    {
+        minT = t;
+        hit = true;
+
+        vec3 n0, n1, n2;
+        if (triangleLayout == 1)
+        {
+            n0 = decodeOctNormal(vertices[idx.x].normal);
+            n1 = decodeOctNormal(vertices[idx.y].normal);
+            n2 = decodeOctNormal(vertices[idx.z].normal);
+        }
+        else
+        {
+            // Triangle normals (last 3 elements)
+            n0 = triangles[i + 3].xyz;
+            n1 = triangles[i + 4].xyz;
+            n2 = triangles[i + 5].xyz;
+        }
+
+        float w = 1.0 - u - v;
+        hitNormal = normalize(w * n0 + u * n1 + v * n2);
+    }
+}
+
+// Brute force closest hit, kept as a reference path for comparison
+bool traceLinear(vec3 orig, vec3 dir, out float minT, out vec3 hitNormal)
+{
+    minT = 1e20;
+    hitNormal = vec3(0.0);
+    bool hit = false;
+    uint triCount = uint(triangles.length()) / 6;
+    if (triangleLayout == 1)
+        triCount = uint(triIndices.length()) / 3;
+    else if (triangleLayout == 2)
+        triCount = uint(triangles.length()) / 4;
+    for (uint tri = 0; tri < triCount; ++tri)
+        testTriangle(tri, orig, dir, minT, hitNormal, hit);
+    return hit;
+}
+
+// Closest hit through the binary BVH below root, visiting the nearer child first. Triangle indices
+// are offset by triOffset so several BLASes can share the buffers.
+void traverseBVHStack(uint root, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    vec3 invDir = 1.0 / dir;
+    if (intersectAABB(orig, invDir, bvhNodes[root].aabbMin, bvhNodes[root].aabbMax, minT) == 1e30)
+        return;
+
+    uint stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    uint nodeIdx = root;
+    while (true)
+    {
+        BVHNode node = bvhNodes[nodeIdx];
+        if (node.triCount > 0)
+        {
+            for (uint i = 0; i < node.triCount; ++i)
+                testTriangle(triOffset + node.leftFirst + i, orig, dir, minT, hitNormal, hit);
+
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+            continue;
+        }
+
+        uint child1 = node.leftFirst;
+        uint child2 = node.leftFirst + 1;
+        float dist1 = intersectAABB(orig, invDir, bvhNodes[child1].aabbMin, bvhNodes[child1].aabbMax, minT);
+        float dist2 = intersectAABB(orig, invDir, bvhNodes[child2].aabbMin, bvhNodes[child2].aabbMax, minT);
+        if (dist1 > dist2)
+        {
+            float d = dist1; dist1 = dist2; dist2 = d;
+            uint c = child1; child1 = child2; child2 = c;
+        }
+
+        if (dist1 == 1e30)
+        {
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+        }
+        else
+        {
+            // Never full, trees as deep as the stack run the stackless kernel (see checkBVHStackDepth)
+            nodeIdx = child1;
+            if (dist2 != 1e30 && stackPtr < BVH_STACK_SIZE)
+                stack[stackPtr++] = child2;
+        }
+    }
+}
+
+uint parentOf(uint node)
+{
+    return bvhLinks[node] >> 3;
+}
+
+uint siblingOf(uint node)
+{
+    return (node & 1u) == 1u ? node + 1u : node - 1u;
+}
+
+// Whether the ray visits an interior node's right child first: children are ordered along the node's
+// split axis and the ray's direction sign picks the end it starts from. Unlike distance ordering this
+// is the same on the way down and on the way back up, which the kernels below rely on.
+bool nearIsRight(uint link, vec3 dir)
+{
+    bool swapped = ((link >> 2) & 1u) != 0u;
+    return swapped != (dir[int(link & 3u)] < 0.0);
+}
+
+bool isNearChild(uint node, uint parent, vec3 dir)
+{
+    return ((node & 1u) == 0u) == nearIsRight(bvhLinks[parent], dir);
+}
+
+void testLeaf(BVHNode node, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    for (uint i = 0; i < node.triCount; ++i)
+        testTriangle(triOffset + node.leftFirst + i, orig, dir, minT, hitNormal, hit);
+}
+
+// Near-first traversal keeping only the last SHORT_STACK_SIZE far children in a ring. Far children
+// pushed out of the ring are found again by walking up the parent links once it runs dry.
+void traverseBVHShortStack(uint root, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    vec3 invDir = 1.0 / dir;
+    if (intersectAABB(orig, invDir, bvhNodes[root].aabbMin, bvhNodes[root].aabbMax, minT) == 1e30)
+        return;
+
+    uint stack[SHORT_STACK_SIZE];
+    int head = 0;
+    int count = 0;
+    bool dropped = false;
+    uint current = root;
+    while (true)
+    {
+        BVHNode node = bvhNodes[current];
+        if (node.triCount == 0)
+        {
+            uint nearIdx = node.leftFirst + (nearIsRight(bvhLinks[current], dir) ? 1u : 0u);
+            uint farIdx = siblingOf(nearIdx);
+            bool nearHit = intersectAABB(orig, invDir, bvhNodes[nearIdx].aabbMin, bvhNodes[nearIdx].aabbMax, minT) != 1e30;
+            bool farHit = intersectAABB(orig, invDir, bvhNodes[farIdx].aabbMin, bvhNodes[farIdx].aabbMax, minT) != 1e30;
+            if (nearHit)
+            {
+                if (farHit)
+                {
+                    stack[head] = farIdx;
+                    head = (head + 1) % SHORT_STACK_SIZE;
+                    if (count == SHORT_STACK_SIZE)
+                        dropped = true;
+                    else
+                        count++;
+                }
+                current = nearIdx;
+                continue;
+            }
+            if (farHit)
+            {
+                current = farIdx;
+                continue;
+            }
+        }
+        else
+            testLeaf(node, triOffset, orig, dir, minT, hitNormal, hit);
+
+        // current's subtree is finished
+        if (count > 0)
+        {
+            head = (head + SHORT_STACK_SIZE - 1) % SHORT_STACK_SIZE;
+            count--;
+            current = stack[head];
+            continue;
+        }
+        if (!dropped)
+            break;
+
+        // Ring is empty but entries were lost: the next far child still to visit is the first one
+        // above current that current was reached through the near side of
+        bool resumed = false;
+        while (current != root)
+        {
+            uint parent = parentOf(current);
+            if (isNearChild(current, parent, dir))
+            {
+                uint farIdx = siblingOf(current);
+                if (intersectAABB(orig, invDir, bvhNodes[farIdx].aabbMin, bvhNodes[farIdx].aabbMax, minT) != 1e30)
+                {
+                    current = farIdx;
+                    resumed = true;
+                    break;
+                }
+            }
+            current = parent;
+        }
+        if (!resumed)
+            break;
+    }
+}
+
+// Stackless traversal with parent links (Hapala et al. 2011), no per-thread array at all. The state
+// says how current was reached: from its parent (near child), from its sibling (far child) or from
+// a child whose subtree is finished.
+void traverseBVHStackless(uint root, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    const int FROM_PARENT = 0;
+    const int FROM_SIBLING = 1;
+    const int FROM_CHILD = 2;
+
+    vec3 invDir = 1.0 / dir;
+    BVHNode rootNode = bvhNodes[root];
+    if (intersectAABB(orig, invDir, rootNode.aabbMin, rootNode.aabbMax, minT) == 1e30)
+        return;
+    if (rootNode.triCount > 0)
+    {
+        testLeaf(rootNode, triOffset, orig, dir, minT, hitNormal, hit);
+        return;
+    }
+
+    uint current = rootNode.leftFirst + (nearIsRight(bvhLinks[root], dir) ? 1u : 0u);
+    int state = FROM_PARENT;
+    while (true)
+    {
+        if (state == FROM_CHILD)
+        {
+            if (current == root)
+                return;
+            uint parent = parentOf(current);
+            if (isNearChild(current, parent, dir))
+            {
+                current = siblingOf(current);
+                state = FROM_SIBLING;
+            }
+            else
+                current = parent;
+            continue;
+        }
+
+        BVHNode node = bvhNodes[current];
+        bool boxHit = intersectAABB(orig, invDir, node.aabbMin, node.aabbMax, minT) != 1e30;
+        if (boxHit && node.triCount == 0)
+        {
+            current = node.leftFirst + (nearIsRight(bvhLinks[current], dir) ? 1u : 0u);
+            state = FROM_PARENT;
+            continue;
+        }
+        if (boxHit)
+            testLeaf(node, triOffset, orig, dir, minT, hitNormal, hit);
+
+        // Subtree finished: a near child hands over to its far sibling, a far child to its parent
+        if (state == FROM_PARENT)
+        {
+            current = siblingOf(current);
+            state = FROM_SIBLING;
+        }
+        else
+        {
+            current = parentOf(current);
+            state = FROM_CHILD;
+        }
+    }
+}
+
+void traverseBVH(uint root, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    if (bvhKernel == 1)
+        traverseBVHShortStack(root, triOffset, orig, dir, minT, hitNormal, hit);
+    else if (bvhKernel == 2)
+        traverseBVHStackless(root, triOffset, orig, dir, minT, hitNormal, hit);
+    else
+        traverseBVHStack(root, triOffset, orig, dir, minT, hitNormal, hit);
+}
+
+bool traceBVH(vec3 orig, vec3 dir, out float minT, out vec3 hitNormal)
+{
+    minT = 1e20;
+    hitNormal = vec3(0.0);
+    bool hit = false;
+    if (bvhNodes.length() > 0)
+        traverseBVH(0u, 0u, orig, dir, minT, hitNormal, hit);
+    return hit;
+}
+
+// Closest hit through the wide BVH below root: leaf children are intersected straight away and the
+// internal children that were hit are pushed far-to-near so the nearest is popped next
+void traverseWideBVH(uint root, uint triOffset, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    vec3 invDir = 1.0 / dir;
+    uint stride = 2u + uint(bvhWidth) / 2u;
+
+    uint stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = root;
+    while (stackPtr > 0)
+    {
+        uint base = stack[--stackPtr] * stride;
+        uvec4 header = wideNodes[base];
+        uvec2 bases = wideNodes[base + 1u].xy;
+        vec3 origin = uintBitsToFloat(header.xyz);
+        vec3 scale = vec3(
+            uintBitsToFloat((header.w & 0xFFu) << 23),
+            uintBitsToFloat(((header.w >> 8) & 0xFFu) << 23),
+            uintBitsToFloat(((header.w >> 16) & 0xFFu) << 23));
+        uint childCount = header.w >> 24;
+
+        float dists[8];
+        uint ids[8];
+        int hitCount = 0;
+        for (uint c = 0u; c < childCount; ++c)
+        {
+            uvec4 pair = wideNodes[base + 2u + c / 2u];
+            uvec2 q = (c & 1u) == 0u ? pair.xy : pair.zw;
+            vec3 qlo = vec3(q.x & 0xFFu, (q.x >> 8) & 0xFFu, (q.x >> 16) & 0xFFu);
+            vec3 qhi = vec3(q.x >> 24, q.y & 0xFFu, (q.y >> 8) & 0xFFu);
+            uint meta = q.y >> 16;
+
+            float dist = intersectAABB(orig, invDir, origin + qlo * scale, origin + qhi * scale, minT);
+            if (dist == 1e30)
+                continue;
+
+            if ((meta & WIDE_LEAF_FLAG) != 0u)
+            {
+                uint first = triOffset + bases.y + (meta & 0x7FFu);
+                uint count = (meta >> 11) & 0xFu;
+                for (uint i = 0u; i < count; ++i)
+                    testTriangle(first + i, orig, dir, minT, hitNormal, hit);
+                continue;
+            }
+
+            // Insertion sort, nearest first
+            int pos = hitCount++;
+            while (pos > 0 && dists[pos - 1] > dist)
+            {
+                dists[pos] = dists[pos - 1];
+                ids[pos] = ids[pos - 1];
+                pos--;
+            }
+            dists[pos] = dist;
+            ids[pos] = bases.x + (meta & 0x7u);
+        }
+
+        // Never full, wide trees that could overflow it aren't used (see wideStackFits)
+        for (int i = hitCount - 1; i >= 0; --i)
+        {
+            if (stackPtr < BVH_STACK_SIZE)
+                stack[stackPtr++] = ids[i];
+        }
+    }
+}
+
+bool traceWideBVH(vec3 orig, vec3 dir, out float minT, out vec3 hitNormal)
+{
+    minT = 1e20;
+    hitNormal = vec3(0.0);
+    bool hit = false;
+    traverseWideBVH(0u, 0u, orig, dir, minT, hitNormal, hit);
+    return hit;
+}
+
+// Moves the ray into instance space and traces the instance's BLAS. The direction is not
+// renormalised, so hit distances stay in world units and minT is shared across instances.
+void traverseInstance(uint inst, vec3 orig, vec3 dir, inout float minT, inout vec3 hitNormal, inout bool hit)
+{
+    Instance instance = instances[inst];
+    vec4 r0 = instance.worldToObject[0];
+    vec4 r1 = instance.worldToObject[1];
+    vec4 r2 = instance.worldToObject[2];
+    vec3 objOrig = vec3(dot(r0.xyz, orig) + r0.w, dot(r1.xyz, orig) + r1.w, dot(r2.xyz, orig) + r2.w);
+    vec3 objDir = vec3(dot(r0.xyz, dir), dot(r1.xyz, dir), dot(r2.xyz, dir));
+
+    bool instanceHit = false;
+    vec3 objNormal = vec3(0.0);
+    if (bvhWidth > 2)
+        traverseWideBVH(instance.blasRoot, instance.blasTriOffset, objOrig, objDir, minT, objNormal, instanceHit);
+    else
+        traverseBVH(instance.blasRoot, instance.blasTriOffset, objOrig, objDir, minT, objNormal, instanceHit);
+
+    // Normals go back to world space through the inverse transpose of objectToWorld = transpose(worldToObject)
+    if (instanceHit)
+    {
+        hit = true;
+        hitNormal = normalize(r0.xyz * objNormal.x + r1.xyz * objNormal.y + r2.xyz * objNormal.z);
+    }
+}
+
+// Closest hit over all instances, walking the TLAS nearer child first
+bool traceInstances(vec3 orig, vec3 dir, out float minT, out vec3 hitNormal)
+{
+    minT = 1e20;
+    hitNormal = vec3(0.0);
+    bool hit = false;
+    vec3 invDir = 1.0 / dir;
+    if (tlasNodes.length() == 0 || intersectAABB(orig, invDir, tlasNodes[0].aabbMin, tlasNodes[0].aabbMax, minT) == 1e30)
+        return false;
+
+    uint stack[TLAS_STACK_SIZE];
+    int stackPtr = 0;
+    uint nodeIdx = 0;
+    while (true)
+    {
+        BVHNode node = tlasNodes[nodeIdx];
+        if (node.triCount > 0)
+        {
+            for (uint i = 0; i < node.triCount; ++i)
+                traverseInstance(node.leftFirst + i, orig, dir, minT, hitNormal, hit);
+
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+            continue;
+        }
+
+        uint child1 = node.leftFirst;
+        uint child2 = node.leftFirst + 1;
+        float dist1 = intersectAABB(orig, invDir, tlasNodes[child1].aabbMin, tlasNodes[child1].aabbMax, minT);
+        float dist2 = intersectAABB(orig, invDir, tlasNodes[child2].aabbMin, tlasNodes[child2].aabbMax, minT);
+        if (dist1 > dist2)
+        {
+            float d = dist1; dist1 = dist2; dist2 = d;
+            uint c = child1; child1 = child2; child2 = c;
+        }
+
+        if (dist1 == 1e30)
+        {
+            if (stackPtr == 0)
+                break;
+            nodeIdx = stack[--stackPtr];
+        }
+        else
+        {
+            // Never full, TLASes as deep as the stack aren't traced (see buildSceneInstances)
+            nodeIdx = child1;
+            if (dist2 != 1e30 && stackPtr < TLAS_STACK_SIZE)
+                stack[stackPtr++] = child2;
+        }
+    }
+    return hit;
+}
+
+// Refracts (or on total internal reflection, reflects) dir at a hit and moves the origin just past the
+// surface. N is the hit normal faced against the incoming ray, kept for the final Fresnel mix. Returns
+// the fraction of the path's energy that carries on (total internal reflection loses none).
+float scatterAtHit(vec3 hitPoint, vec3 hitNormal, inout vec3 origin, inout vec3 dir, inout float currentIOR, out vec3 N)
+{
+    // Face the normal against the incoming ray
+    N = faceforward(hitNormal, dir, hitNormal);
+
+    // Refraction alternates between air and model
+    float nextIOR = (abs(currentIOR - airIOR) < 0.001) ? modelIOR : airIOR;
+    vec3 T = refract(dir, N, currentIOR / nextIOR);
+    float transmitted = 1.0;
+
+    if (length(T) < 0.001)
+    {
+        // Total internal reflection: fallback to reflection
+        dir = reflect(dir, N);
+    }
+    else
+    {
+        float F0 = pow((currentIOR - nextIOR) / (currentIOR + nextIOR), 2.0);
+        transmitted = 1.0 - fresnelSchlick(clamp(dot(-dir, N), 0.0, 1.0), F0);
+        dir = normalize(T);
+        currentIOR = nextIOR;
+    }
+
+    // Move ray origin slightly forward to avoid self-hit
+    origin = hitPoint + dir * 0.001;
+    return transmitted;
+}
+
+// Whether a path that just scattered carries too little energy to matter and can stop early
+bool pathTerminates(float throughput)
+{
+    return throughput < minThroughput;
+}
+
+// Whether a path in air is outside the scene's bounds or pointing away from them, so its next search
+// can only miss. Only the linear search and the TLAS skip that search, a single BVH already rejects
+// the ray at its root node. Callers still count the skipped search in the heatmap.
+bool pathLeavesScene(vec3 origin, vec3 dir, float currentIOR)
+{
+    if (useBVH && !useInstances)
+        return false;
+    return abs(currentIOR - airIOR) < 0.001
+        && intersectAABB(origin, 1.0 / dir, sceneBoundsMin, sceneBoundsMax, 1e30) == 1e30;
+}
+
+// Debug colour for a pixel that ran `searches` intersection searches, blue (none) to red (the whole budget)
+vec3 bounceHeatmap(int searches)
+{
+    float t = clamp(float(searches) / float(max(maxBounces, 1)), 0.0, 1.0);
+    return clamp(vec3(2.0 * t - 0.5, 1.0 - abs(2.0 * t - 1.0) * 1.5, 1.5 - 2.0 * t), 0.0, 1.0);
+}
+
+// Closest hit with whichever acceleration structure is active
+bool traceScene(vec3 orig, vec3 dir, out float minT, out vec3 hitNormal)
+{
+    if (!useBVH)
+        return traceLinear(orig, dir, minT, hitNormal);
+    if (useInstances)
+        return traceInstances(orig, dir, minT, hitNormal);
+    if (bvhWidth > 2)
+        return traceWideBVH(orig, dir, minT, hitNormal);
+    return traceBVH(orig, dir, minT, hitNormal);
+}
+
+// Skybox seen along the path's final direction, mixed with its reflection off the last surface hit
+// (N is zero when nothing was hit, which leaves just the skybox)
+vec3 pathColor(vec3 dir, vec3 N)
+{
+    if (!reflectEnable)
+        return texture(skybox, dir).rgb;
+
+    float cosTheta = clamp(dot(-dir, N), 0.0, 1.0);
+    float F0 = pow((airIOR - modelIOR) / (airIOR + modelIOR), 2.0);
+    float fresnel = fresnelSchlick(cosTheta, F0);
+    vec3 reflectedColor = texture(skybox, reflect(dir, N)).rgb;
+    vec3 refractedColor = texture(skybox, dir).rgb;
+    return mix(refractedColor, reflectedColor, fresnel);
+}
+
+// Bounces from firstBounce until the ray escapes, runs out of bounces or of throughput, and returns its
+// colour (or with showBounceHeatmap, how many intersection searches it took)
+vec3 tracePath(vec3 origin, vec3 dir, float currentIOR, vec3 N, int firstBounce, float throughput)
+{
+    int searches = 0;
+    for (int bounce = firstBounce; bounce < maxBounces && bounce < MAX_BOUNCE_LIMIT; ++bounce)
+    {
+        // Nothing left to hit, the skipped search still shows in the heatmap
+        if (pathLeavesScene(origin, dir, currentIOR))
+        {
+            searches++;
+            break;
+        }
+
+        // Search for closest triangle hit
+        float minT;
+        vec3 hitNormal;
+        bool hit = traceScene(origin, dir, minT, hitNormal);
+        vec3 hitPoint = origin + minT * dir;
+        searches++;
+
+        // If missed, break and let last direction index skybox
+        if (!hit)
+            break;
+
+        throughput *= scatterAtHit(hitPoint, hitNormal, origin, dir, currentIOR, N);
+        if (pathTerminates(throughput))
+            break;
+    }
+
+    if (showBounceHeatmap)
+        return bounceHeatmap(searches);
+
+    // Mix with reflection if enabled
+    return pathColor(dir, N);
+}
@@ -0,0 +1,86 @@
+#version 430 core
+
+out vec4 FragColor;
+in vec2 TexCoords;
+
+// Traced frame in the bottom-left sourceSize texels of source (see my_dynamic_resolution.h)
+uniform sampler2D source;
+uniform vec2 sourceSize;
+
+// Edge-aware upscale: a 4x4 footprint of source texels, weighted by a compact kernel that is
+// squeezed across the local luma gradient and stretched along it. Edges stay sharp where bilinear
+// would blur them and their stair steps are smoothed along the edge. Without an edge the kernel is
+// round and interpolates the texels exactly. The result is clamped to the nearest 2x2 texels, so it
+// never rings.
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main()
+{
+    ivec2 maxTexel = ivec2(sourceSize) - 1;
+    vec2 p = TexCoords * sourceSize - 0.5;     // In texel centres
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+
+    vec3 colors[16];
+    float lumas[16];
+    float minLuma = 1e30;
+    float maxLuma = 0.0;
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            int i = y * 4 + x;
+            colors[i] = texelFetch(source, clamp(base + ivec2(x - 1, y - 1), ivec2(0), maxTexel), 0).rgb;
+            lumas[i] = luma(colors[i]);
+            minLuma = min(minLuma, lumas[i]);
+            maxLuma = max(maxLuma, lumas[i]);
+        }
+    }
+
+    // Central differences at the inner 2x2 (texels 5, 6, 9, 10), bilinearly weighted towards p
+    vec2 gradient = vec2(0.0);
+    for (int y = 1; y <= 2; y++)
+    {
+        for (int x = 1; x <= 2; x++)
+        {
+            int i = y * 4 + x;
+            float w = (x == 1 ? 1.0 - f.x : f.x) * (y == 1 ? 1.0 - f.y : f.y);
+            gradient += w * vec2(lumas[i + 1] - lumas[i - 1], lumas[i + 4] - lumas[i - 4]);
+        }
+    }
+    float strength = length(gradient);
+    vec2 across = strength > 1e-5 ? gradient / strength : vec2(1.0, 0.0);
+    vec2 along = vec2(-across.y, across.x);
+
+    // A step over the whole local range is a full edge, relative so dark and bright edges match (the
+    // floor keeps flat regions' noise from counting)
+    float edge = clamp(strength / max(maxLuma - minLuma, 0.05), 0.0, 1.0);
+    float scaleAcross = mix(1.0, 2.0, edge);
+    float scaleAlong = mix(1.0, 0.3, edge);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            vec2 offset = vec2(x - 1, y - 1) - f;
+            float a = dot(offset, across);
+            float b = dot(offset, along);
+            float w = max(1.0 - (a * a * scaleAcross + b * b * scaleAlong), 0.0);
+            w *= w;
+            sum += w * colors[y * 4 + x];
+            weightSum += w;
+        }
+    }
+
+    vec3 nearest = colors[(f.y < 0.5 ? 5 : 9) + (f.x < 0.5 ? 0 : 1)];
+    vec3 color = weightSum > 1e-5 ? sum / weightSum : nearest;
+    vec3 lo = min(min(colors[5], colors[6]), min(colors[9], colors[10]));
+    vec3 hi = max(max(colors[5], colors[6]), max(colors[9], colors[10]));
+    FragColor = vec4(clamp(color, lo, hi), 1.0);
+}
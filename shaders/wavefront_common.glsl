@@ -0,0 +1,90 @@
+// Ray and hit queues shared by the wavefront kernels (see my_wavefront.h). Each bounce reads the live
+// rays of one queue and the shade kernel compacts the survivors into the other with an atomic counter.
+
+#include "output_image.glsl"
+
+#define WAVEFRONT_GROUP_SIZE 64
+
+// 48 bytes (36 used), the ray's medium and last normal ride in spare bits
+struct WavefrontRay
+{
+    vec3 origin;
+    uint normal;        // Last hit normal faced against the ray (see encodeOctNormal), for the final Fresnel mix
+    vec3 dir;
+    uint pixel;         // Pixel index | RAY_INSIDE | RAY_HAS_NORMAL
+    float throughput;   // Energy left after the refractions so far (see scatterAtHit)
+};
+
+#define RAY_INSIDE 0x80000000u      // Travelling through the model (IOR modelIOR instead of air)
+#define RAY_HAS_NORMAL 0x40000000u  // Hit something already, normal is valid
+#define RAY_PIXEL_MASK 0x3FFFFFFFu
+
+// Two queues of queueCapacity rays back to back, bounce b reads queue b & 1
+layout(std430, binding = 8) buffer RayQueues
+{
+    WavefrontRay rays[];
+};
+
+// xyz = hit normal, w = t (negative on a miss), indexed like the rays of the queue being extended
+layout(std430, binding = 9) buffer HitQueue
+{
+    vec4 hits[];
+};
+
+layout(std430, binding = 10) buffer WavefrontCounters
+{
+    uvec4 dispatchArgs;                         // glDispatchComputeIndirect arguments for extend and shade
+    uint queueCount[2];
+    uint liveRays[MAX_BOUNCE_LIMIT];            // Rays extended per bounce, read back for the stats
+};
+
+uniform int queueCapacity;
+uniform int bounce;
+uniform int firstBounce;    // Bounce raygen queues its rays for (1 when starting from the G-buffer)
+
+void writePixel(uint pixel, vec3 color)
+{
+    int width = imageSize(outputImage).x;
+    writeOutput(ivec2(int(pixel) % width, int(pixel) / width), color);
+}
+
+// Inverse of decodeOctNormal() in trace_common.glsl
+uint encodeOctNormal(vec3 n)
+{
+    vec2 oct = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+    if (n.z < 0.0)
+        oct = (1.0 - abs(oct.yx)) * vec2(oct.x >= 0.0 ? 1.0 : -1.0, oct.y >= 0.0 ? 1.0 : -1.0);
+    return packSnorm2x16(oct);
+}
+
+// Appends a ray to the queue bounce nextBounce reads, N is zero until the first hit
+void pushRay(int nextBounce, vec3 origin, vec3 dir, float currentIOR, vec3 N, float throughput, uint pixel)
+{
+    int queue = nextBounce & 1;
+    uint slot = atomicAdd(queueCount[queue], 1u);
+    WavefrontRay ray;
+    ray.origin = origin;
+    ray.dir = dir;
+    ray.normal = 0u;
+    ray.pixel = pixel;
+    ray.throughput = throughput;
+    if (abs(currentIOR - airIOR) >= 0.001)
+        ray.pixel |= RAY_INSIDE;
+    if (N != vec3(0.0))
+    {
+        ray.normal = encodeOctNormal(N);
+        ray.pixel |= RAY_HAS_NORMAL;
+    }
+    rays[queue * queueCapacity + int(slot)] = ray;
+}
+
+// Medium and last normal of a queued ray
+float rayIOR(WavefrontRay ray)
+{
+    return (ray.pixel & RAY_INSIDE) != 0u ? modelIOR : airIOR;
+}
+
+vec3 rayNormal(WavefrontRay ray)
+{
+    return (ray.pixel & RAY_HAS_NORMAL) != 0u ? decodeOctNormal(ray.normal) : vec3(0.0);
+}
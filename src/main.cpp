@@ -7,9 +7,21 @@
 #include <my_model.h>
 #include <my_skybox.h>
 #include <my_raytracing.h>
+#include <my_gbuffer.h>
+#include <my_frame_uniforms.h>
+#include <my_accumulation.h>
+#include <my_wavefront.h>
+#include <my_compute_tracer.h>
+#include <my_shader_reload.h>
+#include <my_dynamic_resolution.h>
+#include <my_temporal_reuse.h>
+#include <my_interleaved.h>
+#include <my_cpu_tracer.h>
 
 #include <iostream>
 #include <random>
+#include <algorithm>
+#include <unordered_map>
 #define _USE_MATH_DEFINES
 #include <math.h>
 
@@ -27,6 +39,10 @@ void processUserInput(GLFWwindow* window);
 unsigned int SCREEN_WIDTH = 1920;
 unsigned int SCREEN_HEIGHT = 1080;
 
+// Size the traced pass renders at, the screen size unless dynamic resolution scales it down
+unsigned int traceWidth = SCREEN_WIDTH;
+unsigned int traceHeight = SCREEN_HEIGHT;
+
 // Mouse params
 bool firstMouse = true;
 float xPrev = static_cast<float>(SCREEN_WIDTH) / 2.0f;
@@ -55,6 +71,65 @@ GLuint museumCubemapTexture;
 std::vector<GLuint> skyboxVAOs;
 std::vector<GLuint> skyboxCubemapTextures;
 
+// Rasterizes bounce 0 for the hybrid mode, created once the GL context exists
+Shader* gBufferShader = nullptr;
+
+// Typed handles into programs that include trace_common.glsl (raytracing.fs and the wavefront
+// kernels), resolved once per linked program
+struct RaytracingUniforms
+{
+    unsigned int program = 0;
+    Uniform<float> modelIOR, minThroughput;
+    Uniform<bool> reflectEnable, useBVH, useInstances, hybridPrimary, showBounceHeatmap;
+    Uniform<int> bvhWidth, bvhKernel, triangleLayout, skybox, gPosition, gNormal, maxBounces;
+    Uniform<glm::vec3> sceneBoundsMin, sceneBoundsMax;
+
+    void resolve(const Shader& shader)
+    {
+        program = shader.ID;
+        modelIOR = shader.uniform<float>("modelIOR");
+        reflectEnable = shader.uniform<bool>("reflectEnable");
+        useBVH = shader.uniform<bool>("useBVH");
+        useInstances = shader.uniform<bool>("useInstances");
+        hybridPrimary = shader.uniform<bool>("hybridPrimary");
+        bvhWidth = shader.uniform<int>("bvhWidth");
+        bvhKernel = shader.uniform<int>("bvhKernel");
+        triangleLayout = shader.uniform<int>("triangleLayout");
+        skybox = shader.uniform<int>("skybox");
+        gPosition = shader.uniform<int>("gPosition");
+        gNormal = shader.uniform<int>("gNormal");
+        maxBounces = shader.uniform<int>("maxBounces");
+        minThroughput = shader.uniform<float>("minThroughput");
+        showBounceHeatmap = shader.uniform<bool>("showBounceHeatmap");
+        sceneBoundsMin = shader.uniform<glm::vec3>("sceneBoundsMin");
+        sceneBoundsMax = shader.uniform<glm::vec3>("sceneBoundsMax");
+    }
+};
+std::unordered_map<unsigned int, RaytracingUniforms> raytracingUniforms;
+
+// Everything that changes the traced image, accumulated samples are dropped when this changes
+uint64_t accumulationStateKey(const glm::mat4& projection, const glm::mat4& view)
+{
+    FNVHasher hasher;
+    hasher.add(projection);
+    hasher.add(view);
+    hasher.add(IOR);
+    hasher.add(enableReflect);
+    hasher.add(useBVH);
+    hasher.add(useHybridPrimary);
+    hasher.add(selectedBackend);
+    hasher.add(maxBounces);
+    hasher.add(minThroughput);
+    hasher.add(showBounceHeatmap);
+    hasher.add(selectedSkybox);
+    hasher.add(selectedKernel);
+    hasher.add(sceneVersion);
+    hasher.add(shaderHotReload.reloadCount());
+    hasher.add(SCREEN_WIDTH);
+    hasher.add(SCREEN_HEIGHT);
+    return hasher.value();
+}
+
 // Camera specs (set later, can't call functions here)
 const float cameraSpeed = 3.0f;
 const float mouseSensitivity = 0.1f;
@@ -77,6 +152,7 @@ int setupGLFW(GLFWwindow** window)
     GLFWmonitor* MyMonitor = glfwGetPrimaryMonitor();
     const GLFWvidmode* mode = glfwGetVideoMode(MyMonitor);
     SCREEN_WIDTH = mode->width; SCREEN_HEIGHT = mode->height;
+    traceWidth = SCREEN_WIDTH; traceHeight = SCREEN_HEIGHT;
 
     // glfw window creation
     GLFWwindow* glfwWindow = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Realtime Rendering Assignment 5", glfwGetPrimaryMonitor(), nullptr);
@@ -123,13 +199,128 @@ void loadModels()
     Model buddhaModel(BUDDHA_MODEL, GL_LINEAR_MIPMAP_LINEAR); allModels.push_back(buddhaModel);
 }
 
+// Build settings chosen in the GUI for the selected model
+void applyBuildSettings()
+{
+    bvhBuildParams.mode = modelBuildModes[selectedModel];
+    bvhBuildParams.width = bvhWidths[selectedBVHWidth];
+    instanceGridSize = selectedInstanceGrid;
+    triangleLayout = static_cast<TriangleLayout>(selectedTriangleLayout);
+}
+
 void setupRaytracing()
 {
+    applyBuildSettings();
     getTriangleBuffer(allModels[selectedModel]);
     setupSSBO();
     setupFullscreenQuad();
 }
 
+// Builds every bundled model with both build modes and prints build time against SAH cost
+void runBuildComparison()
+{
+    std::cout << "****************************\n";
+    std::cout << "BVH Build Comparison:\n";
+    bvhBuildParams.width = 2;
+    bvhCacheEnabled = false; // Measure real builds, not cache loads
+    for (size_t m = 0; m < allModels.size(); m++)
+    {
+        for (int mode = QualityBuild; mode <= SpatialSplitBuild; mode++)
+        {
+            bvhBuildParams.mode = static_cast<BVHBuildMode>(mode);
+            getTriangleBuffer(allModels[m]);
+            std::cout << "> " << modelOptions[m] << " / " << buildModeOptions[mode] << ": "
+                << bvhBuildStats.buildTimeMs << " ms, " << bvhBuildStats.nodeCount << " nodes, SAH "
+                << bvhBuildStats.sahCost << "\n";
+        }
+    }
+    std::cout << "****************************\n\n";
+
+    // Restore the active model
+    bvhCacheEnabled = true;
+    applyBuildSettings();
+    getTriangleBuffer(allModels[selectedModel]);
+    setupSSBO();
+}
+
+// Traces the current view on the CPU through SAH and SBVH builds of every model and prints the
+// nodes visited and triangles tested per ray (all bounces)
+void runSplitComparison(const glm::mat4& view, const glm::mat4& projection)
+{
+    const int rayWidth = 320;
+    const int rayHeight = 180;
+    std::vector<CPURay> primaryRays = generatePrimaryRays(view, projection, rayWidth, rayHeight);
+
+    std::cout << "****************************\n";
+    std::cout << "SBVH vs SAH (" << rayWidth << "x" << rayHeight << " primary rays, IOR " << IOR << "):\n";
+    bvhBuildParams.width = 2;
+    for (size_t m = 0; m < allModels.size(); m++)
+    {
+        std::cout << modelOptions[m] << ":\n";
+        RayStats sahStats, sbvhStats;
+        for (int mode : { QualityBuild, SpatialSplitBuild })
+        {
+            bvhBuildParams.mode = static_cast<BVHBuildMode>(mode);
+            getTriangleBuffer(allModels[m]);
+            RayStats stats = traceRaySetCPU(sceneBVH, triangleBuffer, primaryRays, IOR, maxBounces, minThroughput);
+            printRayStats(buildModeOptions[mode], stats);
+            (mode == QualityBuild ? sahStats : sbvhStats) = stats;
+        }
+        if (sahStats.nodesPerRay() > 0.0)
+            std::cout << "> SBVH nodes/ray vs SAH: " << 100.0 * sbvhStats.nodesPerRay() / sahStats.nodesPerRay() << "%\n";
+    }
+    std::cout << "****************************\n\n";
+
+    // Restore the active model
+    applyBuildSettings();
+    getTriangleBuffer(allModels[selectedModel]);
+    setupSSBO();
+}
+
+// Traces the current view on the CPU through binary, BVH4 and BVH8 versions of the selected model's
+// BVH and prints node fetches and node bytes read per ray
+void runWidthComparison(const glm::mat4& view, const glm::mat4& projection)
+{
+    const int rayWidth = 320;
+    const int rayHeight = 180;
+    std::vector<CPURay> primaryRays = generatePrimaryRays(view, projection, rayWidth, rayHeight);
+
+    std::cout << "****************************\n";
+    std::cout << "BVH Width Comparison (" << modelOptions[selectedModel] << ", " << buildModeOptions[modelBuildModes[selectedModel]]
+        << ", " << rayWidth << "x" << rayHeight << " primary rays):\n";
+    RayStats binaryStats;
+    for (int w = 0; w < IM_ARRAYSIZE(bvhWidths); w++)
+    {
+        bvhBuildParams.mode = modelBuildModes[selectedModel];
+        bvhBuildParams.width = bvhWidths[w];
+        getTriangleBuffer(allModels[selectedModel]);
+        if (bvhWidths[w] > 2 && bvhBuildStats.width == 2)
+        {
+            std::cout << "> " << bvhWidthOptions[w] << ": skipped, too deep for the traversal stack\n";
+            continue;
+        }
+        RayStats stats = bvhWidths[w] > 2
+            ? traceRaySetCPU(sceneWideBVH, triangleBuffer, primaryRays, IOR, maxBounces, minThroughput)
+            : traceRaySetCPU(sceneBVH, triangleBuffer, primaryRays, IOR, maxBounces, minThroughput);
+        printRayStats(bvhWidthOptions[w], stats);
+        if (bvhWidths[w] == 2)
+            binaryStats = stats;
+        else if (binaryStats.nodesPerRay() > 0.0)
+        {
+            std::cout << "> " << bvhWidthOptions[w] << " vs Binary: "
+                << 100.0 * stats.nodesPerRay() / binaryStats.nodesPerRay() << "% node fetches, "
+                << 100.0 * stats.bytesPerRay() / binaryStats.bytesPerRay() << "% bytes, "
+                << bvhBuildStats.nodeBytes / 1024 << " KB of nodes\n";
+        }
+    }
+    std::cout << "****************************\n\n";
+
+    // Restore the active model
+    applyBuildSettings();
+    getTriangleBuffer(allModels[selectedModel]);
+    setupSSBO();
+}
+
 void setupSkybox(GLuint* skyboxVAO, GLuint* cubemapTexture, const std::string skyboxName)
 {
     // Setup skybox VAO
@@ -159,25 +350,91 @@ void setupCamera()
     camera.setZoomEnabled(false);
 }
 
-void drawModel(Shader& shader, const glm::mat4& projection, const glm::mat4 view)
+// Hybrid primary visibility, the meshes' vertex buffers only match the traced triangles for a single
+// static model
+bool hybridPrimaryActive()
+{
+    return useHybridPrimary && gBufferShader && sceneModel && !sceneSkin.active() && sceneInstances.instances.empty();
+}
+
+// Binary traversal kernel actually run, the full stack one can't hold trees as deep as its stack
+int traversalKernel()
+{
+    return selectedKernel == 0 && !fullStackFits ? 2 : selectedKernel;
+}
+
+// Uniforms, skybox, G-buffer and scene SSBOs for any program that includes trace_common.glsl
+void applyTraceState(Shader& shader, bool hybrid)
 {
-    // Draw models with shader
     shader.use();
 
     // Bind skybox cubemap texture
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxCubemapTextures[selectedSkybox]);
-    glBindVertexArray(skyboxVAOs[selectedSkybox]);
     
     // Set uniforms
-    shader.setMat4("view", view);
-    shader.setMat4("projection", projection);
-    shader.setFloat("modelIOR", IOR);
-    shader.setBool("reflectEnable", enableReflect);
-    shader.setInt("skybox", 0);
+    RaytracingUniforms& uniforms = raytracingUniforms[shader.ID];
+    if (uniforms.program != shader.ID)
+        uniforms.resolve(shader);
+    shader.set(uniforms.modelIOR, IOR);
+    shader.set(uniforms.reflectEnable, enableReflect);
+    shader.set(uniforms.useBVH, useBVH);
+    shader.set(uniforms.bvhWidth, bvhBuildStats.width);
+    shader.set(uniforms.useInstances, !sceneInstances.instances.empty());
+    shader.set(uniforms.bvhKernel, traversalKernel());
+    shader.set(uniforms.triangleLayout, static_cast<int>(triangleLayout));
+    shader.set(uniforms.skybox, 0);
+    shader.set(uniforms.hybridPrimary, hybrid);
+    shader.set(uniforms.gPosition, 1);
+    shader.set(uniforms.gNormal, 2);
+    shader.set(uniforms.maxBounces, maxBounces);
+    shader.set(uniforms.minThroughput, minThroughput);
+    shader.set(uniforms.showBounceHeatmap, showBounceHeatmap);
+    AABB bounds = sceneBounds();
+    shader.set(uniforms.sceneBoundsMin, bounds.bmin);
+    shader.set(uniforms.sceneBoundsMax, bounds.bmax);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gBuffer.position);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, gBuffer.normal);
+    glActiveTexture(GL_TEXTURE0);
 
-    // Bind SSBO (in case it's not already bound)
+    // Bind SSBOs (in case they're not already bound)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvhSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, wideBVHSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, tlasSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, instanceSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bvhLinksSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, vertexSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, indexSSBO);
+}
+
+// Permutation of raytracing.fs for the current settings, compiled the first time they're used
+Shader& raytracingVariant()
+{
+    ShaderVariantKey key;
+    key.maxBounces = std::clamp(maxBounces, 1, MAX_BOUNCE_LIMIT);
+    key.reflect = enableReflect;
+    key.triangleLayout = static_cast<int>(triangleLayout);
+    key.bvhKernel = traversalKernel();
+    return raytracingVariants.get(key);
+}
+
+// genericShader is the uniform-driven raytracing.fs, replaced by its specialized variant when those are on
+void drawModel(Shader& genericShader, const glm::mat4& projection, const glm::mat4 view)
+{
+    Shader& shader = useShaderVariants ? raytracingVariant() : genericShader;
+    bool hybrid = hybridPrimaryActive();
+
+    // View, projection, their inverses and the ray basis for every program below (each used to set
+    // view and projection itself)
+    frameUniforms.update(view, projection, hybrid ? 4 : 2);
+    if (hybrid)
+        renderGBuffer(*gBufferShader, *sceneModel, traceWidth, traceHeight);
+
+    // Draw models with shader
+    applyTraceState(shader, hybrid);
 
     // Draw fullscreen triangle
     glBindVertexArray(fsVAO);
@@ -185,6 +442,467 @@ void drawModel(Shader& shader, const glm::mat4& projection, const glm::mat4 view
     glBindVertexArray(0);
 }
 
+// Creates the selected compute backend's programs and buffers for the traced size, returns its output
+GLuint setupComputeBackend()
+{
+    if (selectedBackend == WavefrontBackend)
+    {
+        setupWavefront(traceWidth, traceHeight);
+        return wavefront.output;
+    }
+    setupComputeTracer(traceWidth, traceHeight);
+    return computeTracer.output;
+}
+
+// Same image as drawModel through the selected compute backend, written (or with accumulate, added)
+// to target
+void drawModelCompute(const glm::mat4& projection, const glm::mat4 view, GLuint target, bool accumulate)
+{
+    bool hybrid = hybridPrimaryActive();
+    frameUniforms.update(view, projection, hybrid ? 4 : 2);
+    if (hybrid)
+        renderGBuffer(*gBufferShader, *sceneModel, traceWidth, traceHeight);
+
+    if (selectedBackend == WavefrontBackend)
+    {
+        applyTraceState(*wavefront.raygen, hybrid);
+        applyTraceState(*wavefront.extend, hybrid);
+        applyTraceState(*wavefront.shade, hybrid);
+        traceWavefront(target, accumulate, hybrid ? 1 : 0, maxBounces);
+    }
+    else
+    {
+        applyTraceState(*computeTracer.program, hybrid);
+        traceCompute(target, accumulate, selectedBackend == ComputePersistentBackend);
+    }
+}
+
+// Draws one (non-accumulated) frame with the selected backend into the default framebuffer
+void drawFrame(Shader& shader, Shader& presentShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    if (selectedBackend == MegakernelBackend)
+    {
+        drawModel(shader, projection, view);
+        return;
+    }
+    GLuint output = setupComputeBackend();
+    drawModelCompute(projection, view, output, false);
+    presentTexture(presentShader, output, fsVAO);
+}
+
+// drawFrame at the size dynamic resolution picked for this frame, upscaled into the default framebuffer
+void drawFrameScaled(Shader& shader, Shader& upscaleShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    beginDynamicResolutionFrame(SCREEN_WIDTH, SCREEN_HEIGHT);
+    traceWidth = dynamicResolution.width;
+    traceHeight = dynamicResolution.height;
+
+    GLuint source = dynamicResolution.texture;
+    if (selectedBackend == MegakernelBackend)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, dynamicResolution.fbo);
+        glViewport(0, 0, traceWidth, traceHeight);
+        drawModel(shader, projection, view);
+    }
+    else
+    {
+        // The compute output already has the traced size
+        source = setupComputeBackend();
+        drawModelCompute(projection, view, source, false);
+    }
+
+    traceWidth = SCREEN_WIDTH;
+    traceHeight = SCREEN_HEIGHT;
+    endDynamicResolutionFrame(upscaleShader, source, fsVAO);
+}
+
+// Everything that changes the traced image except the camera's rotation, which the reprojecting
+// modes follow (the pinned position has to match as well)
+uint64_t rotationHistoryKey(const glm::mat4& projection)
+{
+    FNVHasher hasher;
+    hasher.add(accumulationStateKey(projection, glm::mat4(1.0f)));
+    hasher.add(camera.position);
+    return hasher.value();
+}
+
+// drawModel reusing last frame's samples wherever the camera's rotation carries them over, only the
+// fragment backend can skip the reused pixels (through the stencil test)
+void drawFrameTemporal(Shader& shader, Shader& reprojectShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    beginTemporalFrame(reprojectShader, fsVAO, SCREEN_WIDTH, SCREEN_HEIGHT, rotationHistoryKey(projection), projection, view);
+    drawModel(shader, projection, view);
+    endTemporalFrame();
+}
+
+// drawModel on the interleaved pattern's pixels only (fragment backend), the rest reconstructed
+void drawFrameInterleaved(Shader& shader, Shader& maskShader, Shader& resolveShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    beginInterleavedFrame(maskShader, fsVAO, SCREEN_WIDTH, SCREEN_HEIGHT, rotationHistoryKey(projection));
+    drawModel(shader, projection, view);
+    endInterleavedFrame(resolveShader, fsVAO, projection, view);
+}
+
+// Default framebuffer as 8-bit RGB, what the screen shows
+std::vector<unsigned char> readScreen(int width, int height)
+{
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+// Peak signal-to-noise ratio of image against reference (same size, 8-bit), in dB
+double imagePSNR(const std::vector<unsigned char>& reference, const std::vector<unsigned char>& image)
+{
+    double squaredError = 0.0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        double difference = static_cast<double>(reference[i]) - static_cast<double>(image[i]);
+        squaredError += difference * difference;
+    }
+    double mse = squaredError / static_cast<double>(reference.size());
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+// Mean of every accumulated pixel, clamped to what the screen can show
+std::vector<float> readAccumulation()
+{
+    size_t pixels = static_cast<size_t>(accumulator.width) * accumulator.height;
+    std::vector<float> sums(pixels * 4);
+    glBindTexture(GL_TEXTURE_2D, accumulator.texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, sums.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    std::vector<float> image(pixels * 3);
+    for (size_t i = 0; i < pixels; i++)
+    {
+        float count = sums[4 * i + 3];
+        for (int c = 0; c < 3; c++)
+            image[3 * i + c] = count > 0.0f ? std::clamp(sums[4 * i + c] / count, 0.0f, 1.0f) : 0.0f;
+    }
+    return image;
+}
+
+// Peak signal-to-noise ratio of image against reference (same size, in [0, 1]), in dB
+double imagePSNR(const std::vector<float>& reference, const std::vector<float>& image)
+{
+    double squaredError = 0.0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        double difference = static_cast<double>(reference[i]) - static_cast<double>(image[i]);
+        squaredError += difference * difference;
+    }
+    double mse = squaredError / static_cast<double>(reference.size());
+    return mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : 99.0;
+}
+
+// Accumulates the current view from scratch with the fragment pass, for passes passes or, when that's
+// 0, until gpuBudgetMs of GPU time is spent. Pass i is jittered with Halton sample jitterOffset + i.
+// Returns the GPU time, every pass is timed and waited on.
+double accumulateForComparison(Shader& shader, Shader& maskShader, const glm::mat4& projection, const glm::mat4& view,
+    bool adaptive, unsigned int passes, double gpuBudgetMs, unsigned int jitterOffset, GLuint timerQuery)
+{
+    accumulator.sampleCount = 0;    // needsAccumulationSample clears the buffer
+    resetAdaptiveSampling();
+    double spentMs = 0.0;
+    for (unsigned int pass = 0; passes > 0 ? pass < passes : spentMs < gpuBudgetMs; pass++)
+    {
+        needsAccumulationSample(accumulator.stateKey, SCREEN_WIDTH, SCREEN_HEIGHT, pass + 1);
+        glm::mat4 jittered = jitterProjection(projection, jitterOffset + accumulator.sampleCount, SCREEN_WIDTH, SCREEN_HEIGHT);
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        if (adaptive)
+            beginAdaptiveSample(maskShader, fsVAO);
+        else
+            beginAccumulationSample();
+        drawModel(shader, jittered, view);
+        endAccumulationSample();
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsedNs);
+        spentMs += static_cast<double>(elapsedNs) / 1e6;
+    }
+    return spentMs;
+}
+
+// Equal-time quality of uniform and adaptive accumulation on every bundled model and skybox from the
+// current view: uniform sampling gets a fixed number of passes, adaptive sampling the same GPU time,
+// and both are scored (PSNR) against a uniform reference with sixteen times the samples. The
+// reference is jittered from a separate stretch of the Halton sequence, so it shares no sample with
+// either run and the scores measure convergence rather than overlap.
+void runSamplingComparison(Shader& shader, Shader& maskShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    const unsigned int uniformPasses = 16;
+    const unsigned int referencePasses = 16 * uniformPasses;
+    // Past any pass count the scored runs reach. Odd and not a multiple of 3, an offset like 2^16 would
+    // land every base 2 jitter a hair away from one the scored runs use.
+    const unsigned int referenceJitterOffset = 100003;
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    std::cout << "****************************\n";
+    std::cout << "Adaptive Sampling (" << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ", " << uniformPasses
+        << " uniform samples, adaptive at equal GPU time, " << 100.0f * accumulator.adaptiveFraction << "% of pixels per pass, "
+        << referencePasses << " sample reference):\n";
+    Skyboxes activeSkybox = selectedSkybox;
+    double uniformTotal = 0.0;
+    double adaptiveTotal = 0.0;
+    int runs = 0;
+    for (size_t m = 0; m < allModels.size(); m++)
+    {
+        bvhBuildParams.mode = modelBuildModes[m];
+        getTriangleBuffer(allModels[m]);
+        setupSSBO();
+        for (int skybox = 0; skybox < IM_ARRAYSIZE(skyboxOptions); skybox++)
+        {
+            selectedSkybox = static_cast<Skyboxes>(skybox);
+            accumulateForComparison(shader, maskShader, projection, view, false, referencePasses, 0.0, referenceJitterOffset, timerQuery);
+            std::vector<float> reference = readAccumulation();
+
+            double uniformMs = accumulateForComparison(shader, maskShader, projection, view, false, uniformPasses, 0.0, 0, timerQuery);
+            double uniformPSNR = imagePSNR(reference, readAccumulation());
+            accumulateForComparison(shader, maskShader, projection, view, true, 0, uniformMs, 0, timerQuery);
+            unsigned int adaptivePasses = accumulator.sampleCount;
+            double adaptivePSNR = imagePSNR(reference, readAccumulation());
+
+            std::cout << "> " << modelOptions[m] << " / " << skyboxOptions[skybox] << ": " << uniformMs << " ms, uniform "
+                << uniformPSNR << " dB, adaptive " << adaptivePSNR << " dB (" << adaptivePasses << " passes, "
+                << std::showpos << adaptivePSNR - uniformPSNR << std::noshowpos << " dB)\n";
+            uniformTotal += uniformPSNR;
+            adaptiveTotal += adaptivePSNR;
+            runs++;
+        }
+    }
+    samplingComparison.uniformPSNR = static_cast<float>(uniformTotal / runs);
+    samplingComparison.adaptivePSNR = static_cast<float>(adaptiveTotal / runs);
+    std::cout << "> Mean: uniform " << samplingComparison.uniformPSNR << " dB, adaptive " << samplingComparison.adaptivePSNR << " dB\n";
+    std::cout << "****************************\n\n";
+    glDeleteQueries(1, &timerQuery);
+
+    // Restore the active model and skybox, the interactive accumulation starts over
+    selectedSkybox = activeSkybox;
+    applyBuildSettings();
+    getTriangleBuffer(allModels[selectedModel]);
+    setupSSBO();
+    accumulator.sampleCount = 0;
+}
+
+// Pans the camera (rotation only, like mouse-look) over a run of frames with full tracing and with
+// every interleaved pattern. Prints the GPU time per frame and the PSNR of the pan's last frame
+// against the fully traced one.
+void runInterleavedComparison(Shader& shader, Shader& maskShader, Shader& resolveShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    const int panFrames = 32;
+    const float panDegrees = 0.25f;     // Per frame
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    // Yaw about the camera's (pinned) position
+    auto panView = [&](int frame)
+    {
+        return view * glm::translate(glm::mat4(1.0f), camera.position)
+            * glm::rotate(glm::mat4(1.0f), glm::radians(panDegrees * frame), glm::vec3(0.0f, 1.0f, 0.0f))
+            * glm::translate(glm::mat4(1.0f), -camera.position);
+    };
+
+    std::cout << "****************************\n";
+    std::cout << "Interleaved Tracing (" << modelOptions[selectedModel] << ", " << SCREEN_WIDTH << "x" << SCREEN_HEIGHT
+        << ", " << panFrames << " frame pan):\n";
+    int activePattern = interleaved.pattern;
+    std::vector<unsigned char> reference;
+    for (int pattern = 0; pattern < IM_ARRAYSIZE(interleaveOptions); pattern++)
+    {
+        interleaved.pattern = pattern;
+        interleaved.historyValid = false;
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        for (int f = 0; f < panFrames; f++)
+        {
+            if (pattern == 0)
+                drawModel(shader, projection, panView(f));
+            else
+                drawFrameInterleaved(shader, maskShader, resolveShader, projection, panView(f));
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsedNs);
+        double frameMs = static_cast<double>(elapsedNs) / 1e6 / panFrames;
+        std::vector<unsigned char> image = readScreen(SCREEN_WIDTH, SCREEN_HEIGHT);
+        interleaved.compareMs[pattern] = static_cast<float>(frameMs);
+        std::cout << "> " << interleaveOptions[pattern] << ": " << frameMs << " ms";
+        if (pattern == 0)
+            reference = image;
+        else
+        {
+            interleaved.comparePSNR[pattern] = static_cast<float>(imagePSNR(reference, image));
+            std::cout << " (" << 100.0 * frameMs / interleaved.compareMs[0] << "% of full), PSNR "
+                << interleaved.comparePSNR[pattern] << " dB";
+        }
+        std::cout << "\n";
+    }
+    std::cout << "****************************\n\n";
+    glDeleteQueries(1, &timerQuery);
+
+    interleaved.pattern = activePattern;
+    interleaved.historyValid = false;
+}
+
+// GPU time per frame of every backend from the current view (the compute ones include presenting their
+// output), plus how many rays each wavefront bounce still had to extend
+void runBackendComparison(Shader& shader, Shader& presentShader, const glm::mat4& projection, const glm::mat4& view)
+{
+    const int warmupFrames = 5;
+    const int timedFrames = 30;
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    std::cout << "****************************\n";
+    std::cout << "Tracing Backends (" << modelOptions[selectedModel] << ", " << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << "):\n";
+    int activeBackend = selectedBackend;
+    double megakernelMs = 0.0;
+    for (int backend = 0; backend < IM_ARRAYSIZE(backendOptions); backend++)
+    {
+        selectedBackend = backend;
+        for (int f = 0; f < warmupFrames; f++)
+            drawFrame(shader, presentShader, projection, view);
+
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        for (int f = 0; f < timedFrames; f++)
+            drawFrame(shader, presentShader, projection, view);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsedNs);
+        double frameMs = static_cast<double>(elapsedNs) / 1e6 / timedFrames;
+        if (backend == MegakernelBackend)
+            megakernelMs = frameMs;
+        std::cout << "> " << backendOptions[backend] << ": " << frameMs << " ms";
+        if (backend != MegakernelBackend && megakernelMs > 0.0)
+            std::cout << " (" << 100.0 * frameMs / megakernelMs << "% of megakernel)";
+        std::cout << "\n";
+    }
+
+    // Live rays per bounce, the megakernel keeps every pixel's thread for the whole loop
+    double pixels = static_cast<double>(SCREEN_WIDTH) * SCREEN_HEIGHT;
+    std::vector<GLuint> liveRays = readWavefrontLiveRays();
+    for (size_t bounce = 0; bounce < liveRays.size() && bounce < static_cast<size_t>(maxBounces); bounce++)
+        std::cout << "  bounce " << bounce << ": " << liveRays[bounce] << " live rays ("
+            << 100.0 * liveRays[bounce] / pixels << "% of pixels)\n";
+    std::cout << "****************************\n\n";
+    glDeleteQueries(1, &timerQuery);
+
+    selectedBackend = activeBackend;
+}
+
+// Renders the current view with every binary traversal kernel on every bundled model and prints the
+// GPU time per frame, measured with a timer query over a run of frames after a short warm-up
+void runKernelComparison(Shader& shader, const glm::mat4& projection, const glm::mat4& view)
+{
+    const int warmupFrames = 5;
+    const int timedFrames = 30;
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+
+    std::cout << "****************************\n";
+    std::cout << "BVH Traversal Kernels (" << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ", IOR " << IOR << "):\n";
+    int activeKernel = selectedKernel;
+    bvhBuildParams.width = 2; // The kernels only differ on binary nodes
+    for (size_t m = 0; m < allModels.size(); m++)
+    {
+        bvhBuildParams.mode = modelBuildModes[m];
+        getTriangleBuffer(allModels[m]);
+        setupSSBO();
+
+        double fullStackMs = 0.0;
+        for (int kernel = 0; kernel < IM_ARRAYSIZE(bvhKernelOptions); kernel++)
+        {
+            selectedKernel = kernel;
+            for (int f = 0; f < warmupFrames; f++)
+                drawModel(shader, projection, view);
+
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+            for (int f = 0; f < timedFrames; f++)
+                drawModel(shader, projection, view);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsedNs);
+            double frameMs = static_cast<double>(elapsedNs) / 1e6 / timedFrames;
+            if (kernel == 0)
+                fullStackMs = frameMs;
+            std::cout << "> " << modelOptions[m] << " / " << bvhKernelOptions[kernel] << ": " << frameMs << " ms";
+            if (traversalKernel() != kernel)
+                std::cout << " (ran " << bvhKernelOptions[traversalKernel()] << ", the tree is too deep)";
+            if (kernel > 0 && fullStackMs > 0.0)
+                std::cout << " (" << 100.0 * frameMs / fullStackMs << "% of full stack)";
+            std::cout << "\n";
+        }
+    }
+    std::cout << "****************************\n\n";
+    glDeleteQueries(1, &timerQuery);
+
+    // Restore the active model and kernel
+    selectedKernel = activeKernel;
+    applyBuildSettings();
+    getTriangleBuffer(allModels[selectedModel]);
+    setupSSBO();
+}
+
+// Triangle test throughput: the CPU benchmark of Möller–Trumbore against the unit triangle test, then
+// GPU time per frame for every triangle layout. Tests per frame come from the CPU mirror of the
+// current view, so GPU tests/s (frame time includes traversal) is only printed for the BVH paths it mirrors.
+void runTriangleComparison(Shader& shader, const glm::mat4& projection, const glm::mat4& view)
+{
+    const int warmupFrames = 5;
+    const int timedFrames = 30;
+
+    std::cout << "****************************\n";
+    std::cout << "Triangle Tests (" << modelOptions[selectedModel] << ", " << triangleBuffer.size() << " triangles):\n";
+    std::cout << "CPU (320x180 primary rays against every triangle):\n";
+    printTriangleBenchmark(benchmarkTriangleTests(triangleBuffer, generatePrimaryRays(view, projection, 320, 180)));
+
+    uint64_t testsPerFrame = 0;
+    if (useBVH && sceneInstances.instances.empty())
+    {
+        std::vector<CPURay> screenRays = generatePrimaryRays(view, projection, SCREEN_WIDTH, SCREEN_HEIGHT);
+        RayStats stats = bvhBuildStats.width > 2
+            ? traceRaySetCPU(sceneWideBVH, triangleBuffer, screenRays, IOR, maxBounces, minThroughput)
+            : traceRaySetCPU(sceneBVH, triangleBuffer, screenRays, IOR, maxBounces, minThroughput);
+        testsPerFrame = stats.trianglesTested;
+    }
+
+    std::cout << "GPU (" << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ", " << testsPerFrame << " tests/frame):\n";
+    GLuint timerQuery;
+    glGenQueries(1, &timerQuery);
+    for (int layout = 0; layout < IM_ARRAYSIZE(triangleLayoutOptions); layout++)
+    {
+        triangleLayout = static_cast<TriangleLayout>(layout);
+        setupTriangleSSBO();
+        for (int f = 0; f < warmupFrames; f++)
+            drawModel(shader, projection, view);
+
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        for (int f = 0; f < timedFrames; f++)
+            drawModel(shader, projection, view);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsedNs);
+        double frameMs = static_cast<double>(elapsedNs) / 1e6 / timedFrames;
+        std::cout << "> " << triangleLayoutOptions[layout] << ": " << frameMs << " ms";
+        if (testsPerFrame > 0 && frameMs > 0.0)
+            std::cout << ", " << static_cast<double>(testsPerFrame) / (frameMs / 1000.0) / 1e6 << " M tests/s";
+        std::cout << "\n";
+    }
+    glDeleteQueries(1, &timerQuery);
+    std::cout << "****************************\n\n";
+
+    // Restore the active layout
+    triangleLayout = static_cast<TriangleLayout>(selectedTriangleLayout);
+    setupTriangleSSBO();
+}
+
 int main()
 {
     // Window
@@ -194,6 +912,24 @@ int main()
 
     // Shaders
     Shader raytracingShader("shaders/raytracing.vs", "shaders/raytracing.fs");
+    Shader gBufferProgram("shaders/gbuffer.vs", "shaders/gbuffer.fs");
+    Shader presentShader("shaders/raytracing.vs", "shaders/present.fs");
+    Shader upscaleShader("shaders/raytracing.vs", "shaders/upscale.fs");
+    Shader reprojectShader("shaders/raytracing.vs", "shaders/reproject.fs");
+    Shader interleaveMaskShader("shaders/raytracing.vs", "shaders/interleave_mask.fs");
+    Shader interleaveResolveShader("shaders/raytracing.vs", "shaders/interleave_resolve.fs");
+    Shader adaptiveMaskShader("shaders/raytracing.vs", "shaders/adaptive_mask.fs");
+    gBufferShader = &gBufferProgram;
+    frameUniforms.setup();
+    shaderHotReload.watch(&raytracingShader);
+    shaderHotReload.watch(&gBufferProgram);
+    shaderHotReload.watch(&presentShader);
+    shaderHotReload.watch(&upscaleShader);
+    shaderHotReload.watch(&reprojectShader);
+    shaderHotReload.watch(&interleaveMaskShader);
+    shaderHotReload.watch(&interleaveResolveShader);
+    shaderHotReload.watch(&adaptiveMaskShader);
+    shaderHotReload.start("shaders");
 
     // Models
     loadModels();
@@ -236,6 +972,12 @@ int main()
         // User input handling
         processUserInput(window);
 
+        // Swap in shaders edited since the last frame (a reloaded program may reuse a deleted one's ID)
+        unsigned int reloads = shaderHotReload.reloadCount();
+        shaderHotReload.update();
+        if (shaderHotReload.reloadCount() != reloads)
+            raytracingUniforms.clear();
+
         // Setup IMGUI frame
         if (!fpsTracker.active)
             ImGuiNewFrame();
@@ -243,11 +985,40 @@ int main()
         // Check if model changed
         if (modelChanged)
         {
-            getTriangleBuffer(allModels[selectedModel]);    // Recreate CPU-side buffer
-            setupSSBO();                                    // Re-upload to GPU SSBO
+            applyBuildSettings();
+            getTriangleBuffer(allModels[selectedModel]);    // Recreate CPU-side buffer and BVH
+            setupSSBO();                                    // Re-upload to GPU SSBOs
             modelChanged = false;
         }
 
+        // Only the TLAS depends on the grid, the model's BVH is reused as is
+        if (instancesChanged)
+        {
+            instanceGridSize = selectedInstanceGrid;
+            buildSceneInstances();
+            setupInstanceSSBO();
+            instancesChanged = false;
+        }
+
+        // Both layouts index the same BVH slots, so only the triangle buffers are re-uploaded
+        if (triangleLayoutChanged)
+        {
+            triangleLayout = static_cast<TriangleLayout>(selectedTriangleLayout);
+            setupTriangleSSBO();
+            triangleLayoutChanged = false;
+        }
+
+        // Skin the animated model and refit (or rebuild) its BVH
+        if (animateModel)
+            animateScene(deltaTime, rebuildThreshold);
+
+        // Compare quality and fast builds across all models
+        if (compareBuilds)
+        {
+            runBuildComparison();
+            compareBuilds = false;
+        }
+
         // View and projection
         if (zoomIn)
             camera.position = glm::vec3(0.0f, 0.0f, 4.0f);
@@ -259,12 +1030,96 @@ int main()
             static_cast<float>(SCREEN_WIDTH) / static_cast<float>(SCREEN_HEIGHT), 
             0.1f, 1000.0f);
 
+        // Compare spatial-split and plain SAH traversal cost from the current view
+        if (compareSplits)
+        {
+            runSplitComparison(view, projection);
+            compareSplits = false;
+        }
+
+        // Compare binary and wide node traversal cost from the current view
+        if (compareWidths)
+        {
+            runWidthComparison(view, projection);
+            compareWidths = false;
+        }
+
+        // Time every traversal kernel on every model from the current view
+        if (compareKernels)
+        {
+            runKernelComparison(raytracingShader, projection, view);
+            compareKernels = false;
+        }
+
+        // Triangle test throughput per triangle layout
+        if (compareTriangles)
+        {
+            runTriangleComparison(raytracingShader, projection, view);
+            compareTriangles = false;
+        }
+
+        // Time the fragment megakernel against the wavefront kernels
+        if (compareBackends)
+        {
+            runBackendComparison(raytracingShader, presentShader, projection, view);
+            compareBackends = false;
+        }
+
+        // Uniform against adaptive accumulation at equal GPU time on every model and skybox
+        if (compareSampling)
+        {
+            runSamplingComparison(raytracingShader, adaptiveMaskShader, projection, view);
+            compareSampling = false;
+        }
+
+        // Time and score the interleaved patterns against full tracing over a camera pan
+        if (compareInterleaved)
+        {
+            runInterleavedComparison(raytracingShader, interleaveMaskShader, interleaveResolveShader, projection, view);
+            compareInterleaved = false;
+        }
+
         // Update FPS tracker
         if (fpsTracker.active)
             fpsTracker.update(deltaTime);
 
-        // Draw model
-        drawModel(raytracingShader, projection, view);
+        // Draw model, accumulating jittered samples until the view has converged
+        if (accumulateSamples)
+        {
+            // Adaptive sampling needs the fragment pass (stencil test and the squared luminance target)
+            uint64_t stateKey = accumulationStateKey(projection, view);
+            bool adaptive = accumulator.adaptive && selectedBackend == MegakernelBackend;
+            unsigned int passes = accumulationPasses(static_cast<unsigned int>(targetSamples), adaptive);
+            if (needsAccumulationSample(stateKey, SCREEN_WIDTH, SCREEN_HEIGHT, passes))
+            {
+                glm::mat4 jittered = jitterProjection(projection, accumulator.sampleCount, SCREEN_WIDTH, SCREEN_HEIGHT);
+                if (selectedBackend != MegakernelBackend)
+                {
+                    // The kernels add into the buffer themselves, the blend state is unused
+                    beginAccumulationSample();
+                    setupComputeBackend();
+                    drawModelCompute(jittered, view, accumulator.texture, true);
+                }
+                else
+                {
+                    if (adaptive)
+                        beginAdaptiveSample(adaptiveMaskShader, fsVAO);
+                    else
+                        beginAccumulationSample();
+                    drawModel(raytracingShader, jittered, view);
+                }
+                endAccumulationSample();
+            }
+            presentAccumulation(presentShader, fsVAO);
+        }
+        else if (temporalReuse.enabled && selectedBackend == MegakernelBackend)
+            drawFrameTemporal(raytracingShader, reprojectShader, projection, view);
+        else if (interleaved.pattern != 0 && selectedBackend == MegakernelBackend)
+            drawFrameInterleaved(raytracingShader, interleaveMaskShader, interleaveResolveShader, projection, view);
+        else if (dynamicResolution.enabled)
+            drawFrameScaled(raytracingShader, upscaleShader, projection, view);
+        else
+            drawFrame(raytracingShader, presentShader, projection, view);
 
         // If screenshot
         if (takeScreenshot)
@@ -281,7 +1136,7 @@ int main()
 
         // IMGUI drawing
         if (!fpsTracker.active)
-            ImGuiDrawWindow();
+            ImGuiDrawWindow(bvhBuildStats, sceneSkin.active() ? &animationStats : nullptr);
 
         // Swap buffers and poll events
         glfwSwapBuffers(window);
@@ -294,7 +1149,17 @@ int main()
     ImGui::DestroyContext();
 
     // Clean up
+    shaderHotReload.stop();
     cleanupRayTracing();
+    cleanupGBuffer();
+    frameUniforms.cleanup();
+    cleanupAccumulation();
+    cleanupWavefront();
+    cleanupComputeTracer();
+    cleanupDynamicResolution();
+    cleanupTemporalReuse();
+    cleanupInterleaved();
+    raytracingVariants.clear();
 
     // Destroy window
     glfwDestroyWindow(window);
@@ -374,6 +1239,8 @@ void frameBufferSizeCallback(GLFWwindow* window, int width, int height)
     // Adjust screen width and height params that set the aspect ratio in the projection matrix
     SCREEN_WIDTH = width;
     SCREEN_HEIGHT = height;
+    traceWidth = width;
+    traceHeight = height;
 }
 
 // Mouse input callback
@@ -0,0 +1,219 @@
+// Standalone BVH quality inspector: loads a model through Model (no window or GL context), builds its
+// acceleration structure with the given parameters, prints the tree's quality and memory and traces a
+// CPU ray set that follows raytracing.fs, optionally followed by a triangle test benchmark. With
+// --instances N the ray set goes through a TLAS over an N x N grid of the model, as the renderer's
+// instance grid does. Built from this file plus src/glad.c and src/stb.cpp.
+//
+// Usage: bvh_inspector <model> [--mode sah|lbvh|sbvh] [--width 2|4|8] [--bins N] [--leaf N]
+//                             [--traversal-cost F] [--intersect-cost F] [--threads N]
+//                             [--rays WxH] [--bounces N] [--min-throughput F] [--ior F] [--distance F]
+//                             [--instances N] [--cache] [--tri-bench]
+
+#include <my_model.h>
+#include <my_camera.h>
+#include <my_raytracing.h>
+#include <my_cpu_tracer.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+struct InspectorOptions
+{
+    std::string modelPath;
+    BVHBuildParams params;
+    int rayWidth = 320;
+    int rayHeight = 180;
+    int maxBounces = 4;         // Same as the bounce loop in raytracing.fs
+    float minThroughput = 0.02f;    // Same as the renderer's default, 0 never stops a path early
+    float ior = 1.5f;
+    float cameraDistance = 5.0f;
+    int instanceGrid = 1;       // Above 1 traces an instanceGrid^2 grid of the model through the TLAS
+    bool useCache = false;      // Off by default so build times are real builds
+    bool triangleBench = false; // Möller–Trumbore against unit triangle tests over the primary rays
+};
+
+void printUsage()
+{
+    std::cout << "Usage: bvh_inspector <model> [--mode sah|lbvh|sbvh] [--width 2|4|8] [--bins N] [--leaf N]\n"
+        << "                     [--traversal-cost F] [--intersect-cost F] [--threads N]\n"
+        << "                     [--rays WxH] [--bounces N] [--min-throughput F] [--ior F] [--distance F]\n"
+        << "                     [--instances N] [--cache] [--tri-bench]\n";
+}
+
+bool parseOptions(int argc, char** argv, InspectorOptions& options)
+{
+    if (argc < 2)
+        return false;
+    options.modelPath = argv[1];
+
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--cache")
+            options.useCache = true;
+        else if (arg == "--tri-bench")
+            options.triangleBench = true;
+        else if (!hasValue)
+        {
+            std::cout << "Missing value for " << arg << "\n";
+            return false;
+        }
+        else if (arg == "--mode")
+        {
+            std::string mode = argv[++i];
+            if (mode == "sah")
+                options.params.mode = QualityBuild;
+            else if (mode == "lbvh")
+                options.params.mode = FastBuild;
+            else if (mode == "sbvh")
+                options.params.mode = SpatialSplitBuild;
+            else
+            {
+                std::cout << "Unknown build mode " << mode << "\n";
+                return false;
+            }
+        }
+        else if (arg == "--width")
+        {
+            options.params.width = std::atoi(argv[++i]);
+            if (options.params.width != 2 && options.params.width != 4 && options.params.width != 8)
+            {
+                std::cout << "Width must be 2, 4 or 8\n";
+                return false;
+            }
+        }
+        else if (arg == "--bins")
+            options.params.binCount = std::max(2, std::atoi(argv[++i]));
+        else if (arg == "--leaf")
+            options.params.maxLeafSize = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--traversal-cost")
+            options.params.traversalCost = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--intersect-cost")
+            options.params.intersectCost = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--threads")
+            options.params.threadCount = static_cast<unsigned int>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--rays")
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &options.rayWidth, &options.rayHeight) != 2
+                || options.rayWidth <= 0 || options.rayHeight <= 0)
+            {
+                std::cout << "Rays must be given as WxH\n";
+                return false;
+            }
+        }
+        else if (arg == "--bounces")
+            options.maxBounces = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--min-throughput")
+            options.minThroughput = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+        else if (arg == "--ior")
+            options.ior = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--distance")
+            options.cameraDistance = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--instances")
+            options.instanceGrid = std::clamp(std::atoi(argv[++i]), 1, 10);
+        else
+        {
+            std::cout << "Unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Leaf count by primitive count, plus how many primitives sit in leaves of each size
+void printLeafHistogram(const BVH& bvh)
+{
+    std::vector<unsigned int> histogram;
+    for (const GPUBVHNode& node : bvh.nodes)
+    {
+        if (!node.isLeaf())
+            continue;
+        if (histogram.size() <= node.triCount)
+            histogram.resize(node.triCount + 1, 0);
+        histogram[node.triCount]++;
+    }
+
+    std::cout << "Leaf Size Histogram:\n";
+    for (size_t size = 1; size < histogram.size(); size++)
+    {
+        if (histogram[size] == 0)
+            continue;
+        std::cout << "> " << size << " prims: " << histogram[size] << " leaves ("
+            << static_cast<unsigned long long>(histogram[size]) * size << " prims)\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    InspectorOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printUsage();
+        return 1;
+    }
+
+    Model model(options.modelPath, GL_LINEAR, false);
+    if (model.meshes.empty())
+    {
+        std::cout << "No meshes loaded from " << options.modelPath << "\n";
+        return 1;
+    }
+
+    // Build through the same path as the renderer
+    bvhBuildParams = options.params;
+    bvhCacheEnabled = options.useCache;
+    instanceGridSize = options.instanceGrid;
+    getTriangleBuffer(model);
+
+    std::cout << "****************************\n";
+    std::cout << "BVH Quality (" << options.modelPath << "):\n";
+    std::cout << "> SAH Cost: " << computeSAHCost(sceneBVH, bvhBuildParams) << "\n";
+    std::cout << "> Depth: " << bvhBuildStats.maxDepth << "\n";
+    std::cout << "> Nodes: " << sceneBVH.nodes.size() << " binary";
+    if (bvhBuildStats.width > 2)
+        std::cout << ", " << sceneWideBVH.nodeCount << " BVH" << bvhBuildStats.width;
+    std::cout << "\n";
+    std::cout << "> Node Memory: " << static_cast<double>(bvhBuildStats.nodeBytes) / 1024.0 << " KB\n";
+    std::cout << "> Triangle Memory: " << static_cast<double>(triangleBuffer.size() * sizeof(GPUTriangle)) / 1024.0
+        << " KB full, " << static_cast<double>(indexedTriangleBytes()) / 1024.0 << " KB indexed ("
+        << triangleBuffer.size() << " triangles, " << sceneMesh.vertices.size() << " vertices)\n";
+    if (!sceneInstances.instances.empty())
+        std::cout << "> TLAS: " << sceneInstances.instances.size() << " instances, " << sceneInstances.tlas.nodes.size() << " nodes\n";
+    printLeafHistogram(sceneBVH);
+
+    // Same view as the renderer's default camera
+    Camera camera(glm::vec3(0.0f, 0.0f, options.cameraDistance));
+    glm::mat4 view = camera.getViewMatrix();
+    glm::mat4 projection = glm::perspective(glm::radians(camera.zoom),
+        static_cast<float>(options.rayWidth) / static_cast<float>(options.rayHeight), 0.1f, 1000.0f);
+    std::vector<CPURay> primaryRays = generatePrimaryRays(view, projection, options.rayWidth, options.rayHeight);
+
+    RayStats stats;
+    if (!sceneInstances.instances.empty())
+        stats = traceRaySetCPU(sceneInstances, sceneBVH, sceneWideBVH, triangleBuffer, primaryRays, options.ior, options.maxBounces, options.minThroughput);
+    else if (bvhBuildStats.width > 2)
+        stats = traceRaySetCPU(sceneWideBVH, triangleBuffer, primaryRays, options.ior, options.maxBounces, options.minThroughput);
+    else
+        stats = traceRaySetCPU(sceneBVH, triangleBuffer, primaryRays, options.ior, options.maxBounces, options.minThroughput);
+    std::string label = bvhBuildStats.width > 2 ? "BVH" + std::to_string(bvhBuildStats.width) : "Binary";
+    if (!sceneInstances.instances.empty())
+        label = "TLAS + " + label + " BLAS";
+    std::cout << "Ray Set (" << options.rayWidth << "x" << options.rayHeight << " primary rays, "
+        << options.maxBounces << " bounces, min throughput " << options.minThroughput << ", IOR " << options.ior << "):\n";
+    printRayStats(label, stats);
+    if (options.triangleBench)
+    {
+        std::cout << "Triangle Tests (every primary ray against every triangle, at most 50M tests each):\n";
+        printTriangleBenchmark(benchmarkTriangleTests(triangleBuffer, primaryRays));
+    }
+    std::cout << "****************************\n";
+    return 0;
+}